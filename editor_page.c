@@ -1,8 +1,15 @@
 #include "editor_page.h"
+#include "linkgraph.h"
+#include "markdown.h"
+#include "perf.h"
+#include "trace.h"
+#include "workspace.h"
 #include <glib-object.h>
 #include <glib.h>
 #include <gtk/gtk.h>
 
+#include <string.h>
+
 G_DEFINE_TYPE(EditorPage, editor_page, G_TYPE_OBJECT)
 
 typedef enum {
@@ -18,20 +25,79 @@ static GParamSpec *obj_properties[N_PROPERTIES] = {
 
 enum editor_page_signals {
   EDITOR_PAGE_SWITCH = 0,
-  EDITOR_PAGE_NEW_ANCHOR,
   EDITOR_PAGE_LAST
 };
 
 static guint editor_signals[EDITOR_PAGE_LAST] = { 0 };
 
+/* Pages larger than this are loaded in chunks of this size from idle */
+#define LOAD_CHUNK_SIZE (64 * 1024)
+
 typedef void (*create_cb)(gpointer, gpointer);
 
+/* The tags of the markdown styles, indexed by MdStyle */
+static GtkTextTag *style_tags[MD_N_STYLES];
+
+/* Links between all pages, see editor_page_links() */
+static LinkGraph *links;
+
+/* Which pages embed which, see editor_page_embeds() */
+static LinkGraph *embeds;
+/* Shared by the text of all links */
+static GtkTextTag *link_style;
+/* Shared by the text of all embeds, which is read-only */
+static GtkTextTag *embed_style;
+/* Page tags of finalized pages, see take_page_tag() */
+static GPtrArray *spare_tags;
+/* Embedded pages changed since their embeds were last rendered */
+static GHashTable *stale;
+static guint refresh_source;
+
+/* Embeds nested deeper than this are not rendered */
+#define EMBED_MAX_DEPTH 8
+
+static void render_embed(EditorPage *page,
+                         GtkTextIter *iter,
+                         const gchar *name);
+static void mark_stale(EditorPage *page);
+
+/* User edits are recorded here if set, see editor_page_set_trace() */
+static Trace *trace;
+/* Non zero while a page edits itself rather than the user */
+static guint untraced;
+
+/* Pages with a rendered preview, most recently used first */
+#define PREVIEW_CACHE_SIZE 16
+static GQueue previews = G_QUEUE_INIT;
+
+/* Markdown read for a preview and the paragraphs shown of it */
+#define PREVIEW_MAX_BYTES 2048
+#define PREVIEW_PARAGRAPHS 3
+
 struct add_link_ctx {
   GtkTextMark *start_mark;
   GtkTextMark *stop_mark;
   EditorPage *page;
 };
 
+/* Side effects held back between editor_page_bulk_begin() and commit */
+static struct {
+  guint depth;
+  gboolean committing;
+  GPtrArray *created;
+} bulk;
+
+static void
+run_created_cb(EditorPage *self)
+{
+  if (bulk.depth > 0) {
+    g_ptr_array_add(bulk.created, self);
+    return;
+  }
+
+  ((create_cb) *self->created_cb)(self, self->user_data);
+}
+
 static gboolean
 validate_name(const gchar *name)
 {
@@ -64,90 +130,191 @@ validate_name(const gchar *name)
 }
 
 static gboolean
-validate_name_only(const gchar *name)
+is_run_bound(EditorPage *page, const GtkTextIter *iter)
 {
-  g_assert(name);
+  for (guint i = 0; i < page->run_bounds->len; i++) {
+    GtkTextIter bound;
 
-  while (name[0] != '\0') {
-    gunichar utf_c;
+    gtk_text_buffer_get_iter_at_mark(page->content, &bound,
+                                     g_ptr_array_index(page->run_bounds, i));
+    if (gtk_text_iter_equal(&bound, iter)) {
+      return TRUE;
+    }
+  }
 
-    utf_c = g_utf8_get_char(name);
+  return FALSE;
+}
 
-    if (!g_unichar_isprint(utf_c)) {
-      return FALSE;
+/* Whether a link or embed with tag starts at iter */
+static gboolean
+starts_run(EditorPage *page, const GtkTextIter *iter, GtkTextTag *tag)
+{
+  return gtk_text_iter_starts_tag(iter, tag) ||
+         (gtk_text_iter_has_tag(iter, tag) && is_run_bound(page, iter));
+}
+
+/* Moves iter inside a link or embed with tag to its end */
+static void
+forward_to_run_end(EditorPage *page, GtkTextIter *iter, GtkTextTag *tag)
+{
+  GtkTextIter from = *iter;
+
+  gtk_text_iter_forward_to_tag_toggle(iter, tag);
+
+  for (guint i = 0; i < page->run_bounds->len; i++) {
+    GtkTextIter bound;
+
+    gtk_text_buffer_get_iter_at_mark(page->content, &bound,
+                                     g_ptr_array_index(page->run_bounds, i));
+    if (gtk_text_iter_compare(&bound, &from) > 0 &&
+        gtk_text_iter_compare(&bound, iter) < 0) {
+      *iter = bound;
     }
+  }
+}
 
-    if (g_unichar_isspace(utf_c) && name[0] != ' ') {
-      return FALSE;
+/* Moves iter inside a link or embed with tag to its start */
+static void
+backward_to_run_start(EditorPage *page, GtkTextIter *iter, GtkTextTag *tag)
+{
+  GtkTextIter from = *iter;
+
+  if (!gtk_text_iter_starts_tag(iter, tag)) {
+    gtk_text_iter_backward_to_tag_toggle(iter, tag);
+  }
+
+  for (guint i = 0; i < page->run_bounds->len; i++) {
+    GtkTextIter bound;
+
+    gtk_text_buffer_get_iter_at_mark(page->content, &bound,
+                                     g_ptr_array_index(page->run_bounds, i));
+    if (gtk_text_iter_compare(&bound, iter) > 0 &&
+        gtk_text_iter_compare(&bound, &from) <= 0) {
+      *iter = bound;
     }
+  }
+}
 
-    name = g_utf8_next_char(name);
+/* Moves iter to the next place a run may start, FALSE at the end */
+static gboolean
+next_run_start(EditorPage *page, GtkTextIter *iter)
+{
+  GtkTextIter from = *iter;
+  gboolean found = gtk_text_iter_forward_to_tag_toggle(iter, NULL);
+
+  for (guint i = 0; i < page->run_bounds->len; i++) {
+    GtkTextIter bound;
+
+    gtk_text_buffer_get_iter_at_mark(page->content, &bound,
+                                     g_ptr_array_index(page->run_bounds, i));
+    if (gtk_text_iter_compare(&bound, &from) > 0 &&
+        gtk_text_iter_compare(&bound, iter) < 0) {
+      *iter = bound;
+      found = TRUE;
+    }
   }
 
-  return TRUE;
+  return found;
+}
+
+/* Two runs of tag that meet at iter stay two links or embeds */
+static void
+keep_apart(EditorPage *page, const GtkTextIter *iter, GtkTextTag *tag)
+{
+  GtkTextIter before = *iter;
+
+  if (!gtk_text_iter_has_tag(iter, tag) ||
+      !gtk_text_iter_backward_char(&before) ||
+      !gtk_text_iter_has_tag(&before, tag) || is_run_bound(page, iter)) {
+    return;
+  }
+
+  g_ptr_array_add(page->run_bounds,
+                  gtk_text_buffer_create_mark(page->content, NULL, iter, TRUE));
+}
+
+/* Turns [start, end) into a link to the page name, creating a stub page if
+ * there is none. The caller has already removed the brackets. */
+static void
+tag_link(EditorPage *page,
+         GtkTextIter *start,
+         GtkTextIter *end,
+         const gchar *name,
+         GdkRGBA *color)
+{
+  EditorPage *other;
+
+  other = g_hash_table_lookup(page->pages, name);
+
+  if (!other) {
+    other = editor_page_new(name, page->pages, color, page->created_cb,
+                            page->user_data);
+    link_graph_set_stub(editor_page_links(), other, TRUE);
+  }
+
+  gtk_text_buffer_apply_tag(page->content, link_style, start, end);
+  gtk_text_buffer_apply_tag(page->content, other->tag, start, end);
+  keep_apart(page, start, other->tag);
+  keep_apart(page, end, other->tag);
+  link_graph_add_link(editor_page_links(), page, other);
 }
 
 static void
 add_link_anchor(gpointer user_data)
 {
   struct add_link_ctx *ctx = (struct add_link_ctx *) user_data;
-  EditorPage *other;
   GtkTextBuffer *buffer;
   GtkTextIter start, end;
-  // GtkWidget *label;
+  GtkTextIter before;
   gchar *name;
-  GtkTextChildAnchor *anchor;
-  GtkWidget *button;
+  gint64 begin = perf_begin();
 
   buffer = ctx->page->content;
-  /*
-  start_mark = gtk_text_buffer_get_mark(buffer, "start-new-link");
-  stop_mark = gtk_text_buffer_get_mark(buffer, "stop-new-link");
-*/
+  untraced++;
 
   gtk_text_buffer_get_iter_at_mark(buffer, &start, ctx->start_mark);
   gtk_text_buffer_get_iter_at_mark(buffer, &end, ctx->stop_mark);
 
   name = gtk_text_iter_get_text(&start, &end);
-  g_print("ADD_LINK NAME %s\n", name);
 
-  gtk_text_iter_backward_char(&start);
-  gtk_text_iter_backward_char(&start);
-  gtk_text_iter_forward_char(&end);
-  gtk_text_iter_forward_char(&end);
+  /* Only the brackets go, the name stays as the link text */
+  gtk_text_iter_forward_chars(&end, 2);
+  gtk_text_buffer_get_iter_at_mark(buffer, &start, ctx->stop_mark);
   gtk_text_buffer_delete(buffer, &start, &end);
 
-  anchor = gtk_text_buffer_create_child_anchor(buffer, &start);
-
-  other = g_hash_table_lookup(ctx->page->pages, name);
+  gtk_text_buffer_get_iter_at_mark(buffer, &start, ctx->start_mark);
+  end = start;
+  gtk_text_iter_backward_chars(&start, 2);
+  gtk_text_buffer_delete(buffer, &start, &end);
 
-  if (!other) {
-    other = editor_page_new(name, ctx->page->pages, NULL, ctx->page->created_cb,
-                            ctx->page->user_data);
+  gtk_text_buffer_get_iter_at_mark(buffer, &start, ctx->start_mark);
+  gtk_text_buffer_get_iter_at_mark(buffer, &end, ctx->stop_mark);
+  before = start;
+  if (gtk_text_iter_backward_char(&before) &&
+      gtk_text_iter_get_char(&before) == '!') {
+    /* ![[Name]] shows the page rather than linking to it */
+    gtk_text_buffer_delete(buffer, &before, &end);
+    render_embed(ctx->page, &before, name);
+  } else {
+    tag_link(ctx->page, &start, &end, name, NULL);
   }
-  g_object_set_data(G_OBJECT(anchor), "target", other);
-
-  g_ptr_array_add(ctx->page->anchors, g_object_ref(anchor));
-
-  // gtk_text_view_add_child_at_anchor(textarea, widget, anchor);
-  /* EMIT new anchor */
-  button = editor_page_in_content_button(other);
-  g_object_set_data(G_OBJECT(button), "anchor", anchor);
-  g_object_set_data(G_OBJECT(button), "target", ctx->page);
-
-  g_signal_emit(ctx->page, editor_signals[EDITOR_PAGE_NEW_ANCHOR], 0, anchor,
-                button);
 
+  gtk_text_buffer_delete_mark(buffer, ctx->start_mark);
+  gtk_text_buffer_delete_mark(buffer, ctx->stop_mark);
   g_free(name);
   g_free(ctx);
+
+  untraced--;
+  perf_sample(PERF_TAG_LINK, begin);
 }
 
+/* Watches typed text for [[ and ]], the link is made from idle */
 static void
-insert_text(GtkTextBuffer *self,
-            const GtkTextIter *location,
-            gchar *text,
-            gint len,
-            gpointer user_data)
+check_link_brackets(GtkTextBuffer *self,
+                    const GtkTextIter *location,
+                    gchar *text,
+                    gint len,
+                    gpointer user_data)
 {
   static gchar last = ' ';
   EditorPage *page = EDITOR_PAGE(user_data);
@@ -181,7 +348,6 @@ insert_text(GtkTextBuffer *self,
 
         gtk_text_iter_forward_char(&start_location);
         gtk_text_iter_forward_char(&start_location);
-        g_print("NAME: %s\n", name);
 
         ctx->start_mark = gtk_text_buffer_create_mark(self, NULL,
                                                       &start_location, TRUE);
@@ -197,429 +363,1657 @@ insert_text(GtkTextBuffer *self,
     return;
   }
   last = text[0];
-  g_print("Inserted txt: %s\n", text);
 }
 
-static GtkTextMark *
-fix_last_anchor(EditorPage *page, GtkTextMark *start_mark)
+static void
+insert_text(GtkTextBuffer *self,
+            const GtkTextIter *location,
+            gchar *text,
+            gint len,
+            gpointer user_data)
 {
-  GtkTextChildAnchor *anchor;
-  EditorPage *other;
-  GtkTextBuffer *buffer;
-  GtkTextIter start;
-  GtkTextIter match_begin_start;
-  GtkTextIter match_begin_end;
-  GtkTextIter match_stop_start;
-  GtkTextIter match_stop_end;
+  EditorPage *page = EDITOR_PAGE(user_data);
+  gint64 begin = perf_begin();
+
+  if (trace != NULL && page->quiet == 0 && untraced == 0) {
+    trace_insert(trace, page->heading, gtk_text_iter_get_offset(location),
+                 text, len);
+  }
+
+  check_link_brackets(self, location, text, len, user_data);
+
+  perf_sample(PERF_INSERT_TEXT, begin);
+}
+
+struct markup_edit {
+  glong offset;
+  glong len;
+};
+
+struct markup_link {
+  glong offset;
+  glong len;
   gchar *name;
-  GtkTextMark *return_mark = NULL;
-  GtkWidget *button;
+};
 
-  buffer = page->content;
+struct markup_span {
+  MdStyle style;
+  glong start;
+  glong end;
+};
 
-  if (start_mark != NULL) {
-    gtk_text_buffer_get_iter_at_mark(buffer, &start, start_mark);
-  } else {
-    gtk_text_buffer_get_end_iter(buffer, &start);
-  }
+/* The page a page tag stands for, see take_page_tag() */
+static EditorPage *
+tag_target(GtkTextTag *tag)
+{
+  return g_object_get_data(G_OBJECT(tag), "page");
+}
+
+/* The page whose tag is at iter, with style over it */
+static EditorPage *
+target_at(const GtkTextIter *iter, GtkTextTag *style)
+{
+  GSList *tags;
+  EditorPage *target = NULL;
 
-  if (!gtk_text_iter_backward_search(&start, "]]", GTK_TEXT_SEARCH_TEXT_ONLY,
-                                     &match_stop_start, &match_stop_end, NULL)) {
-    g_print("DID NOT FIND ]]\n");
+  if (!gtk_text_iter_has_tag(iter, style)) {
     return NULL;
   }
 
-  if (!gtk_text_iter_backward_search(&match_stop_start, "[[",
-                                     GTK_TEXT_SEARCH_TEXT_ONLY,
-                                     &match_begin_start, &match_begin_end,
-                                     NULL)) {
-    g_print("DID NOT FIND [[\n");
-    return NULL;
+  tags = gtk_text_iter_get_tags(iter);
+  for (GSList *tag = tags; tag != NULL && target == NULL; tag = tag->next) {
+    target = tag_target(tag->data);
   }
+  g_slist_free(tags);
 
-  gtk_text_iter_backward_char(&match_begin_start);
-  return_mark = gtk_text_buffer_create_mark(buffer, NULL, &match_begin_start,
-                                            TRUE);
-  gtk_text_iter_forward_char(&match_begin_start);
+  return target;
+}
 
-  name = gtk_text_iter_get_text(&match_begin_end, &match_stop_start);
+EditorPage *
+editor_page_embed_at(const GtkTextIter *iter)
+{
+  return target_at(iter, embed_style);
+}
 
-  g_print("FOUND NAME: %s\n", name);
-  if (!validate_name_only(name)) {
-    return_mark = gtk_text_buffer_create_mark(buffer, NULL, &match_begin_start,
-                                              TRUE);
-    goto out;
-  }
+/* Text whose markers are not markup: the text of an embed is another page's,
+ * that of a link is a page name, which may have them, and code is code */
+static gboolean
+is_verbatim(const GtkTextIter *iter)
+{
+  return gtk_text_iter_has_tag(iter, embed_style) ||
+         gtk_text_iter_has_tag(iter, link_style) ||
+         gtk_text_iter_has_tag(iter, style_tags[MD_CODE_BLOCK]) ||
+         gtk_text_iter_has_tag(iter, style_tags[MD_CODE]);
+}
 
-  return_mark = gtk_text_buffer_create_mark(buffer, NULL, &match_begin_start,
-                                            TRUE);
+static gboolean
+range_has_tag(const GtkTextIter *start,
+              const GtkTextIter *end,
+              GtkTextTag *tag)
+{
+  GtkTextIter iter = *start;
 
-  /* Invalidates all the iterators above */
-  gtk_text_buffer_delete(buffer, &match_begin_start, &match_stop_end);
+  return gtk_text_iter_has_tag(start, tag) ||
+         (gtk_text_iter_forward_to_tag_toggle(&iter, tag) &&
+          gtk_text_iter_compare(&iter, end) < 0);
+}
 
-  gtk_text_buffer_get_iter_at_mark(buffer, &start, return_mark);
-  anchor = gtk_text_buffer_create_child_anchor(buffer, &start);
+static gboolean
+range_has_verbatim(const GtkTextIter *start, const GtkTextIter *end)
+{
+  return range_has_tag(start, end, embed_style) ||
+         range_has_tag(start, end, link_style) ||
+         range_has_tag(start, end, style_tags[MD_CODE_BLOCK]) ||
+         range_has_tag(start, end, style_tags[MD_CODE]);
+}
 
-  other = g_hash_table_lookup(page->pages, name);
+/*
+ * Turns the tokens in verbatim text at base back into text, and with them
+ * the markers they were paired with
+ */
+static void
+demote_verbatim(EditorPage *page,
+                const gchar *text,
+                GArray *tokens,
+                glong base)
+{
+  gint open[MD_N_STYLES];
+  glong in = 0;
 
-  if (!other) {
-    other = editor_page_new(name, page->pages, &page->color, page->created_cb,
-                            page->user_data);
+  for (guint i = 0; i < MD_N_STYLES; i++) {
+    open[i] = -1;
   }
 
-  g_object_set_data(G_OBJECT(anchor), "target", other);
+  for (guint i = 0; i < tokens->len; i++) {
+    MdToken *token = &g_array_index(tokens, MdToken, i);
+    GtkTextIter iter;
 
-  g_ptr_array_add(page->anchors, g_object_ref(anchor));
+    if (token->type != MD_TOKEN_TEXT) {
+      gtk_text_buffer_get_iter_at_offset(page->content, &iter, base + in);
+      if (is_verbatim(&iter)) {
+        token->type = MD_TOKEN_TEXT;
+      }
+    }
+    in += g_utf8_strlen(text + token->offset, token->len);
 
-  // gtk_text_view_add_child_at_anchor(textarea, widget, anchor);
-  /* EMIT new anchor */
-  button = editor_page_in_content_button(other);
-  g_object_set_data(G_OBJECT(button), "anchor", anchor);
-  g_object_set_data(G_OBJECT(button), "target", page);
+    if (token->type == MD_TOKEN_OPEN) {
+      open[token->style] = i;
+    } else if (token->type == MD_TOKEN_CLOSE) {
+      if (open[token->style] < 0) {
+        token->type = MD_TOKEN_TEXT;
+      }
+      open[token->style] = -1;
+    }
+  }
 
-  g_signal_emit(page, editor_signals[EDITOR_PAGE_NEW_ANCHOR], 0, anchor, button);
-  g_print("Returning a mark\n");
-out:
-  g_free(name);
-  return return_mark;
+  for (guint i = 0; i < MD_N_STYLES; i++) {
+    if (open[i] >= 0) {
+      g_array_index(tokens, MdToken, open[i]).type = MD_TOKEN_TEXT;
+    }
+  }
 }
 
+/*
+ * Converts the markdown in [start, end) to tags and links. The range is
+ * tokenized once, then the markers and link brackets are removed back to
+ * front so the offsets of earlier ones stay valid, and last the tags are
+ * placed by their offsets in the cleaned up text.
+ */
 static void
-fix_anchors(EditorPage *page)
+apply_markup(EditorPage *page,
+             GtkTextMark *start_mark,
+             GtkTextMark *end_mark,
+             MdParseFlags flags)
 {
-  GtkTextMark *mark = NULL;
+  GtkTextIter start;
+  GtkTextIter end;
+  GArray *tokens;
+  GArray *edits;
+  GArray *links;
+  GArray *embedded;
+  GArray *spans;
+  glong open_at[MD_N_STYLES] = { 0 };
+  glong base;
+  glong in = 0;
+  glong out = 0;
+  gchar *text;
 
-  mark = fix_last_anchor(page, mark);
-  while (mark != NULL) {
-    mark = fix_last_anchor(page, mark);
+  if (start_mark != NULL) {
+    gtk_text_buffer_get_iter_at_mark(page->content, &start, start_mark);
+  } else {
+    gtk_text_buffer_get_start_iter(page->content, &start);
+  }
+  if (end_mark != NULL) {
+    gtk_text_buffer_get_iter_at_mark(page->content, &end, end_mark);
+  } else {
+    gtk_text_buffer_get_end_iter(page->content, &end);
   }
-}
 
-static void
-fix_tags(EditorPage *page)
-{
-  GtkTextIter start;
-  GtkTextIter match_start;
-  GtkTextIter match_end;
-  GtkTextIter bold_end_iter;
-  GtkTextMark *mark = NULL;
-  GtkTextMark *bold_end = NULL;
-  gboolean bold;
+  page->quiet++;
 
-  gtk_text_buffer_get_end_iter(page->content, &start);
+  base = gtk_text_iter_get_offset(&start);
+  text = gtk_text_iter_get_slice(&start, &end);
+  tokens = md_tokenize(text, strlen(text), flags);
+  if (range_has_verbatim(&start, &end)) {
+    demote_verbatim(page, text, tokens, base);
+  }
 
-  while (true) {
-    if (!gtk_text_iter_backward_search(&start, "**", GTK_TEXT_SEARCH_TEXT_ONLY,
-                                       &match_start, &match_end, NULL)) {
-      return;
+  edits = g_array_new(FALSE, FALSE, sizeof(struct markup_edit));
+  links = g_array_new(FALSE, FALSE, sizeof(struct markup_link));
+  embedded = g_array_new(FALSE, FALSE, sizeof(struct markup_link));
+  spans = g_array_new(FALSE, FALSE, sizeof(struct markup_span));
+
+  for (guint i = 0; i < tokens->len; i++) {
+    MdToken *token = &g_array_index(tokens, MdToken, i);
+    glong chars = g_utf8_strlen(text + token->offset, token->len);
+    struct markup_edit edit = { base + in, chars };
+
+    switch (token->type) {
+    case MD_TOKEN_TEXT:
+      out += chars;
+      break;
+    case MD_TOKEN_OPEN:
+      open_at[token->style] = out;
+      break;
+    case MD_TOKEN_CLOSE: {
+      struct markup_span span = { token->style, base + open_at[token->style],
+                                  base + out };
+      g_array_append_val(spans, span);
+      break;
+    }
+    case MD_TOKEN_LINK: {
+      struct markup_link link = { base + out, chars - 4,
+                                  md_link_target(text, token) };
+      struct markup_edit open = { base + in, 2 };
+      struct markup_edit close = { base + in + chars - 2, 2 };
+
+      g_array_append_val(links, link);
+      g_array_append_val(edits, open);
+      g_array_append_val(edits, close);
+      out += link.len;
+      break;
+    }
+    case MD_TOKEN_EMBED: {
+      /* One character stays in place of the embed until it is rendered */
+      struct markup_link embed = { base + out, 1,
+                                   md_link_target(text, token) };
+      struct markup_edit rest = { base + in + 1, chars - 1 };
+
+      g_array_append_val(embedded, embed);
+      g_array_append_val(edits, rest);
+      out += 1;
+      break;
+    }
     }
 
-    mark = gtk_text_buffer_create_mark(page->content, NULL, &match_start, TRUE);
-
-    if (!bold) {
-      bold_end = gtk_text_buffer_create_mark(page->content, NULL, &match_start,
-                                             TRUE);
-      bold = TRUE;
-    } else {
-      gtk_text_buffer_get_iter_at_mark(page->content, &bold_end_iter, bold_end);
-      gtk_text_buffer_apply_tag_by_name(page->content, "bold", &match_end,
-                                        &bold_end_iter);
-      bold = FALSE;
+    if (token->type != MD_TOKEN_TEXT && token->type != MD_TOKEN_LINK &&
+        token->type != MD_TOKEN_EMBED && chars > 0) {
+      g_array_append_val(edits, edit);
     }
+    in += chars;
+  }
 
-    /* Invalidates all the iterators above */
-    gtk_text_buffer_delete(page->content, &match_start, &match_end);
+  for (guint i = edits->len; i > 0; i--) {
+    struct markup_edit *edit = &g_array_index(edits, struct markup_edit, i - 1);
 
-    gtk_text_buffer_get_iter_at_mark(page->content, &start, mark);
+    gtk_text_buffer_get_iter_at_offset(page->content, &start, edit->offset);
+    gtk_text_buffer_get_iter_at_offset(page->content, &end,
+                                       edit->offset + edit->len);
+    gtk_text_buffer_delete(page->content, &start, &end);
   }
-}
 
-static void
-foreach_button_name(gpointer data, gpointer user_data)
-{
-  GtkButton *button = GTK_BUTTON(data);
-  GtkLabel *label;
-  gchar *name = (gchar *) user_data;
+  for (guint i = 0; i < links->len; i++) {
+    struct markup_link *link = &g_array_index(links, struct markup_link, i);
+
+    gtk_text_buffer_get_iter_at_offset(page->content, &start, link->offset);
+    gtk_text_buffer_get_iter_at_offset(page->content, &end,
+                                       link->offset + link->len);
+    tag_link(page, &start, &end, link->name, &page->color);
+    g_free(link->name);
+  }
+
+  for (guint i = 0; i < spans->len; i++) {
+    struct markup_span *span = &g_array_index(spans, struct markup_span, i);
+
+    gtk_text_buffer_get_iter_at_offset(page->content, &start, span->start);
+    gtk_text_buffer_get_iter_at_offset(page->content, &end, span->end);
+    gtk_text_buffer_apply_tag_by_name(page->content,
+                                      md_rule(span->style)->tag, &start, &end);
+  }
+
+  /* Back to front, each one changes the length of the text after it */
+  for (guint i = embedded->len; i > 0; i--) {
+    struct markup_link *embed = &g_array_index(embedded, struct markup_link,
+                                               i - 1);
+
+    gtk_text_buffer_get_iter_at_offset(page->content, &start, embed->offset);
+    end = start;
+    gtk_text_iter_forward_char(&end);
+    gtk_text_buffer_delete(page->content, &start, &end);
+    render_embed(page, &start, embed->name);
+    g_free(embed->name);
+  }
+
+  g_array_unref(embedded);
+  g_array_unref(spans);
+  g_array_unref(links);
+  g_array_unref(edits);
+  g_array_unref(tokens);
+  g_free(text);
 
-  label = GTK_LABEL(gtk_button_get_child(button));
-  gtk_label_set_text(label, name);
+  page->quiet--;
 }
 
+/* Paragraphs are separated by blank lines */
 static void
-update_name(EditorPage *self)
+expand_to_paragraph(GtkTextIter *start, GtkTextIter *end)
 {
-  GtkLabel *label;
+  gtk_text_iter_set_line_offset(start, 0);
+  while (!gtk_text_iter_is_start(start)) {
+    GtkTextIter prev = *start;
 
-  if (!self->page_button) {
-    return;
+    gtk_text_iter_backward_line(&prev);
+    if (gtk_text_iter_ends_line(&prev)) {
+      break;
+    }
+    *start = prev;
   }
 
-  label = GTK_LABEL(gtk_button_get_child(GTK_BUTTON(self->page_button)));
-  gtk_label_set_text(label, self->heading);
+  if (!gtk_text_iter_ends_line(end)) {
+    gtk_text_iter_forward_to_line_end(end);
+  }
+  while (TRUE) {
+    GtkTextIter next = *end;
 
-  g_ptr_array_foreach(self->buttons, foreach_button_name, self->heading);
+    if (!gtk_text_iter_forward_line(&next) || gtk_text_iter_ends_line(&next)) {
+      break;
+    }
+    *end = next;
+    gtk_text_iter_forward_to_line_end(end);
+  }
 }
 
-static void
-editor_page_finalize(GObject *obj)
+/* Re-tokenizes the paragraphs touched since the last run */
+static gboolean
+restyle(gpointer user_data)
 {
-  EditorPage *self = EDITOR_PAGE(obj);
+  EditorPage *page = EDITOR_PAGE(user_data);
+  GtkTextIter start;
+  GtkTextIter end;
+  GtkTextIter placeholder;
 
-  g_assert(self);
+  page->restyle_source = 0;
 
-  /*free stuff */
+  gtk_text_buffer_get_iter_at_mark(page->content, &start, page->dirty_start);
+  gtk_text_buffer_get_iter_at_mark(page->content, &end, page->dirty_end);
+  gtk_text_buffer_delete_mark(page->content, page->dirty_start);
+  gtk_text_buffer_delete_mark(page->content, page->dirty_end);
+  page->dirty_start = NULL;
+  page->dirty_end = NULL;
 
-  g_free(self->heading);
+  expand_to_paragraph(&start, &end);
 
-  g_clear_object(&self->content);
+  if (page->load_mark != NULL) {
+    gtk_text_buffer_get_iter_at_mark(page->content, &placeholder,
+                                     page->load_mark);
+    if (gtk_text_iter_compare(&end, &placeholder) > 0) {
+      end = placeholder;
+    }
+  }
 
-  g_clear_object(&self->page_button);
+  if (gtk_text_iter_compare(&start, &end) >= 0) {
+    return G_SOURCE_REMOVE;
+  }
 
-  /* Always chain up to the parent finalize function to complete object
-   * destruction. */
-  G_OBJECT_CLASS(editor_page_parent_class)->finalize(obj);
+  page->dirty_start = gtk_text_buffer_create_mark(page->content, NULL, &start,
+                                                  TRUE);
+  page->dirty_end = gtk_text_buffer_create_mark(page->content, NULL, &end,
+                                                FALSE);
+
+  /* Links are handled as they are typed, see insert_text(). The markers
+   * go in one undo step of their own, see undo_begin(). */
+  gtk_text_buffer_begin_user_action(page->content);
+  apply_markup(page, page->dirty_start, page->dirty_end, MD_PARSE_NO_LINKS);
+  gtk_text_buffer_end_user_action(page->content);
+
+  gtk_text_buffer_delete_mark(page->content, page->dirty_start);
+  gtk_text_buffer_delete_mark(page->content, page->dirty_end);
+  page->dirty_start = NULL;
+  page->dirty_end = NULL;
+
+  return G_SOURCE_REMOVE;
 }
 
 static void
-get_property(GObject *object, guint property_id, GValue *value, GParamSpec *pspec)
+mark_dirty(EditorPage *page, const GtkTextIter *start, const GtkTextIter *end)
 {
-  EditorPage *self = EDITOR_PAGE(object);
-
-  switch ((EditorPageProperty) property_id) {
-  case PROP_HEADING:
-    g_value_set_string(value, self->heading);
-    break;
+  GtkTextIter iter;
 
-  case PROP_CONTENT:
-    g_value_set_object(value, self->content);
-    break;
+  if (page->quiet > 0 || page->undoing || !page->fixed) {
+    return;
+  }
 
-  case PROP_PAGE_BUTTON:
-    g_value_set_object(value, self->page_button);
-    break;
+  if (page->dirty_start == NULL) {
+    page->dirty_start = gtk_text_buffer_create_mark(page->content, NULL, start,
+                                                    TRUE);
+    page->dirty_end = gtk_text_buffer_create_mark(page->content, NULL, end,
+                                                  FALSE);
+  } else {
+    gtk_text_buffer_get_iter_at_mark(page->content, &iter, page->dirty_start);
+    if (gtk_text_iter_compare(start, &iter) < 0) {
+      gtk_text_buffer_move_mark(page->content, page->dirty_start, start);
+    }
+    gtk_text_buffer_get_iter_at_mark(page->content, &iter, page->dirty_end);
+    if (gtk_text_iter_compare(end, &iter) > 0) {
+      gtk_text_buffer_move_mark(page->content, page->dirty_end, end);
+    }
+  }
 
-  default:
-    /* We don't have any other property... */
-    G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
-    break;
+  /* Coalesced, one run per main loop iteration however much was typed */
+  if (page->restyle_source == 0) {
+    page->restyle_source = g_idle_add(restyle, page);
   }
 }
 
+/*
+ * Undoing a restyle brings its markers back as text. Were they restyled
+ * again, Ctrl+Z would never get past them. Redo is restyled as usual.
+ */
 static void
-set_property(GObject *object,
-             guint property_id,
-             const GValue *value,
-             GParamSpec *pspec)
+undo_begin(G_GNUC_UNUSED GtkTextBuffer *buffer, gpointer user_data)
 {
-  EditorPage *self = EDITOR_PAGE(object);
+  EDITOR_PAGE(user_data)->undoing = TRUE;
+}
 
-  switch ((EditorPageProperty) property_id) {
-  case PROP_HEADING:
-    g_free(self->heading);
-    self->heading = g_value_dup_string(value);
-    update_name(self);
-    break;
-  case PROP_CONTENT:
-    g_clear_object(&self->content);
-    self->content = g_value_get_object(value);
-    break;
-  case PROP_PAGE_BUTTON:
-    g_clear_object(&self->page_button);
-    self->page_button = g_value_get_object(value);
-    break;
-  default:
-    /* We don't have any other property... */
-    G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
-    break;
-  }
+static void
+undo_end(G_GNUC_UNUSED GtkTextBuffer *buffer, gpointer user_data)
+{
+  EDITOR_PAGE(user_data)->undoing = FALSE;
 }
 
+/* Text typed into a header line or a code block continues its style */
 static void
-editor_page_class_init(EditorPageClass *klass)
+continue_block_style(EditorPage *page,
+                     const GtkTextIter *start,
+                     const GtkTextIter *end,
+                     const gchar *text,
+                     gint len)
 {
-  GObjectClass *object_class = G_OBJECT_CLASS(klass);
+  GtkTextIter before = *start;
 
-  object_class->finalize = editor_page_finalize;
-  object_class->set_property = set_property;
-  object_class->get_property = get_property;
+  if (!gtk_text_iter_backward_char(&before)) {
+    return;
+  }
 
-  obj_properties[PROP_HEADING] = g_param_spec_string("heading", "Heading",
-                                                     "Placeholder "
-                                                     "description.",
-                                                     NULL, G_PARAM_READWRITE);
+  for (MdStyle style = MD_H1; style <= MD_H3; style++) {
+    if (gtk_text_iter_has_tag(&before, style_tags[style]) &&
+        memchr(text, '\n', len) == NULL) {
+      gtk_text_buffer_apply_tag(page->content, style_tags[style], start, end);
+    }
+  }
 
-  obj_properties[PROP_CONTENT] = g_param_spec_object("content", "Content",
-                                                     "Placeholder "
-                                                     "description.",
+  if (gtk_text_iter_has_tag(&before, style_tags[MD_CODE_BLOCK]) &&
+      gtk_text_iter_has_tag(end, style_tags[MD_CODE_BLOCK])) {
+    gtk_text_buffer_apply_tag(page->content, style_tags[MD_CODE_BLOCK], start,
+                              end);
+  }
+}
+
+static void
+inserted_text(G_GNUC_UNUSED GtkTextBuffer *buffer,
+              const GtkTextIter *location,
+              gchar *text,
+              gint len,
+              gpointer user_data)
+{
+  EditorPage *page = EDITOR_PAGE(user_data);
+  GtkTextIter start = *location;
+
+  if (page->quiet > 0) {
+    return;
+  }
+
+  /* Typing into a stub makes it a page of its own */
+  link_graph_set_stub(editor_page_links(), page, FALSE);
+
+  /* location has been moved to the end of the inserted text */
+  gtk_text_iter_backward_chars(&start, g_utf8_strlen(text, len));
+
+  /* Text typed inside a link becomes part of it, so the link stays one and
+   * is saved with the new text. What can not be in a name splits it. */
+  if (!gtk_text_iter_is_start(&start) && !gtk_text_iter_is_end(location)) {
+    GtkTextIter before = start;
+    EditorPage *target;
+
+    gtk_text_iter_backward_char(&before);
+    target = editor_page_link_at(&before);
+    if (target != NULL && editor_page_link_at(location) == target &&
+        !is_run_bound(page, &start)) {
+      if (md_valid_link_name(text, len)) {
+        gtk_text_buffer_apply_tag(page->content, link_style, &start,
+                                  location);
+        gtk_text_buffer_apply_tag(page->content, target->tag, &start,
+                                  location);
+      } else {
+        link_graph_add_link(editor_page_links(), page, target);
+      }
+    }
+  }
+
+  if (!page->fixed) {
+    return;
+  }
+
+  continue_block_style(page, &start, location, text, len);
+  mark_dirty(page, &start, location);
+}
+
+EditorPage *
+editor_page_link_at(const GtkTextIter *iter)
+{
+  return target_at(iter, link_style);
+}
+
+/* Before the default handler, while the links are still in the range. Only
+ * links and embeds that are deleted as a whole go away. */
+static void
+deleting_range(G_GNUC_UNUSED GtkTextBuffer *buffer,
+               GtkTextIter *start,
+               GtkTextIter *end,
+               gpointer user_data)
+{
+  EditorPage *page = EDITOR_PAGE(user_data);
+  GtkTextIter iter = *start;
+
+  if (trace != NULL && page->quiet == 0 && untraced == 0) {
+    trace_delete(trace, page->heading, gtk_text_iter_get_offset(start),
+                 gtk_text_iter_get_offset(end));
+  }
+
+  while (gtk_text_iter_compare(&iter, end) < 0) {
+    GSList *tags = gtk_text_iter_get_tags(&iter);
+
+    for (GSList *tag = tags; tag != NULL; tag = tag->next) {
+      EditorPage *target = tag_target(tag->data);
+      LinkGraph *graph = editor_page_links();
+      GtkTextIter run_end = iter;
+
+      if (target == NULL || !starts_run(page, &iter, tag->data)) {
+        continue;
+      }
+      if (gtk_text_iter_has_tag(&iter, embed_style)) {
+        graph = editor_page_embeds();
+      }
+
+      forward_to_run_end(page, &run_end, tag->data);
+      if (gtk_text_iter_compare(&run_end, end) <= 0) {
+        link_graph_remove_link(graph, user_data, target);
+      }
+    }
+    g_slist_free(tags);
+
+    if (!next_run_start(page, &iter)) {
+      break;
+    }
+  }
+
+  /* A run that ends in the range and one that starts after it meet */
+  page->joining = FALSE;
+  if (!gtk_text_iter_is_start(start) && !gtk_text_iter_is_end(end)) {
+    GtkTextIter before = *start;
+    GSList *tags;
+
+    gtk_text_iter_backward_char(&before);
+    tags = gtk_text_iter_get_tags(&before);
+    for (GSList *tag = tags; tag != NULL; tag = tag->next) {
+      GtkTextIter run_end = before;
+
+      if (tag_target(tag->data) == NULL ||
+          !gtk_text_iter_has_tag(end, tag->data)) {
+        continue;
+      }
+
+      forward_to_run_end(page, &run_end, tag->data);
+      page->joining |= gtk_text_iter_compare(&run_end, end) <= 0;
+    }
+    g_slist_free(tags);
+  }
+}
+
+/* Drops the bounds at iter that no longer have the same link or embed on
+ * both sides */
+static void
+prune_bounds(EditorPage *page, const GtkTextIter *iter)
+{
+  for (guint i = page->run_bounds->len; i > 0; i--) {
+    GtkTextMark *mark = g_ptr_array_index(page->run_bounds, i - 1);
+    GtkTextIter bound;
+    GtkTextIter before;
+    gboolean apart = FALSE;
+
+    gtk_text_buffer_get_iter_at_mark(page->content, &bound, mark);
+    if (!gtk_text_iter_equal(&bound, iter)) {
+      continue;
+    }
+
+    before = bound;
+    if (gtk_text_iter_backward_char(&before)) {
+      GSList *tags = gtk_text_iter_get_tags(&before);
+
+      for (GSList *tag = tags; tag != NULL; tag = tag->next) {
+        apart |= tag_target(tag->data) != NULL &&
+                 gtk_text_iter_has_tag(&bound, tag->data);
+      }
+      g_slist_free(tags);
+    }
+
+    if (!apart) {
+      gtk_text_buffer_delete_mark(page->content, mark);
+      g_ptr_array_remove_index_fast(page->run_bounds, i - 1);
+    }
+  }
+}
+
+static void
+deleted_range(G_GNUC_UNUSED GtkTextBuffer *buffer,
+              GtkTextIter *start,
+              GtkTextIter *end,
+              gpointer user_data)
+{
+  EditorPage *page = EDITOR_PAGE(user_data);
+
+  if (page->joining) {
+    GSList *tags = gtk_text_iter_get_tags(start);
+
+    for (GSList *tag = tags; tag != NULL; tag = tag->next) {
+      if (tag_target(tag->data) != NULL) {
+        keep_apart(page, start, tag->data);
+      }
+    }
+    g_slist_free(tags);
+    page->joining = FALSE;
+  }
+  prune_bounds(page, start);
+
+  mark_dirty(page, start, end);
+}
+
+/* Replaces the text of every link to self in page with its heading */
+static void
+rename_links(gpointer data, gpointer user_data)
+{
+  EditorPage *page = EDITOR_PAGE(data);
+  EditorPage *self = EDITOR_PAGE(user_data);
+  GtkTextIter iter;
+
+  gtk_text_buffer_get_start_iter(page->content, &iter);
+
+  page->quiet++;
+  while (starts_run(page, &iter, self->tag) ||
+         gtk_text_iter_forward_to_tag_toggle(&iter, self->tag)) {
+    GtkTextMark *mark;
+    GtkTextIter end;
+
+    /* Embeds of self have its tag as well */
+    if (!starts_run(page, &iter, self->tag) ||
+        !gtk_text_iter_has_tag(&iter, link_style)) {
+      continue;
+    }
+
+    /* New text first, so the link is never deleted as a whole */
+    gtk_text_buffer_insert_with_tags(page->content, &iter, self->heading, -1,
+                                     link_style, self->tag, NULL);
+    mark = gtk_text_buffer_create_mark(page->content, NULL, &iter, TRUE);
+
+    end = iter;
+    forward_to_run_end(page, &end, self->tag);
+    gtk_text_buffer_delete(page->content, &iter, &end);
+
+    gtk_text_buffer_get_iter_at_mark(page->content, &iter, mark);
+    gtk_text_buffer_delete_mark(page->content, mark);
+  }
+  page->quiet--;
+}
+
+static void
+drop_preview(EditorPage *self)
+{
+  if (self->preview != NULL) {
+    g_clear_pointer(&self->preview, g_free);
+    g_queue_remove(&previews, self);
+  }
+}
+
+static void
+content_changed(G_GNUC_UNUSED GtkTextBuffer *buffer, gpointer user_data)
+{
+  drop_preview(EDITOR_PAGE(user_data));
+  mark_stale(EDITOR_PAGE(user_data));
+}
+
+static void
+update_name(EditorPage *self, const gchar *old_heading)
+{
+  GtkLabel *label;
+  GList *sources;
+  gpointer key;
+
+  drop_preview(self);
+
+  /* Keeps [[New heading]] resolving to the page */
+  if (self->pages != NULL && old_heading != NULL &&
+      g_hash_table_lookup(self->pages, old_heading) == self &&
+      !g_hash_table_contains(self->pages, self->heading) &&
+      g_hash_table_steal_extended(self->pages, old_heading, &key, NULL)) {
+    g_free(key);
+    g_hash_table_insert(self->pages, g_strdup(self->heading), self);
+  }
+
+  if (self->page_button != NULL) {
+    label = GTK_LABEL(gtk_button_get_child(GTK_BUTTON(self->page_button)));
+    gtk_label_set_text(label, self->heading);
+  }
+
+  sources = link_graph_sources(editor_page_links(), self);
+  g_list_foreach(sources, rename_links, self);
+  g_list_free(sources);
+
+  /* Their text stays, but the next save writes ![[New heading]] */
+  sources = link_graph_sources(editor_page_embeds(), self);
+  for (GList *iter = sources; iter != NULL; iter = iter->next) {
+    EditorPage *source = iter->data;
+
+    gtk_text_buffer_set_modified(source->content, TRUE);
+  }
+  g_list_free(sources);
+}
+
+static void
+editor_page_finalize(GObject *obj)
+{
+  EditorPage *self = EDITOR_PAGE(obj);
+
+  g_assert(self);
+
+  /*free stuff */
+
+  g_free(self->heading);
+  drop_preview(self);
+  if (stale != NULL) {
+    g_hash_table_remove(stale, self);
+  }
+
+  g_clear_handle_id(&self->load_source, g_source_remove);
+  g_clear_handle_id(&self->restyle_source, g_source_remove);
+  g_free(self->pending);
+
+  g_clear_object(&self->content);
+
+  g_clear_object(&self->page_button);
+
+  /* Kept for a new page, looking like a new one */
+  g_object_set_data(G_OBJECT(self->tag), "page", NULL);
+  g_object_set(self->tag, "strikethrough-set", FALSE, "background-set", FALSE,
+               NULL);
+  g_ptr_array_add(spare_tags, g_steal_pointer(&self->tag));
+  g_free(self->css_name);
+  g_ptr_array_unref(self->run_bounds);
+
+  /* Always chain up to the parent finalize function to complete object
+   * destruction. */
+  G_OBJECT_CLASS(editor_page_parent_class)->finalize(obj);
+}
+
+static void
+get_property(GObject *object, guint property_id, GValue *value, GParamSpec *pspec)
+{
+  EditorPage *self = EDITOR_PAGE(object);
+
+  switch ((EditorPageProperty) property_id) {
+  case PROP_HEADING:
+    g_value_set_string(value, self->heading);
+    break;
+
+  case PROP_CONTENT:
+    g_value_set_object(value, self->content);
+    break;
+
+  case PROP_PAGE_BUTTON:
+    g_value_set_object(value, self->page_button);
+    break;
+
+  default:
+    /* We don't have any other property... */
+    G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+    break;
+  }
+}
+
+static void
+set_property(GObject *object,
+             guint property_id,
+             const GValue *value,
+             GParamSpec *pspec)
+{
+  EditorPage *self = EDITOR_PAGE(object);
+
+  switch ((EditorPageProperty) property_id) {
+  case PROP_HEADING: {
+    gchar *old_heading = self->heading;
+
+    self->heading = g_value_dup_string(value);
+    update_name(self, old_heading);
+    g_free(old_heading);
+    break;
+  }
+  case PROP_CONTENT:
+    g_clear_object(&self->content);
+    self->content = g_value_get_object(value);
+    break;
+  case PROP_PAGE_BUTTON:
+    g_clear_object(&self->page_button);
+    self->page_button = g_value_get_object(value);
+    break;
+  default:
+    /* We don't have any other property... */
+    G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+    break;
+  }
+}
+
+static void
+editor_page_class_init(EditorPageClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+  object_class->finalize = editor_page_finalize;
+  object_class->set_property = set_property;
+  object_class->get_property = get_property;
+
+  obj_properties[PROP_HEADING] = g_param_spec_string("heading", "Heading",
+                                                     "Placeholder "
+                                                     "description.",
+                                                     NULL, G_PARAM_READWRITE);
+
+  obj_properties[PROP_CONTENT] = g_param_spec_object("content", "Content",
+                                                     "Placeholder "
+                                                     "description.",
                                                      GTK_TYPE_TEXT_BUFFER, /* default
                                                                             */
                                                      G_PARAM_READWRITE);
 
-  obj_properties[PROP_PAGE_BUTTON] = g_param_spec_object("page_button",
-                                                         "Page_button",
-                                                         "Placeholder "
-                                                         "description.",
-                                                         GTK_TYPE_BUTTON, /* default
-                                                                           */
-                                                         G_PARAM_READWRITE);
+  obj_properties[PROP_PAGE_BUTTON] = g_param_spec_object("page_button",
+                                                         "Page_button",
+                                                         "Placeholder "
+                                                         "description.",
+                                                         GTK_TYPE_BUTTON, /* default
+                                                                           */
+                                                         G_PARAM_READWRITE);
+
+  g_object_class_install_properties(object_class, N_PROPERTIES, obj_properties);
+
+  editor_signals[EDITOR_PAGE_SWITCH] = g_signal_newv("switch-page",
+                                                     G_TYPE_FROM_CLASS(klass),
+                                                     G_SIGNAL_RUN_LAST |
+                                                       G_SIGNAL_NO_RECURSE |
+                                                       G_SIGNAL_NO_HOOKS,
+                                                     NULL, NULL, NULL, NULL,
+                                                     G_TYPE_NONE, 0, NULL);
+
+}
+
+static void
+set_color(EditorPage *self, const GdkRGBA *color)
+{
+  if (color != NULL) {
+    self->color.red = color->red;
+    self->color.green = color->green;
+    self->color.blue = color->blue;
+    self->color.alpha = color->alpha;
+  }
+
+  g_object_set(self->tag, "background-rgba", &self->color, NULL);
+}
+
+void
+editor_page_set_color(EditorPage *self, const GdkRGBA *color)
+{
+  set_color(self, color);
+}
+
+static GtkTextTag *
+add_tag(GtkTextTagTable *table, const gchar *name, const gchar *first, ...)
+{
+  GtkTextTag *tag;
+  va_list args;
+
+  tag = gtk_text_tag_new(name);
+
+  va_start(args, first);
+  g_object_set_valist(G_OBJECT(tag), first, args);
+  va_end(args);
+
+  gtk_text_tag_table_add(table, tag);
+  g_object_unref(tag);
+
+  return tag;
+}
+
+GtkTextTagTable *
+editor_page_tag_table(void)
+{
+  static GtkTextTagTable *table = NULL;
+
+  if (table != NULL) {
+    return table;
+  }
+
+  /* Built once, every page buffer is created against it */
+  table = gtk_text_tag_table_new();
+
+  style_tags[MD_BOLD] = add_tag(table, md_rule(MD_BOLD)->tag, "weight", 800,
+                                NULL);
+  style_tags[MD_ITALIC] = add_tag(table, md_rule(MD_ITALIC)->tag, "style",
+                                  PANGO_STYLE_ITALIC, NULL);
+  style_tags[MD_CODE] = add_tag(table, md_rule(MD_CODE)->tag, "family",
+                                "monospace", NULL);
+  style_tags[MD_H1] = add_tag(table, md_rule(MD_H1)->tag, "weight", 800,
+                              "scale", 1.8, NULL);
+  style_tags[MD_H2] = add_tag(table, md_rule(MD_H2)->tag, "weight", 800,
+                              "scale", 1.5, NULL);
+  style_tags[MD_H3] = add_tag(table, md_rule(MD_H3)->tag, "weight", 800,
+                              "scale", 1.2, NULL);
+  style_tags[MD_CODE_BLOCK] = add_tag(table, md_rule(MD_CODE_BLOCK)->tag,
+                                      "family", "monospace",
+                                      "paragraph-background",
+                                      "rgba(127,127,127,0.15)", NULL);
+
+  add_tag(table, "loading", "editable", FALSE, "foreground", "gray", NULL);
+  link_style = add_tag(table, "link", "underline", PANGO_UNDERLINE_SINGLE,
+                       NULL);
+  embed_style = add_tag(table, "embed", "editable", FALSE, "left-margin", 40,
+                        "paragraph-background", "rgba(127,127,255,0.1)",
+                        NULL);
+
+  return table;
+}
+
+/*
+ * The tag of a page, over the text of the links to it and of its embeds.
+ * It has the color of the page and is named after its css_name. Taking a
+ * tag out of the table goes through every buffer sharing it, so tags are
+ * never removed, those of finalized pages go to new ones instead.
+ */
+static GtkTextTag *
+take_page_tag(void)
+{
+  static guint css_num = 0;
+  GtkTextTag *tag;
+  gchar *name;
+
+  if (spare_tags == NULL) {
+    spare_tags = g_ptr_array_new();
+  }
+
+  if (spare_tags->len > 0) {
+    return g_ptr_array_steal_index_fast(spare_tags, spare_tags->len - 1);
+  }
+
+  name = g_strdup_printf("page%u", ++css_num);
+  tag = gtk_text_tag_new(name);
+  gtk_text_tag_table_add(editor_page_tag_table(), tag);
+  g_free(name);
+
+  return tag;
+}
+
+static void
+editor_page_init(EditorPage *self)
+{
+  /* initialize all public and private members to reasonable default values.
+   * They are all automatically initialized to 0 to begin with. */
+
+  self->content = gtk_text_buffer_new(editor_page_tag_table());
+  self->color.red = .7;
+  self->color.green = .7;
+  self->color.blue = 1.0;
+  self->color.alpha = 1.0;
+
+  self->bold = gtk_text_tag_table_lookup(editor_page_tag_table(), "bold");
+  self->loading = gtk_text_tag_table_lookup(editor_page_tag_table(),
+                                            "loading");
+
+  self->tag = take_page_tag();
+  g_object_set_data(G_OBJECT(self->tag), "page", self);
+  g_object_get(self->tag, "name", &self->css_name, NULL);
+
+  /* The marks are content's */
+  self->run_bounds = g_ptr_array_new();
+}
+
+static void
+change_page(G_GNUC_UNUSED GObject *button, EditorPage *self)
+{
+  g_signal_emit(self, editor_signals[EDITOR_PAGE_SWITCH], 0, self);
+  // EMIT change page
+}
+
+static guint last_id = 0;
+
+EditorPage *
+editor_page_new(const gchar *heading,
+                GHashTable *pages,
+                GdkRGBA *color,
+                GCallback created_cb,
+                gpointer user_data)
+{
+  EditorPage *self;
+
+  self = g_object_new(EDITOR_TYPE_PAGE, "heading", heading, NULL);
+
+  self->id = ++last_id;
+  self->pages = pages;
+  g_hash_table_insert(pages, g_strdup(heading), self);
+
+  set_color(self, color);
+
+  g_signal_connect(self->content, "insert-text", G_CALLBACK(insert_text), self);
+  g_signal_connect_after(self->content, "insert-text",
+                         G_CALLBACK(inserted_text), self);
+  g_signal_connect_after(self->content, "delete-range",
+                         G_CALLBACK(deleted_range), self);
+  g_signal_connect(self->content, "delete-range", G_CALLBACK(deleting_range),
+                   self);
+  g_signal_connect(self->content, "changed", G_CALLBACK(content_changed),
+                   self);
+  g_signal_connect(self->content, "undo", G_CALLBACK(undo_begin), self);
+  g_signal_connect_after(self->content, "undo", G_CALLBACK(undo_end), self);
+
+  /* Nothing to fix up in a page that starts out empty */
+  self->fixed = TRUE;
+
+  link_graph_add_page(editor_page_links(), self, FALSE);
+
+  self->created_cb = created_cb;
+  self->user_data = user_data;
+  run_created_cb(self);
+
+  return self;
+}
+
+GtkWidget *
+editor_page_button(EditorPage *self)
+{
+  if (self->page_button != NULL) {
+    return self->page_button;
+  }
+
+  self->page_button = g_object_ref_sink(gtk_button_new_with_label(
+    self->heading));
+  gtk_widget_add_css_class(self->page_button, self->css_name);
+  g_signal_connect(self->page_button, "clicked", G_CALLBACK(change_page), self);
+  g_object_set_data(G_OBJECT(self->page_button), "page", self);
+
+  return self->page_button;
+}
+
+void
+editor_page_set_trace(Trace *new_trace)
+{
+  trace = new_trace;
+}
+
+void
+editor_page_bulk_begin(void)
+{
+  if (bulk.depth++ > 0) {
+    return;
+  }
+
+  if (bulk.created == NULL) {
+    bulk.created = g_ptr_array_new();
+  }
+}
+
+void
+editor_page_bulk_commit(void)
+{
+  g_return_if_fail(bulk.depth > 0);
+
+  if (--bulk.depth > 0) {
+    return;
+  }
+
+  bulk.committing = TRUE;
+
+  for (guint i = 0; i < bulk.created->len; i++) {
+    EditorPage *page = g_ptr_array_index(bulk.created, i);
+
+    ((create_cb) *page->created_cb)(page, page->user_data);
+  }
+
+  g_ptr_array_set_size(bulk.created, 0);
+
+  bulk.committing = FALSE;
+}
+
+gboolean
+editor_page_bulk_active(void)
+{
+  return bulk.depth > 0 || bulk.committing;
+}
+
+void
+editor_page_set_id(EditorPage *self, guint id)
+{
+  self->id = id;
+  editor_page_reserve_id(id);
+}
+
+void
+editor_page_reserve_id(guint id)
+{
+  last_id = MAX(last_id, id);
+}
+
+LinkGraph *
+editor_page_links(void)
+{
+  if (links == NULL) {
+    links = link_graph_new();
+  }
+
+  return links;
+}
+
+void
+editor_page_remove(EditorPage *self)
+{
+  self->removed = TRUE;
+
+  link_graph_remove_page(editor_page_links(), self);
+  link_graph_remove_page(editor_page_embeds(), self);
+
+  /* Links to the page stay in place but lead nowhere */
+  g_object_set(self->tag, "strikethrough", TRUE, "background-set", FALSE,
+               NULL);
+
+  /* Embeds of it say so */
+  mark_stale(self);
+}
+
+void
+editor_page_selected_to_heading(EditorPage *self)
+{
+  GtkTextIter start;
+  GtkTextIter end;
+  if (!gtk_text_buffer_get_selection_bounds(self->content, &start, &end)) {
+    return;
+  }
+
+  gtk_text_buffer_apply_tag_by_name(self->content, "bold", &start, &end);
+}
+
+/* Serialized markdown is handed to the stream in chunks of this size */
+#define MD_CHUNK_SIZE 8192
+
+struct md_sink {
+  GString *buf;
+  GOutputStream *out;
+  GChecksum *checksum;
+  gsize written;
+  GCancellable *cancellable;
+  GError *error;
+  /* Stop after about this many bytes, 0 for the whole page */
+  gsize limit;
+};
+
+static void
+sink_flush(struct md_sink *sink)
+{
+  gsize written = 0;
+
+  if (sink->out == NULL || sink->error != NULL || sink->buf->len == 0) {
+    return;
+  }
+
+  g_output_stream_write_all(sink->out, sink->buf->str, sink->buf->len,
+                            &written, sink->cancellable, &sink->error);
+  if (sink->checksum != NULL) {
+    g_checksum_update(sink->checksum, (const guchar *) sink->buf->str,
+                      written);
+  }
+  sink->written += written;
+  g_string_truncate(sink->buf, 0);
+}
+
+static void
+sink_check(struct md_sink *sink)
+{
+  if (sink->buf->len >= MD_CHUNK_SIZE) {
+    sink_flush(sink);
+  }
+}
+
+static void
+sink_append_len(struct md_sink *sink, const gchar *str, gsize len)
+{
+  while (len > 0 && sink->error == NULL) {
+    gsize n = MIN(len, MD_CHUNK_SIZE);
+
+    g_string_append_len(sink->buf, str, n);
+    sink_check(sink);
+    str += n;
+    len -= n;
+  }
+}
+
+/* A code block that keeps its fence line, the one with the info string */
+static gboolean
+starts_with_fence(const GtkTextIter *iter)
+{
+  GtkTextIter end = *iter;
+  gchar *text;
+  gboolean fence;
+
+  gtk_text_iter_forward_chars(&end, 3);
+  text = gtk_text_iter_get_slice(iter, &end);
+  fence = strcmp(text, "```") == 0;
+  g_free(text);
+
+  return fence;
+}
+
+/* Markers of the styles that end and start at iter, closing ones first */
+static void
+append_toggles(GtkTextIter *iter, struct md_sink *sink)
+{
+  for (gint i = MD_N_STYLES - 1; i >= 0; i--) {
+    if (gtk_text_iter_ends_tag(iter, style_tags[i])) {
+      g_string_append(sink->buf, md_rule(i)->close);
+    }
+  }
+
+  for (guint i = 0; i < MD_N_STYLES; i++) {
+    if (gtk_text_iter_starts_tag(iter, style_tags[i]) &&
+        !(i == MD_CODE_BLOCK && starts_with_fence(iter))) {
+      g_string_append(sink->buf, md_rule(i)->open);
+    }
+  }
+}
+
+/* Text between toggles */
+static void
+append_segment(struct md_sink *sink, GtkTextIter *start, GtkTextIter *end)
+{
+  gchar *slice;
+
+  slice = gtk_text_iter_get_slice(start, end);
+  g_string_append(sink->buf, slice);
+  g_free(slice);
+
+  sink_check(sink);
+}
+
+static gboolean
+sink_full(struct md_sink *sink)
+{
+  return sink->limit > 0 && sink->buf->len >= sink->limit;
+}
+
+static void
+serialize(EditorPage *self, struct md_sink *sink)
+{
+  GtkTextIter iter;
+  gboolean loading = FALSE;
+
+  g_string_append_printf(sink->buf, "#%s\n", self->heading);
+
+  gtk_text_buffer_get_start_iter(self->content, &iter);
+
+  while (!gtk_text_iter_is_end(&iter) && sink->error == NULL &&
+         !sink_full(sink)) {
+    GtkTextIter next = iter;
+    EditorPage *target;
+    EditorPage *source;
+
+    append_toggles(&iter, sink);
+
+    if (gtk_text_iter_has_tag(&iter, self->loading)) {
+      /* The placeholder at the end of a page that is still loading */
+      loading = TRUE;
+      break;
+    }
+
+    /* Only the name of an embedded page is written, not its text */
+    source = editor_page_embed_at(&iter);
+    if (source != NULL && starts_run(self, &iter, source->tag)) {
+      g_string_append_printf(sink->buf, "![[%s]]", source->heading);
+      sink_check(sink);
+      forward_to_run_end(self, &next, source->tag);
+      iter = next;
+      continue;
+    }
+
+    /* A link is written by its text. That is the heading of its page, see
+     * rename_links(), unless it was typed over, and then it leads to the
+     * page it names once loaded again. */
+    target = editor_page_link_at(&iter);
+    if (target != NULL && starts_run(self, &iter, target->tag)) {
+      gchar *name;
+
+      forward_to_run_end(self, &next, target->tag);
+      name = gtk_text_iter_get_slice(&iter, &next);
+      g_string_append_printf(sink->buf, "[[%s]]",
+                             md_valid_link_name(name, strlen(name))
+                               ? name
+                               : target->heading);
+      sink_check(sink);
+      g_free(name);
+      iter = next;
+      continue;
+    }
+
+    /* Up to the next tag toggle, at most a chunk at a time */
+    gtk_text_iter_forward_to_tag_toggle(&next, NULL);
+    if (gtk_text_iter_get_offset(&next) - gtk_text_iter_get_offset(&iter) >
+        MD_CHUNK_SIZE) {
+      next = iter;
+      gtk_text_iter_forward_chars(&next, MD_CHUNK_SIZE);
+    }
+    if (sink->limit > 0 &&
+        gtk_text_iter_get_offset(&next) - gtk_text_iter_get_offset(&iter) >
+          (gint) sink->limit) {
+      next = iter;
+      gtk_text_iter_forward_chars(&next, sink->limit);
+    }
+
+    append_segment(sink, &iter, &next);
+    iter = next;
+  }
+
+  /* Styles running to the end of the buffer */
+  if (!loading) {
+    append_toggles(&iter, sink);
+  }
+
+  if (self->pending != NULL && !sink_full(sink)) {
+    gsize len = self->pending_len - self->pending_pos;
 
-  g_object_class_install_properties(object_class, N_PROPERTIES, obj_properties);
+    if (sink->limit > 0) {
+      len = MIN(len, sink->limit - sink->buf->len);
+    }
+    sink_append_len(sink, self->pending + self->pending_pos, len);
+  }
+}
 
-  editor_signals[EDITOR_PAGE_SWITCH] = g_signal_newv("switch-page",
-                                                     G_TYPE_FROM_CLASS(klass),
-                                                     G_SIGNAL_RUN_LAST |
-                                                       G_SIGNAL_NO_RECURSE |
-                                                       G_SIGNAL_NO_HOOKS,
-                                                     NULL, NULL, NULL, NULL,
-                                                     G_TYPE_NONE, 0, NULL);
+GString *
+editor_page_to_md(EditorPage *self)
+{
+  struct md_sink sink = { 0 };
+
+  sink.buf = g_string_new("");
+  serialize(self, &sink);
 
-  GType params[] = { G_TYPE_OBJECT, G_TYPE_OBJECT };
-  editor_signals[EDITOR_PAGE_NEW_ANCHOR] = g_signal_newv("new-anchor",
-                                                         G_TYPE_FROM_CLASS(klass),
-                                                         G_SIGNAL_RUN_LAST |
-                                                           G_SIGNAL_NO_RECURSE |
-                                                           G_SIGNAL_NO_HOOKS,
-                                                         NULL, NULL, NULL, NULL,
-                                                         G_TYPE_NONE, 2, params);
+  return sink.buf;
 }
 
-static void
-set_color(EditorPage *self, GdkRGBA *color)
+gboolean
+editor_page_range_has_link(EditorPage *self, gint start, gint end)
 {
-  if (color != NULL) {
-    self->color.red = color->red;
-    self->color.green = color->green;
-    self->color.blue = color->blue;
-    self->color.alpha = color->alpha;
+  GtkTextIter iter;
+
+  gtk_text_buffer_get_iter_at_offset(self->content, &iter, start);
+
+  do {
+    if (editor_page_link_at(&iter) != NULL ||
+        editor_page_embed_at(&iter) != NULL) {
+      return TRUE;
+    }
+  } while (gtk_text_iter_forward_to_tag_toggle(&iter, NULL) &&
+           gtk_text_iter_get_offset(&iter) < end);
+
+  return FALSE;
+}
+
+gboolean
+editor_page_replace_range(EditorPage *self,
+                          gint start,
+                          gint end,
+                          const gchar *old,
+                          const gchar *text)
+{
+  GtkTextIter from;
+  GtkTextIter to;
+  GtkTextMark *mark;
+  GSList *tags;
+  gchar *current;
+  gboolean same;
+
+  if (end > gtk_text_buffer_get_char_count(self->content)) {
+    return FALSE;
+  }
+
+  gtk_text_buffer_get_iter_at_offset(self->content, &from, start);
+  gtk_text_buffer_get_iter_at_offset(self->content, &to, end);
+  current = gtk_text_iter_get_slice(&from, &to);
+  same = g_str_equal(current, old);
+  g_free(current);
+
+  if (!same) {
+    return FALSE;
+  }
+
+  tags = gtk_text_iter_get_tags(&from);
+  mark = gtk_text_buffer_create_mark(self->content, NULL, &from, TRUE);
+
+  /* New text first, so a styled range never goes away as a whole */
+  gtk_text_buffer_insert(self->content, &from, text, -1);
+  gtk_text_buffer_get_iter_at_mark(self->content, &to, mark);
+  gtk_text_buffer_remove_all_tags(self->content, &to, &from);
+  for (GSList *tag = tags; tag != NULL; tag = tag->next) {
+    gtk_text_buffer_apply_tag(self->content, tag->data, &to, &from);
   }
+
+  to = from;
+  gtk_text_iter_forward_chars(&to, end - start);
+  gtk_text_buffer_delete(self->content, &from, &to);
+
+  gtk_text_buffer_delete_mark(self->content, mark);
+  g_slist_free(tags);
+
+  return TRUE;
 }
 
-static void
-editor_page_init(EditorPage *self)
+guint
+editor_page_replace_pending(EditorPage *self, gsize base, GPtrArray *matches)
 {
-  /* initialize all public and private members to reasonable default values.
-   * They are all automatically initialized to 0 to begin with. */
+  const gchar *text = self->pending;
+  GArray *tokens;
+  guint token = 0;
+  gsize cursor = 0;
+  guint replaced = 0;
+  GString *out;
+
+  if (self->pending == NULL || self->pending_pos != base) {
+    return 0;
+  }
 
-  if (self->heading == NULL) {
-    g_print("Before the args\n");
-  } else {
-    g_print("After the args\n");
+  /* Only text is replaced, as in the loaded part where markers are tags and
+   * links are skipped. The loaded part stays, but is parsed along so that
+   * a block opened in it is known. */
+  tokens = md_tokenize(text, self->pending_len, MD_PARSE_DEFAULT);
+  out = g_string_sized_new(self->pending_len);
+
+  for (guint i = 0; i < matches->len; i++) {
+    SearchMatch *match = g_ptr_array_index(matches, i);
+    gsize len = match->end_byte - match->start_byte;
+    MdToken *in = NULL;
+
+    if (match->start_byte < MAX(cursor, base) ||
+        match->end_byte > self->pending_len ||
+        memcmp(text + match->start_byte, match->text, len) != 0) {
+      continue;
+    }
+
+    /* Matches are in order, so are the tokens */
+    while (token < tokens->len) {
+      in = &g_array_index(tokens, MdToken, token);
+      if (in->offset + in->len > match->start_byte) {
+        break;
+      }
+      token++;
+    }
+    if (token == tokens->len || in->type != MD_TOKEN_TEXT ||
+        match->end_byte > in->offset + in->len) {
+      continue;
+    }
+
+    g_string_append_len(out, text + cursor, match->start_byte - cursor);
+    g_string_append(out, match->replacement);
+    cursor = match->end_byte;
+    replaced++;
   }
-  /* Not sharing tags (for now at least) */
-  self->content = gtk_text_buffer_new(NULL);
-  self->anchors = g_ptr_array_new();
-  self->buttons = g_ptr_array_new();
-  self->color.red = .7;
-  self->color.green = .7;
-  self->color.blue = 1.0;
-  self->color.alpha = 1.0;
 
-  self->bold = gtk_text_buffer_create_tag(self->content, "bold", "weight", 800,
-                                          NULL);
+  g_string_append_len(out, text + cursor, self->pending_len - cursor);
+  g_array_unref(tokens);
+
+  g_free(self->pending);
+  self->pending_len = out->len;
+  self->pending = g_string_free(out, FALSE);
+
+  drop_preview(self);
+  gtk_text_buffer_set_modified(self->content, TRUE);
+
+  return replaced;
 }
 
-static void
-change_page(G_GNUC_UNUSED GObject *button, EditorPage *self)
+const gchar *
+editor_page_preview(EditorPage *self)
 {
-  g_print("Emit change page\n");
-  g_signal_emit(self, editor_signals[EDITOR_PAGE_SWITCH], 0, self);
-  // EMIT change page
+  struct md_sink sink = { 0 };
+  gchar *title;
+  gchar *body;
+  gsize skip;
+
+  if (self->preview != NULL) {
+    g_queue_remove(&previews, self);
+    g_queue_push_head(&previews, self);
+    return self->preview;
+  }
+
+  /* Only the start of the page, whether it is in the buffer or still
+   * pending */
+  sink.buf = g_string_new("");
+  sink.limit = PREVIEW_MAX_BYTES;
+  serialize(self, &sink);
+
+  /* The heading line is shown on its own */
+  skip = strlen(self->heading) + 2;
+  body = md_preview_markup(sink.buf->str + MIN(skip, sink.buf->len),
+                           sink.buf->len - MIN(skip, sink.buf->len),
+                           PREVIEW_PARAGRAPHS);
+  title = g_markup_printf_escaped("<b>%s</b>", self->heading);
+  self->preview = g_strjoin("\n", title, body[0] != '\0' ? body : NULL, NULL);
+  g_free(title);
+  g_free(body);
+  g_string_free(sink.buf, TRUE);
+
+  g_queue_push_head(&previews, self);
+  if (g_queue_get_length(&previews) > PREVIEW_CACHE_SIZE) {
+    drop_preview(g_queue_peek_tail(&previews));
+  }
+
+  return self->preview;
 }
 
-EditorPage *
-editor_page_new(const gchar *heading,
-                GHashTable *pages,
-                GdkRGBA *color,
-                GCallback created_cb,
-                gpointer user_data)
+gboolean
+editor_page_write_md(EditorPage *self,
+                     GOutputStream *out,
+                     GChecksum *checksum,
+                     gsize *bytes_written,
+                     GCancellable *cancellable,
+                     GError **error)
 {
-  static guint css_num = 0;
-  EditorPage *self;
+  struct md_sink sink = { 0 };
 
-  self = g_object_new(EDITOR_TYPE_PAGE, "heading", heading, "page_button",
-                      gtk_button_new_with_label(heading), NULL);
+  g_assert(self);
+  g_assert(out);
 
-  css_num++;
-  self->css_name = g_strdup_printf("page%u", css_num);
-  self->pages = pages;
-  g_hash_table_insert(pages, g_strdup(heading), self);
+  sink.buf = g_string_sized_new(MD_CHUNK_SIZE + 64);
+  sink.out = out;
+  sink.checksum = checksum;
+  sink.cancellable = cancellable;
 
-  set_color(self, color);
+  serialize(self, &sink);
+  sink_flush(&sink);
 
-  gtk_widget_add_css_class(self->page_button, self->css_name);
+  g_string_free(sink.buf, TRUE);
 
-  g_signal_connect(self->page_button, "clicked", G_CALLBACK(change_page), self);
-  g_signal_connect(self->content, "insert-text", G_CALLBACK(insert_text), self);
+  if (bytes_written != NULL) {
+    *bytes_written = sink.written;
+  }
 
-  g_object_set_data(G_OBJECT(self->page_button), "page", self);
+  if (sink.error != NULL) {
+    g_propagate_error(error, sink.error);
+    return FALSE;
+  }
 
-  self->created_cb = created_cb;
-  self->user_data = user_data;
-  ((create_cb) *self->created_cb)(self, self->user_data);
+  return TRUE;
+}
 
-  return self;
+/* Loading is not undoable, does not trigger the restyler and does not mark
+ * the page as changed since the last save */
+static void
+begin_load_edit(EditorPage *page)
+{
+  if (page->quiet++ == 0) {
+    page->load_modified = gtk_text_buffer_get_modified(page->content);
+  }
+  gtk_text_buffer_begin_irreversible_action(page->content);
 }
 
-GtkWidget *
-editor_page_in_content_button(EditorPage *self)
+static void
+end_load_edit(EditorPage *page)
 {
-  GtkWidget *button;
+  gtk_text_buffer_end_irreversible_action(page->content);
+  if (--page->quiet == 0) {
+    gtk_text_buffer_set_modified(page->content, page->load_modified);
+  }
+}
 
-  button = gtk_button_new_with_label(self->heading);
-  gtk_button_set_has_frame(GTK_BUTTON(button), FALSE);
-  g_signal_connect(button, "clicked", G_CALLBACK(change_page), self);
-  gtk_widget_add_css_class(button, "in-text-button");
-  gtk_widget_add_css_class(button, self->css_name);
+/* Length of the next chunk of text. Chunks are marked up one at a time, so
+ * one never ends inside a paragraph or a code block. */
+static gsize
+next_chunk(const gchar *text, gsize len)
+{
+  if (len <= LOAD_CHUNK_SIZE) {
+    return len;
+  }
 
-  g_ptr_array_add(self->buttons, g_object_ref(button));
-  return button;
+  return md_block_break(text, len, LOAD_CHUNK_SIZE);
 }
 
-void
-editor_page_selected_to_heading(EditorPage *self)
+static void
+stop_loading(EditorPage *page)
 {
   GtkTextIter start;
   GtkTextIter end;
-  if (!gtk_text_buffer_get_selection_bounds(self->content, &start, &end)) {
-    return;
-  }
 
-  gtk_text_buffer_apply_tag_by_name(self->content, "bold", &start, &end);
+  g_clear_handle_id(&page->load_source, g_source_remove);
+  g_clear_pointer(&page->pending, g_free);
+
+  /* Drops the placeholder, everything from the mark on */
+  if (page->load_mark != NULL) {
+    gtk_text_buffer_get_iter_at_mark(page->content, &start, page->load_mark);
+    gtk_text_buffer_get_end_iter(page->content, &end);
+
+    begin_load_edit(page);
+    gtk_text_buffer_delete(page->content, &start, &end);
+    end_load_edit(page);
+
+    gtk_text_buffer_delete_mark(page->content, page->load_mark);
+    page->load_mark = NULL;
+  }
 }
 
-GString *
-editor_page_to_md(EditorPage *self)
+static gboolean
+load_chunk(gpointer user_data)
 {
-  GString *res = g_string_new("");
+  EditorPage *page = EDITOR_PAGE(user_data);
+  GtkTextMark *chunk_start;
   GtkTextIter iter;
-  gunichar c;
-  GtkTextChildAnchor *anchor;
+  gsize len;
 
-  g_string_append_printf(res, "#%s\n", self->heading);
+  len = next_chunk(page->pending + page->pending_pos,
+                   page->pending_len - page->pending_pos);
 
-  gtk_text_buffer_get_start_iter(self->content, &iter);
+  gtk_text_buffer_get_iter_at_mark(page->content, &iter, page->load_mark);
+  chunk_start = gtk_text_buffer_create_mark(page->content, NULL, &iter, TRUE);
 
-  while ((c = gtk_text_iter_get_char(&iter)) > 0) {
-    if (gtk_text_iter_starts_tag(&iter, self->bold) ||
-        gtk_text_iter_ends_tag(&iter, self->bold)) {
-      g_string_append(res, "**");
-    }
+  begin_load_edit(page);
+  gtk_text_buffer_insert(page->content, &iter,
+                         page->pending + page->pending_pos, len);
+  end_load_edit(page);
+  page->pending_pos += len;
 
-    if (c == 0xFFFC) {
-      /** unknown char - deal with anchors */
-      anchor = gtk_text_iter_get_child_anchor(&iter);
-      if (anchor != NULL) {
-        EditorPage *target = g_object_get_data(G_OBJECT(anchor), "target");
-        g_string_append_printf(res, "[[%s]]", target->heading);
-      }
-    } else {
-      g_string_append_unichar(res, c);
-    }
+  /* Before the first fix up the whole buffer is fixed in one go */
+  if (page->fixed) {
+    begin_load_edit(page);
+    apply_markup(page, chunk_start, page->load_mark, MD_PARSE_DEFAULT);
+    end_load_edit(page);
+  }
+
+  gtk_text_buffer_delete_mark(page->content, chunk_start);
 
-    gtk_text_iter_forward_char(&iter);
+  if (page->pending_pos < page->pending_len) {
+    return G_SOURCE_CONTINUE;
   }
 
-  return res;
+  page->load_source = 0;
+  stop_loading(page);
+
+  return G_SOURCE_REMOVE;
 }
 
 EditorPage *
@@ -632,40 +2026,94 @@ editor_page_load(GHashTable *pages,
   GError *lerr = NULL;
   gchar *content = NULL;
   gsize size;
-  gchar *name;
-  EditorPage *page;
-  gchar *text;
 
-  if (!g_file_get_contents(filename, &content, &size, &lerr)) {
+  if (!workspace_read_file(filename, &content, &size, &lerr)) {
     g_warning("Could not open file: %s", lerr->message);
     g_clear_error(&lerr);
     return NULL;
   }
 
+  return editor_page_load_data(pages, content, size, color, created_cb,
+                               user_data);
+}
+
+EditorPage *
+editor_page_load_data(GHashTable *pages,
+                      gchar *content,
+                      gsize size,
+                      GdkRGBA *color,
+                      GCallback created_cb,
+                      gpointer user_data)
+{
+  gchar *name;
+  EditorPage *page;
+  gchar *text;
+  gsize len;
+  gsize first;
+  gint offset;
+  GtkTextIter end;
+
   if (!g_str_has_prefix(content, "#")) {
+    g_free(content);
     return NULL;
   }
 
   text = g_strstr_len(content, size, "\n");
   if (text == NULL) {
-    NULL;
+    g_free(content);
+    return NULL;
   }
 
   name = g_strndup(content + 1, text - content - 1);
 
-  g_print("Name: %s\n", name);
-
   page = g_hash_table_lookup(pages, name);
 
   if (page == NULL) {
     page = editor_page_new(name, pages, color, created_cb, user_data);
   } else {
     set_color(page, color);
+    stop_loading(page);
+  }
+
+  g_free(name);
+
+  text++;
+  len = content + size - text;
+  first = next_chunk(text, len);
+
+  /* Restyled in one go by editor_page_fix_content() */
+  page->fixed = FALSE;
+  link_graph_set_stub(editor_page_links(), page, FALSE);
+  untraced++;
+  gtk_text_buffer_set_text(page->content, text, first);
+  untraced--;
+  gtk_text_buffer_set_modified(page->content, FALSE);
+
+  if (first == len) {
+    g_free(content);
+    return page;
   }
 
-  gtk_text_buffer_set_text(page->content, text + 1, -1);
+  /* Show the start of the page right away and fill in the rest from idle,
+   * the unloaded part is represented by a non-editable placeholder */
+  gtk_text_buffer_get_end_iter(page->content, &end);
+  offset = gtk_text_iter_get_offset(&end);
+
+  begin_load_edit(page);
+  gtk_text_buffer_insert_with_tags(page->content, &end, "\n\u2026", -1,
+                                   page->loading, NULL);
+  end_load_edit(page);
 
-  g_free(content);
+  /* At the start of the placeholder. Chunks go in at the mark, which moves
+   * past them, so the placeholder stays last until stop_loading() */
+  gtk_text_buffer_get_iter_at_offset(page->content, &end, offset);
+  page->load_mark = gtk_text_buffer_create_mark(page->content, NULL, &end,
+                                                FALSE);
+
+  page->pending = content;
+  page->pending_pos = text + first - content;
+  page->pending_len = size;
+  page->load_source = g_idle_add(load_chunk, page);
 
   return page;
 }
@@ -673,10 +2121,278 @@ editor_page_load(GHashTable *pages,
 void
 editor_page_fix_content(EditorPage *page)
 {
-  g_print("Fixing anchors \n");
-  fix_anchors(page);
+  begin_load_edit(page);
+  apply_markup(page, NULL, page->load_mark, MD_PARSE_DEFAULT);
+  end_load_edit(page);
+
+  page->fixed = TRUE;
+}
+
+LinkGraph *
+editor_page_embeds(void)
+{
+  if (embeds == NULL) {
+    embeds = link_graph_new();
+  }
+
+  return embeds;
+}
+
+/*
+ * Why source cannot be shown in page, or NULL if it can. Only the pages
+ * source embeds, and the ones they embed, are looked at, level by level
+ * down to EMBED_MAX_DEPTH.
+ */
+static const gchar *
+embed_blocked(EditorPage *page, EditorPage *source)
+{
+  const gchar *reason = NULL;
+  GHashTable *seen;
+  GPtrArray *level;
+
+  if (source->removed) {
+    return "removed";
+  }
+
+  seen = g_hash_table_new(NULL, NULL);
+  level = g_ptr_array_new();
+  g_hash_table_add(seen, source);
+  g_ptr_array_add(level, source);
+
+  for (guint depth = 0; reason == NULL && level->len > 0; depth++) {
+    GPtrArray *next;
+
+    if (depth == EMBED_MAX_DEPTH) {
+      reason = "nested too deep";
+      break;
+    }
+
+    next = g_ptr_array_new();
+    for (guint i = 0; reason == NULL && i < level->len; i++) {
+      GList *targets;
+
+      if (g_ptr_array_index(level, i) == page) {
+        reason = "embeds this page";
+        break;
+      }
+
+      targets = link_graph_targets(editor_page_embeds(),
+                                   g_ptr_array_index(level, i));
+      for (GList *iter = targets; iter != NULL; iter = iter->next) {
+        if (g_hash_table_add(seen, iter->data)) {
+          g_ptr_array_add(next, iter->data);
+        }
+      }
+      g_list_free(targets);
+    }
+
+    g_ptr_array_unref(level);
+    level = next;
+  }
+
+  g_ptr_array_unref(level);
+  g_hash_table_unref(seen);
+
+  return reason;
+}
+
+/* What an embed of source in page shows: the loaded text of source, with
+ * the embeds in it already rendered */
+static gchar *
+embed_text(EditorPage *page, EditorPage *source)
+{
+  const gchar *blocked = embed_blocked(page, source);
+  GtkTextIter start;
+  GtkTextIter end;
+  gchar *text;
+
+  if (blocked != NULL) {
+    return g_strdup_printf("\u29c9 %s (%s)", source->heading, blocked);
+  }
+
+  gtk_text_buffer_get_start_iter(source->content, &start);
+  if (source->load_mark != NULL) {
+    gtk_text_buffer_get_iter_at_mark(source->content, &end, source->load_mark);
+  } else {
+    gtk_text_buffer_get_end_iter(source->content, &end);
+  }
+
+  text = gtk_text_iter_get_text(&start, &end);
+  if (text[0] == '\0') {
+    g_free(text);
+    text = g_strdup_printf("\u29c9 %s", source->heading);
+  }
+
+  return text;
+}
+
+/* Inserts the text of the page name at iter, creating a stub page if there
+ * is none. The text is plain, with the tag of the page over it. */
+static void
+render_embed(EditorPage *page, GtkTextIter *iter, const gchar *name)
+{
+  EditorPage *source;
+  GtkTextIter start;
+  gchar *text;
+
+  source = g_hash_table_lookup(page->pages, name);
+  if (source == NULL) {
+    source = editor_page_new(name, page->pages, NULL, page->created_cb,
+                             page->user_data);
+    link_graph_set_stub(editor_page_links(), source, TRUE);
+  }
+
+  text = embed_text(page, source);
+
+  page->quiet++;
+  untraced++;
+  gtk_text_buffer_insert_with_tags(page->content, iter, text, -1, embed_style,
+                                   source->tag, NULL);
+  untraced--;
+  page->quiet--;
+
+  keep_apart(page, iter, source->tag);
+  start = *iter;
+  gtk_text_iter_backward_chars(&start, g_utf8_strlen(text, -1));
+  keep_apart(page, &start, source->tag);
+
+  link_graph_add_link(editor_page_embeds(), page, source);
+  g_free(text);
+}
+
+/* Renders the embeds of source in page again, where their text is out of
+ * date. Embeds are not the page's own text, so the modified flag stays and
+ * the undo history does not record them. */
+static void
+refresh_embeds(EditorPage *page, EditorPage *source)
+{
+  GtkTextIter start;
+  GtkTextIter end;
+  gchar *text;
+
+  gtk_text_buffer_get_start_iter(page->content, &start);
+  if (!gtk_text_iter_starts_tag(&start, source->tag) &&
+      !gtk_text_iter_forward_to_tag_toggle(&start, source->tag)) {
+    return;
+  }
+
+  text = embed_text(page, source);
+  untraced++;
+
+  do {
+    gchar *current;
+
+    if (!starts_run(page, &start, source->tag)) {
+      continue;
+    }
+
+    end = start;
+    forward_to_run_end(page, &end, source->tag);
+    /* Links to source have its tag as well */
+    if (!gtk_text_iter_has_tag(&start, embed_style)) {
+      start = end;
+      continue;
+    }
+    current = gtk_text_iter_get_text(&start, &end);
+
+    /* Unchanged text is what ends a chain of refreshes, and cycles */
+    if (!g_str_equal(current, text)) {
+      gint offset = gtk_text_iter_get_offset(&start);
+
+      begin_load_edit(page);
+      gtk_text_buffer_delete(page->content, &start, &end);
+      gtk_text_buffer_get_iter_at_offset(page->content, &start, offset);
+      gtk_text_buffer_insert_with_tags(page->content, &start, text, -1,
+                                       embed_style, source->tag, NULL);
+      end_load_edit(page);
+
+      link_graph_add_link(editor_page_embeds(), page, source);
+      gtk_text_buffer_get_iter_at_offset(page->content, &start, offset);
+      gtk_text_buffer_get_iter_at_offset(page->content, &end,
+                                         offset + g_utf8_strlen(text, -1));
+      keep_apart(page, &start, source->tag);
+      keep_apart(page, &end, source->tag);
+    }
+    g_free(current);
+
+    start = end;
+  } while (starts_run(page, &start, source->tag) ||
+           gtk_text_iter_forward_to_tag_toggle(&start, source->tag));
+
+  untraced--;
+  g_free(text);
+}
+
+static gboolean
+refresh_stale(G_GNUC_UNUSED gpointer user_data)
+{
+  GHashTable *sources = g_steal_pointer(&stale);
+  GHashTableIter iter;
+  gpointer source;
+
+  refresh_source = 0;
+
+  /* Refreshed pages change in turn, and go stale for the next run */
+  g_hash_table_iter_init(&iter, sources);
+  while (g_hash_table_iter_next(&iter, &source, NULL)) {
+    GList *embedders = link_graph_sources(editor_page_embeds(), source);
+
+    for (GList *page = embedders; page != NULL; page = page->next) {
+      if (!EDITOR_PAGE(page->data)->removed) {
+        refresh_embeds(page->data, source);
+      }
+    }
+    g_list_free(embedders);
+  }
+
+  g_hash_table_unref(sources);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Coalesced like restyle(), pages nothing embeds cost a lookup */
+static void
+mark_stale(EditorPage *page)
+{
+  GList *embedders;
+
+  if (embeds == NULL) {
+    return;
+  }
+
+  embedders = link_graph_sources(embeds, page);
+  if (embedders == NULL) {
+    return;
+  }
+  g_list_free(embedders);
+
+  if (stale == NULL) {
+    stale = g_hash_table_new(NULL, NULL);
+  }
+  g_hash_table_add(stale, page);
+
+  if (refresh_source == 0) {
+    refresh_source = g_idle_add(refresh_stale, NULL);
+  }
+}
+
+gboolean
+editor_page_delete_embed(EditorPage *self, const GtkTextIter *iter)
+{
+  EditorPage *source = editor_page_embed_at(iter);
+  GtkTextIter start = *iter;
+  GtkTextIter end = *iter;
+
+  if (source == NULL) {
+    return FALSE;
+  }
+
+  backward_to_run_start(self, &start, source->tag);
+  forward_to_run_end(self, &end, source->tag);
 
-  fix_tags(page);
+  gtk_text_buffer_begin_user_action(self->content);
+  gtk_text_buffer_delete(self->content, &start, &end);
+  gtk_text_buffer_end_user_action(self->content);
 
-  g_print("Free content\n");
-}
\ No newline at end of file
+  return TRUE;
+}
@@ -3,17 +3,28 @@
 #include <glib-object.h>
 #include <gtk/gtk.h>
 
+#include "linkgraph.h"
+#include "search.h"
+#include "trace.h"
+
 G_BEGIN_DECLS
 
 /** Public variables. Move to .c file to make private */
 struct _EditorPage {
   GObject parent;
 
+  guint id;
   gchar *heading;
   GtkTextBuffer *content;
   GtkWidget *page_button;
-  GPtrArray *anchors;
-  GPtrArray *buttons;
+  /* Applied to the text of links to this page and of its embeds, along
+   * with the shared link or embed style. Named css_name. */
+  GtkTextTag *tag;
+  /* Marks in content between two links or embeds of the same page that
+   * touch, which would otherwise be one run of its tag. See keep_apart(). */
+  GPtrArray *run_bounds;
+  /* The delete in progress puts two runs next to each other */
+  gboolean joining;
 
   gchar *css_name;
   GdkRGBA color;
@@ -23,6 +34,31 @@ struct _EditorPage {
   gpointer user_data;
 
   GtkTextTag *bold;
+
+  /* Set by editor_page_remove() */
+  gboolean removed;
+
+  /* Large pages are inserted in chunks, see editor_page_load() */
+  GtkTextTag *loading;
+  GtkTextMark *load_mark;
+  gchar *pending;
+  gsize pending_pos;
+  gsize pending_len;
+  guint load_source;
+  gboolean fixed;
+
+  /* Paragraphs edited since the last restyle, see mark_dirty() */
+  GtkTextMark *dirty_start;
+  GtkTextMark *dirty_end;
+  guint restyle_source;
+  guint quiet;
+  /* An undo is in progress, what it brings back is not restyled */
+  gboolean undoing;
+  /* The modified flag of content before the load edits in progress */
+  gboolean load_modified;
+
+  /* Cached by editor_page_preview() until the content changes */
+  gchar *preview;
 };
 
 /*
@@ -41,17 +77,108 @@ EditorPage *editor_page_new(const gchar *heading,
                             GCallback created_cb,
                             gpointer user_data);
 
-GtkWidget *editor_page_in_content_button(EditorPage *self);
+/* The sidebar button of the page. Made on first use, so that pages work
+ * without a display as long as nothing asks for it. */
+GtkWidget *editor_page_button(EditorPage *self);
+
+/* Records the edits the user makes to any page in trace, NULL stops */
+void editor_page_set_trace(Trace *trace);
+
+/* Workspace ids are stable across saves, new pages get an unused one */
+void editor_page_set_id(EditorPage *self, guint id);
+
+/* Keeps id from being given to new pages */
+void editor_page_reserve_id(guint id);
+
+/* The tag table shared by the content of all pages */
+GtkTextTagTable *editor_page_tag_table(void);
+
+/* The link graph of all pages, with the pages as nodes */
+LinkGraph *editor_page_links(void);
+
+/* Takes the page out of the link graph and strikes out the links to it. The
+ * caller removes it from the workspace. */
+void editor_page_remove(EditorPage *self);
+
+void editor_page_set_color(EditorPage *self, const GdkRGBA *color);
+
+/* The page linked to at iter, or NULL */
+EditorPage *editor_page_link_at(const GtkTextIter *iter);
+
+/*
+ * Which pages embed which, with the pages as nodes. ![[Name]] shows the
+ * content of the page Name in place, read-only. Changing a page renders its
+ * embeds again, in the pages that embed it only.
+ */
+LinkGraph *editor_page_embeds(void);
+
+/* The page embedded at iter, or NULL */
+EditorPage *editor_page_embed_at(const GtkTextIter *iter);
+
+/* Deletes the embed at iter as a whole, FALSE if there is none */
+gboolean editor_page_delete_embed(EditorPage *self, const GtkTextIter *iter);
+
+/* Whether any text in [start, end) of the content is a link or embed */
+gboolean editor_page_range_has_link(EditorPage *self, gint start, gint end);
+
+/* Replaces [start, end) of the content, which must still read old, with
+ * text. The new text gets the tags of the first replaced character. */
+gboolean editor_page_replace_range(EditorPage *self,
+                                   gint start,
+                                   gint end,
+                                   const gchar *old,
+                                   const gchar *text);
+
+/* Applies matches, a GPtrArray of SearchMatch in order, to the markdown
+ * still waiting to be loaded, as it was when pending_pos was base. Matches
+ * in markers or links are left alone. Returns the number replaced, 0 if
+ * loading moved on since. */
+guint editor_page_replace_pending(EditorPage *self,
+                                  gsize base,
+                                  GPtrArray *matches);
+
+/* Pango markup of the heading and first paragraphs of the page. Owned by the
+ * page, valid until its content changes or another preview is rendered. */
+const gchar *editor_page_preview(EditorPage *self);
 
 GString *editor_page_to_md(EditorPage *self);
 
+/* Like editor_page_to_md() but written to out in fixed-size chunks. The
+ * written bytes are also fed to checksum, if given. */
+gboolean editor_page_write_md(EditorPage *self,
+                              GOutputStream *out,
+                              GChecksum *checksum,
+                              gsize *bytes_written,
+                              GCancellable *cancellable,
+                              GError **error);
+
+/* Files ending in ".gz" are decompressed while reading */
 EditorPage *editor_page_load(GHashTable *pages,
                              gchar *filename,
                              GdkRGBA *color,
                              GCallback created_cb,
                              gpointer user_data);
+
+/* Like editor_page_load() but from the contents of a page file already in
+ * memory, takes ownership of content */
+EditorPage *editor_page_load_data(GHashTable *pages,
+                                  gchar *content,
+                                  gsize size,
+                                  GdkRGBA *color,
+                                  GCallback created_cb,
+                                  gpointer user_data);
 void editor_page_fix_content(EditorPage *page);
 
 void editor_page_selected_to_heading(EditorPage *self);
 
+/*
+ * Bulk updates. Between begin and commit the created_cb of new pages is
+ * queued, and commit runs them in order. Calls nest,
+ * only the outermost commit applies the queue. editor_page_bulk_active() is
+ * TRUE while the queue is applied so callbacks can skip per-page work.
+ */
+void editor_page_bulk_begin(void);
+void editor_page_bulk_commit(void);
+gboolean editor_page_bulk_active(void);
+
 G_END_DECLS
@@ -0,0 +1,498 @@
+#include "export.h"
+#include "editor_page.h"
+#include "markdown.h"
+#include <gio/gio.h>
+#include <glib.h>
+#include <gtk/gtk.h>
+
+#include <errno.h>
+#include <string.h>
+
+#define EXPORT_BUFFER_SIZE (64 * 1024)
+
+struct export_page {
+  gchar *heading;
+  gchar *file;
+  gchar *css_name;
+  gchar *color;
+  GString *md;
+};
+
+struct export_ctx {
+  gchar *dest;
+  GPtrArray *sources;
+  guint next_source;
+
+  GPtrArray *pages;
+  GHashTable *headings;
+  GHashTable *files;
+
+  GMutex lock;
+  GError *error;
+};
+
+static void
+export_page_free(gpointer data)
+{
+  struct export_page *page = data;
+
+  g_free(page->heading);
+  g_free(page->file);
+  g_free(page->css_name);
+  g_free(page->color);
+  if (page->md != NULL) {
+    g_string_free(page->md, TRUE);
+  }
+  g_free(page);
+}
+
+static void
+export_ctx_free(gpointer data)
+{
+  struct export_ctx *ctx = data;
+
+  g_free(ctx->dest);
+  g_ptr_array_unref(ctx->sources);
+  g_hash_table_unref(ctx->headings);
+  g_hash_table_unref(ctx->files);
+  g_ptr_array_unref(ctx->pages);
+  g_mutex_clear(&ctx->lock);
+  g_clear_error(&ctx->error);
+  g_free(ctx);
+}
+
+static void
+set_error(struct export_ctx *ctx, GError *error)
+{
+  g_mutex_lock(&ctx->lock);
+  if (ctx->error == NULL) {
+    ctx->error = error;
+  } else {
+    g_error_free(error);
+  }
+  g_mutex_unlock(&ctx->lock);
+}
+
+static gchar *
+unique_file_name(struct export_ctx *ctx, const gchar *heading)
+{
+  gchar *name;
+  gchar *file;
+  guint n = 1;
+
+  name = g_str_to_ascii(heading, NULL);
+  g_strdelimit(name, "/\\:", '_');
+
+  file = g_strdup_printf("%s.html", name);
+  while (g_hash_table_contains(ctx->files, file) ||
+         g_strcmp0(file, "index.html") == 0) {
+    g_free(file);
+    file = g_strdup_printf("%s-%u.html", name, n++);
+  }
+
+  g_free(name);
+  return file;
+}
+
+static gboolean
+write_str(GOutputStream *out, const gchar *str, gssize len, GError **error)
+{
+  if (len < 0) {
+    len = strlen(str);
+  }
+  return g_output_stream_write_all(out, str, len, NULL, NULL, error);
+}
+
+static gboolean
+write_escaped(GOutputStream *out, const gchar *str, gsize len, GError **error)
+{
+  const gchar *start = str;
+  const gchar *end = str + len;
+
+  for (const gchar *iter = str; iter < end; iter++) {
+    const gchar *entity;
+
+    switch (*iter) {
+    case '&':
+      entity = "&amp;";
+      break;
+    case '<':
+      entity = "&lt;";
+      break;
+    case '>':
+      entity = "&gt;";
+      break;
+    case '"':
+      entity = "&quot;";
+      break;
+    default:
+      continue;
+    }
+
+    if (!write_str(out, start, iter - start, error) ||
+        !write_str(out, entity, -1, error)) {
+      return FALSE;
+    }
+    start = iter + 1;
+  }
+
+  return write_str(out, start, end - start, error);
+}
+
+static gboolean
+write_link(GOutputStream *out,
+           struct export_ctx *ctx,
+           const gchar *name,
+           gsize len,
+           GError **error)
+{
+  struct export_page *target;
+  gchar *heading;
+  gchar *href;
+  gboolean ok;
+
+  heading = g_strndup(name, len);
+  target = g_hash_table_lookup(ctx->headings, heading);
+  g_free(heading);
+
+  if (target == NULL) {
+    return write_str(out, "<span class=\"missing\">", -1, error) &&
+           write_escaped(out, name, len, error) &&
+           write_str(out, "</span>", -1, error);
+  }
+
+  href = g_uri_escape_string(target->file, NULL, FALSE);
+  ok = write_str(out, "<a class=\"link ", -1, error) &&
+       write_str(out, target->css_name, -1, error) &&
+       write_str(out, "\" href=\"", -1, error) &&
+       write_str(out, href, -1, error) && write_str(out, "\">", -1, error) &&
+       write_escaped(out, name, len, error) &&
+       write_str(out, "</a>", -1, error);
+  g_free(href);
+
+  return ok;
+}
+
+/* Same tokenizer as editor_page_fix_content(), so the rules match */
+static gboolean
+write_body(GOutputStream *out,
+           struct export_ctx *ctx,
+           const gchar *md,
+           gsize len,
+           GError **error)
+{
+  GArray *tokens;
+  gboolean ok = TRUE;
+  gboolean info = FALSE;
+
+  tokens = md_tokenize(md, len, MD_PARSE_DEFAULT);
+
+  for (guint i = 0; ok && i < tokens->len; i++) {
+    MdToken *token = &g_array_index(tokens, MdToken, i);
+    gsize skip = 0;
+
+    switch (token->type) {
+    case MD_TOKEN_TEXT:
+      /* The fence line of a code block with an info string is its first */
+      if (info) {
+        const gchar *nl = memchr(md + token->offset, '\n', token->len);
+
+        skip = nl != NULL ? (gsize) (nl - md) + 1 - token->offset : token->len;
+        info = FALSE;
+      }
+      ok = write_escaped(out, md + token->offset + skip, token->len - skip,
+                         error);
+      break;
+    case MD_TOKEN_OPEN:
+      info = token->style == MD_CODE_BLOCK && token->len == 0;
+      ok = write_str(out, md_rule(token->style)->html_open, -1, error);
+      break;
+    case MD_TOKEN_CLOSE:
+      ok = write_str(out, md_rule(token->style)->html_close, -1, error);
+      break;
+    case MD_TOKEN_LINK:
+      ok = write_link(out, ctx, md + token->offset + 2, token->len - 4, error);
+      break;
+    /* Pages are exported one file each, an embed links to its page */
+    case MD_TOKEN_EMBED:
+      ok = write_link(out, ctx, md + token->offset + 3, token->len - 5, error);
+      break;
+    }
+  }
+
+  g_array_unref(tokens);
+
+  return ok;
+}
+
+static GOutputStream *
+open_output(struct export_ctx *ctx,
+            const gchar *name,
+            GCancellable *cancellable,
+            GError **error)
+{
+  GFileOutputStream *file_out;
+  GOutputStream *out;
+  GFile *file;
+  gchar *path;
+
+  path = g_build_filename(ctx->dest, name, NULL);
+  file = g_file_new_for_path(path);
+  g_free(path);
+
+  file_out = g_file_replace(file, NULL, FALSE, G_FILE_CREATE_NONE, cancellable,
+                            error);
+  g_object_unref(file);
+
+  if (file_out == NULL) {
+    return NULL;
+  }
+
+  out = g_buffered_output_stream_new_sized(G_OUTPUT_STREAM(file_out),
+                                           EXPORT_BUFFER_SIZE);
+  g_object_unref(file_out);
+
+  return out;
+}
+
+static gboolean
+write_header(GOutputStream *out, const gchar *title, GError **error)
+{
+  return write_str(out,
+                   "<!DOCTYPE html>\n<html>\n<head>\n<meta charset=\"utf-8\">\n"
+                   "<link rel=\"stylesheet\" href=\"style.css\">\n<title>",
+                   -1, error) &&
+         write_escaped(out, title, strlen(title), error) &&
+         write_str(out, "</title>\n</head>\n<body>\n", -1, error);
+}
+
+static void
+render_page(gpointer data, gpointer user_data)
+{
+  struct export_page *page = data;
+  GTask *task = G_TASK(user_data);
+  struct export_ctx *ctx = g_task_get_task_data(task);
+  GCancellable *cancellable = g_task_get_cancellable(task);
+  GError *lerr = NULL;
+  GOutputStream *out;
+  const gchar *body;
+
+  if (g_cancellable_set_error_if_cancelled(cancellable, &lerr)) {
+    set_error(ctx, lerr);
+    return;
+  }
+
+  out = open_output(ctx, page->file, cancellable, &lerr);
+  if (out == NULL) {
+    set_error(ctx, lerr);
+    return;
+  }
+
+  /* Skip the "#heading" line, the heading gets its own element */
+  body = memchr(page->md->str, '\n', page->md->len);
+  body = body != NULL ? body + 1 : page->md->str + page->md->len;
+
+  if (!write_header(out, page->heading, &lerr) ||
+      !write_str(out, "<h1 class=\"", -1, &lerr) ||
+      !write_str(out, page->css_name, -1, &lerr) ||
+      !write_str(out, "\">", -1, &lerr) ||
+      !write_escaped(out, page->heading, strlen(page->heading), &lerr) ||
+      !write_str(out, "</h1>\n<div class=\"page\">", -1, &lerr) ||
+      !write_body(out, ctx, body, page->md->str + page->md->len - body,
+                  &lerr) ||
+      !write_str(out,
+                 "</div>\n<p><a href=\"index.html\">Index</a></p>\n"
+                 "</body>\n</html>\n",
+                 -1, &lerr) ||
+      !g_output_stream_close(out, cancellable, &lerr)) {
+    set_error(ctx, lerr);
+  }
+
+  g_object_unref(out);
+}
+
+static gboolean
+write_style(struct export_ctx *ctx, GCancellable *cancellable, GError **error)
+{
+  GOutputStream *out;
+  gboolean ok;
+
+  out = open_output(ctx, "style.css", cancellable, error);
+  if (out == NULL) {
+    return FALSE;
+  }
+
+  ok = write_str(out,
+                 ".page {white-space: pre-wrap;}\n"
+                 ".link {padding: 0px 4px; border-radius: 4px; "
+                 "color: inherit; text-decoration: none;}\n"
+                 ".missing {font-style: italic;}\n",
+                 -1, error);
+
+  for (guint i = 0; ok && i < ctx->pages->len; i++) {
+    struct export_page *page = g_ptr_array_index(ctx->pages, i);
+
+    ok = write_str(out, ".", -1, error) &&
+         write_str(out, page->css_name, -1, error) &&
+         write_str(out, " {background-color: ", -1, error) &&
+         write_str(out, page->color, -1, error) &&
+         write_str(out, ";}\n", -1, error);
+  }
+
+  ok = ok && g_output_stream_close(out, cancellable, error);
+  g_object_unref(out);
+
+  return ok;
+}
+
+static gboolean
+write_index(struct export_ctx *ctx, GCancellable *cancellable, GError **error)
+{
+  GOutputStream *out;
+  gboolean ok;
+
+  out = open_output(ctx, "index.html", cancellable, error);
+  if (out == NULL) {
+    return FALSE;
+  }
+
+  ok = write_header(out, "Index", error) &&
+       write_str(out, "<h1>Index</h1>\n<ul>\n", -1, error);
+
+  for (guint i = 0; ok && i < ctx->pages->len; i++) {
+    struct export_page *page = g_ptr_array_index(ctx->pages, i);
+
+    ok = write_str(out, "<li>", -1, error) &&
+         write_link(out, ctx, page->heading, strlen(page->heading), error) &&
+         write_str(out, "</li>\n", -1, error);
+  }
+
+  ok = ok && write_str(out, "</ul>\n</body>\n</html>\n", -1, error) &&
+       g_output_stream_close(out, cancellable, error);
+  g_object_unref(out);
+
+  return ok;
+}
+
+static void
+render_thread(GTask *task,
+              G_GNUC_UNUSED gpointer source_object,
+              gpointer task_data,
+              GCancellable *cancellable)
+{
+  struct export_ctx *ctx = task_data;
+  GError *lerr = NULL;
+  GThreadPool *pool;
+
+  if (g_mkdir_with_parents(ctx->dest, 0755) != 0) {
+    g_task_return_new_error(task, G_IO_ERROR,
+                            g_io_error_from_errno(errno),
+                            "Could not create %s: %s", ctx->dest,
+                            g_strerror(errno));
+    return;
+  }
+
+  if (!write_style(ctx, cancellable, &lerr)) {
+    g_task_return_error(task, lerr);
+    return;
+  }
+
+  pool = g_thread_pool_new(render_page, task, g_get_num_processors(), FALSE,
+                           &lerr);
+  if (pool == NULL) {
+    g_task_return_error(task, lerr);
+    return;
+  }
+
+  for (guint i = 0; i < ctx->pages->len; i++) {
+    g_thread_pool_push(pool, g_ptr_array_index(ctx->pages, i), NULL);
+  }
+
+  /* Waits for all pages to be rendered */
+  g_thread_pool_free(pool, FALSE, TRUE);
+
+  if (ctx->error != NULL) {
+    g_task_return_error(task, g_steal_pointer(&ctx->error));
+    return;
+  }
+
+  if (!write_index(ctx, cancellable, &lerr)) {
+    g_task_return_error(task, lerr);
+    return;
+  }
+
+  g_task_return_boolean(task, TRUE);
+}
+
+static gboolean
+snapshot_page(gpointer user_data)
+{
+  GTask *task = G_TASK(user_data);
+  struct export_ctx *ctx = g_task_get_task_data(task);
+  struct export_page *page;
+  EditorPage *source;
+
+  if (ctx->next_source >= ctx->sources->len) {
+    /* Release the pages here, the task may be finalized on a worker */
+    g_ptr_array_set_size(ctx->sources, 0);
+    g_task_run_in_thread(task, render_thread);
+    g_object_unref(task);
+    return G_SOURCE_REMOVE;
+  }
+
+  /* One page per main loop iteration to keep the UI responsive */
+  source = g_ptr_array_index(ctx->sources, ctx->next_source++);
+
+  page = g_malloc0(sizeof(*page));
+  page->heading = g_strdup(source->heading);
+  page->file = unique_file_name(ctx, source->heading);
+  page->css_name = g_strdup_printf("p%u", ctx->pages->len);
+  page->color = gdk_rgba_to_string(&source->color);
+  page->md = editor_page_to_md(source);
+
+  g_ptr_array_add(ctx->pages, page);
+  g_hash_table_add(ctx->files, page->file);
+  g_hash_table_insert(ctx->headings, page->heading, page);
+
+  return G_SOURCE_CONTINUE;
+}
+
+void
+export_html_async(GQueue *pages_list,
+                  const gchar *dest,
+                  GCancellable *cancellable,
+                  GAsyncReadyCallback callback,
+                  gpointer user_data)
+{
+  struct export_ctx *ctx;
+  GTask *task;
+
+  g_assert(pages_list);
+  g_assert(dest);
+
+  ctx = g_malloc0(sizeof(*ctx));
+  ctx->dest = g_strdup(dest);
+  ctx->sources = g_ptr_array_new_with_free_func(g_object_unref);
+  ctx->pages = g_ptr_array_new_with_free_func(export_page_free);
+  ctx->headings = g_hash_table_new(g_str_hash, g_str_equal);
+  ctx->files = g_hash_table_new(g_str_hash, g_str_equal);
+  g_mutex_init(&ctx->lock);
+
+  for (GList *iter = pages_list->head; iter != NULL; iter = iter->next) {
+    g_ptr_array_add(ctx->sources, g_object_ref(iter->data));
+  }
+
+  task = g_task_new(NULL, cancellable, callback, user_data);
+  g_task_set_source_tag(task, export_html_async);
+  g_task_set_task_data(task, ctx, export_ctx_free);
+
+  g_idle_add(snapshot_page, task);
+}
+
+gboolean
+export_html_finish(GAsyncResult *res, GError **error)
+{
+  g_return_val_if_fail(g_task_is_valid(res, NULL), FALSE);
+
+  return g_task_propagate_boolean(G_TASK(res), error);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Render every page in pages_list to a static HTML site in dest.
+ *
+ * The pages are serialized from idle callbacks on the calling thread and then
+ * rendered concurrently on a thread pool, so the UI is never blocked. dest
+ * ends up with one file per page, a style.css with the page colors and an
+ * index.html in pages_list order.
+ */
+void export_html_async(GQueue *pages_list,
+                       const gchar *dest,
+                       GCancellable *cancellable,
+                       GAsyncReadyCallback callback,
+                       gpointer user_data);
+
+gboolean export_html_finish(GAsyncResult *res, GError **error);
+
+G_END_DECLS
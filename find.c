@@ -0,0 +1,406 @@
+#include "find.h"
+#include "editor_page.h"
+#include "search.h"
+#include <glib.h>
+#include <gtk/gtk.h>
+
+/* Matches listed for review, the count covers the rest */
+#define PREVIEW_ROWS 200
+
+struct find {
+  GtkApplication *app;
+  GtkWidget *pattern;
+  GtkWidget *replacement;
+  GtkWidget *regex;
+  GtkWidget *caseless;
+  GtkWidget *status;
+  GtkWidget *list;
+  GtkWidget *replace_button;
+  GCancellable *cancellable;
+  GPtrArray *matches;
+  /* Searched pages, kept alive while their matches are */
+  GPtrArray *pages;
+  /* page -> pending_pos its markdown was searched from */
+  GHashTable *pending;
+};
+
+static void
+find_free(gpointer data)
+{
+  struct find *find = data;
+
+  g_cancellable_cancel(find->cancellable);
+  g_clear_object(&find->cancellable);
+  g_clear_pointer(&find->matches, g_ptr_array_unref);
+  g_ptr_array_unref(find->pages);
+  g_hash_table_unref(find->pending);
+  g_free(find);
+}
+
+static void
+clear_matches(struct find *find)
+{
+  GtkWidget *row;
+
+  g_clear_pointer(&find->matches, g_ptr_array_unref);
+  g_ptr_array_set_size(find->pages, 0);
+  g_hash_table_remove_all(find->pending);
+  while ((row = gtk_widget_get_first_child(find->list)) != NULL) {
+    gtk_list_box_remove(GTK_LIST_BOX(find->list), row);
+  }
+  gtk_widget_set_sensitive(find->replace_button, FALSE);
+}
+
+/* Loaded text up to the loading placeholder, then the markdown not loaded
+ * yet. Slices keep character offsets the same as in the buffer, the
+ * markdown is searched from pending_pos on. */
+static GPtrArray *
+snapshot_texts(struct find *find)
+{
+  GQueue *pages_list = g_object_get_data(G_OBJECT(find->app), "pages_list");
+  GPtrArray *texts;
+
+  texts = g_ptr_array_new_with_free_func((GDestroyNotify) search_text_free);
+
+  for (GList *iter = pages_list->head; iter != NULL; iter = iter->next) {
+    EditorPage *page = EDITOR_PAGE(iter->data);
+    GtkTextIter start;
+    GtkTextIter end;
+
+    if (page->removed) {
+      continue;
+    }
+
+    g_ptr_array_add(find->pages, g_object_ref(page));
+    gtk_text_buffer_get_start_iter(page->content, &start);
+    if (page->load_mark != NULL) {
+      gtk_text_buffer_get_iter_at_mark(page->content, &end, page->load_mark);
+    } else {
+      gtk_text_buffer_get_end_iter(page->content, &end);
+    }
+    g_ptr_array_add(texts,
+                    search_text_new(page, gtk_text_iter_get_slice(&start, &end),
+                                    FALSE));
+
+    if (page->pending != NULL) {
+      SearchText *pending = search_text_new(page,
+                                            g_strndup(page->pending,
+                                                      page->pending_len),
+                                            TRUE);
+
+      pending->from = page->pending_pos;
+      g_hash_table_insert(find->pending, page,
+                          GSIZE_TO_POINTER(page->pending_pos));
+      g_ptr_array_add(texts, pending);
+    }
+  }
+
+  return texts;
+}
+
+static GtkWidget *
+match_row(SearchMatch *match)
+{
+  GtkWidget *label;
+  gchar *markup;
+
+  markup = g_markup_printf_escaped("<b>%s</b>  %s<s>%s</s><u>%s</u>%s",
+                                   EDITOR_PAGE(match->page)->heading,
+                                   match->before, match->text,
+                                   match->replacement, match->after);
+  label = gtk_label_new(NULL);
+  gtk_label_set_markup(GTK_LABEL(label), markup);
+  gtk_label_set_xalign(GTK_LABEL(label), 0);
+  gtk_label_set_ellipsize(GTK_LABEL(label), PANGO_ELLIPSIZE_END);
+  g_free(markup);
+
+  return label;
+}
+
+static void
+search_done(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  GtkWidget *window = GTK_WIDGET(user_data);
+  struct find *find = g_object_get_data(G_OBJECT(window), "find");
+  GHashTable *pages;
+  GPtrArray *matches;
+  GError *lerr = NULL;
+  gchar *status;
+
+  matches = search_finish(res, &lerr);
+  if (matches == NULL) {
+    if (!g_error_matches(lerr, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+      gtk_label_set_text(GTK_LABEL(find->status), lerr->message);
+    }
+    g_clear_error(&lerr);
+    g_object_unref(window);
+    return;
+  }
+
+  /* Links follow page headings, they are renamed with the page instead.
+   * Pages removed while searching are left alone. */
+  for (guint i = matches->len; i > 0; i--) {
+    SearchMatch *match = g_ptr_array_index(matches, i - 1);
+    EditorPage *page = EDITOR_PAGE(match->page);
+
+    if (page->removed ||
+        (!match->markdown &&
+         editor_page_range_has_link(page, match->start, match->end))) {
+      g_ptr_array_remove_index(matches, i - 1);
+    }
+  }
+
+  pages = g_hash_table_new(NULL, NULL);
+  for (guint i = 0; i < matches->len; i++) {
+    SearchMatch *match = g_ptr_array_index(matches, i);
+
+    g_hash_table_add(pages, match->page);
+    if (i < PREVIEW_ROWS) {
+      gtk_list_box_append(GTK_LIST_BOX(find->list), match_row(match));
+    }
+  }
+
+  if (matches->len > PREVIEW_ROWS) {
+    status = g_strdup_printf("%u matches in %u pages, showing the first %u",
+                             matches->len, g_hash_table_size(pages),
+                             PREVIEW_ROWS);
+  } else {
+    status = g_strdup_printf("%u matches in %u pages", matches->len,
+                             g_hash_table_size(pages));
+  }
+  gtk_label_set_text(GTK_LABEL(find->status), status);
+  gtk_widget_set_sensitive(find->replace_button, matches->len > 0);
+
+  find->matches = matches;
+
+  g_free(status);
+  g_hash_table_unref(pages);
+  g_object_unref(window);
+}
+
+static void
+start_search(G_GNUC_UNUSED GtkWidget *widget, gpointer user_data)
+{
+  GtkWidget *window = GTK_WIDGET(user_data);
+  struct find *find = g_object_get_data(G_OBJECT(window), "find");
+  const gchar *pattern;
+  SearchFlags flags = SEARCH_DEFAULT;
+
+  g_cancellable_cancel(find->cancellable);
+  g_clear_object(&find->cancellable);
+  clear_matches(find);
+
+  pattern = gtk_editable_get_text(GTK_EDITABLE(find->pattern));
+  if (pattern[0] == '\0') {
+    gtk_label_set_text(GTK_LABEL(find->status), "");
+    return;
+  }
+
+  if (gtk_check_button_get_active(GTK_CHECK_BUTTON(find->regex))) {
+    flags |= SEARCH_REGEX;
+  }
+  if (!gtk_check_button_get_active(GTK_CHECK_BUTTON(find->caseless))) {
+    flags |= SEARCH_CASELESS;
+  }
+
+  gtk_label_set_text(GTK_LABEL(find->status), "Searching…");
+  find->cancellable = g_cancellable_new();
+  search_async(snapshot_texts(find), pattern,
+               gtk_editable_get_text(GTK_EDITABLE(find->replacement)), flags,
+               find->cancellable, search_done, g_object_ref(window));
+}
+
+static void
+replace_all(G_GNUC_UNUSED GtkWidget *widget, gpointer user_data)
+{
+  struct find *find = user_data;
+  GHashTable *pending;
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+  EditorPage *page = NULL;
+  guint replaced = 0;
+  guint skipped = 0;
+  gchar *status;
+
+  if (find->matches == NULL) {
+    return;
+  }
+
+  /* page -> its pending matches, in order */
+  pending = g_hash_table_new_full(NULL, NULL, NULL,
+                                  (GDestroyNotify) g_ptr_array_unref);
+
+  /* Backwards, so earlier offsets of a page still hold. One undo step per
+   * page. */
+  for (guint i = find->matches->len; i > 0; i--) {
+    SearchMatch *match = g_ptr_array_index(find->matches, i - 1);
+    EditorPage *match_page = EDITOR_PAGE(match->page);
+
+    if (match->markdown) {
+      GPtrArray *page_matches = g_hash_table_lookup(pending, match_page);
+
+      if (page_matches == NULL) {
+        page_matches = g_ptr_array_new();
+        g_hash_table_insert(pending, match_page, page_matches);
+      }
+      g_ptr_array_insert(page_matches, 0, match);
+      continue;
+    }
+
+    if (match_page != page) {
+      if (page != NULL) {
+        gtk_text_buffer_end_user_action(page->content);
+      }
+      page = match_page;
+      gtk_text_buffer_begin_user_action(page->content);
+    }
+
+    if (!page->removed &&
+        editor_page_replace_range(page, match->start, match->end, match->text,
+                                  match->replacement)) {
+      replaced++;
+    } else {
+      skipped++;
+    }
+  }
+  if (page != NULL) {
+    gtk_text_buffer_end_user_action(page->content);
+  }
+
+  g_hash_table_iter_init(&iter, pending);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    GPtrArray *page_matches = value;
+    guint n = 0;
+
+    if (!EDITOR_PAGE(key)->removed) {
+      n = editor_page_replace_pending(
+        EDITOR_PAGE(key),
+        GPOINTER_TO_SIZE(g_hash_table_lookup(find->pending, key)),
+        page_matches);
+    }
+    replaced += n;
+    skipped += page_matches->len - n;
+  }
+
+  if (skipped > 0) {
+    status = g_strdup_printf("Replaced %u, %u skipped as their page changed "
+                             "since the search",
+                             replaced, skipped);
+  } else {
+    status = g_strdup_printf("Replaced %u", replaced);
+  }
+  gtk_label_set_text(GTK_LABEL(find->status), status);
+  clear_matches(find);
+
+  g_free(status);
+  g_hash_table_unref(pending);
+}
+
+static void
+forget_window(GtkApplication *app)
+{
+  g_object_set_data(G_OBJECT(app), "find-window", NULL);
+}
+
+void
+find_show(GtkApplication *app, GtkWindow *parent)
+{
+  GtkWidget *window;
+  GtkWidget *box;
+  GtkWidget *options;
+  GtkWidget *find_button;
+  GtkWidget *scroll;
+  struct find *find;
+
+  window = g_object_get_data(G_OBJECT(app), "find-window");
+  if (window != NULL) {
+    gtk_window_present(GTK_WINDOW(window));
+    return;
+  }
+
+  find = g_malloc0(sizeof(*find));
+  find->app = app;
+  find->pages = g_ptr_array_new_with_free_func(g_object_unref);
+  find->pending = g_hash_table_new(NULL, NULL);
+
+  window = gtk_window_new();
+  gtk_window_set_title(GTK_WINDOW(window), "Find and replace");
+  gtk_window_set_transient_for(GTK_WINDOW(window), parent);
+  gtk_window_set_default_size(GTK_WINDOW(window), 560, 480);
+  gtk_window_set_hide_on_close(GTK_WINDOW(window), TRUE);
+  gtk_window_set_destroy_with_parent(GTK_WINDOW(window), TRUE);
+  g_signal_connect_swapped(window, "destroy", G_CALLBACK(forget_window), app);
+  g_object_set_data_full(G_OBJECT(window), "find", find, find_free);
+
+  box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 6);
+  gtk_widget_set_margin_top(box, 12);
+  gtk_widget_set_margin_bottom(box, 12);
+  gtk_widget_set_margin_start(box, 12);
+  gtk_widget_set_margin_end(box, 12);
+  gtk_window_set_child(GTK_WINDOW(window), box);
+
+  find->pattern = gtk_entry_new();
+  gtk_entry_set_placeholder_text(GTK_ENTRY(find->pattern), "Find");
+  g_signal_connect(find->pattern, "activate", G_CALLBACK(start_search),
+                   window);
+  gtk_box_append(GTK_BOX(box), find->pattern);
+
+  find->replacement = gtk_entry_new();
+  gtk_entry_set_placeholder_text(GTK_ENTRY(find->replacement),
+                                 "Replace with");
+  g_signal_connect(find->replacement, "activate", G_CALLBACK(start_search),
+                   window);
+  gtk_box_append(GTK_BOX(box), find->replacement);
+
+  options = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 12);
+  find->regex = gtk_check_button_new_with_label("Regular expression");
+  gtk_box_append(GTK_BOX(options), find->regex);
+  find->caseless = gtk_check_button_new_with_label("Match case");
+  gtk_box_append(GTK_BOX(options), find->caseless);
+  find_button = gtk_button_new_with_label("Find");
+  gtk_widget_set_hexpand(find_button, TRUE);
+  gtk_widget_set_halign(find_button, GTK_ALIGN_END);
+  g_signal_connect(find_button, "clicked", G_CALLBACK(start_search), window);
+  gtk_box_append(GTK_BOX(options), find_button);
+  gtk_box_append(GTK_BOX(box), options);
+
+  find->status = gtk_label_new("");
+  gtk_label_set_xalign(GTK_LABEL(find->status), 0);
+  gtk_box_append(GTK_BOX(box), find->status);
+
+  find->list = gtk_list_box_new();
+  gtk_list_box_set_selection_mode(GTK_LIST_BOX(find->list),
+                                  GTK_SELECTION_NONE);
+  scroll = gtk_scrolled_window_new();
+  gtk_widget_set_vexpand(scroll, TRUE);
+  gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(scroll), find->list);
+  gtk_box_append(GTK_BOX(box), scroll);
+
+  find->replace_button = gtk_button_new_with_label("Replace all");
+  gtk_widget_set_halign(find->replace_button, GTK_ALIGN_END);
+  gtk_widget_set_sensitive(find->replace_button, FALSE);
+  g_signal_connect(find->replace_button, "clicked", G_CALLBACK(replace_all),
+                   find);
+  gtk_box_append(GTK_BOX(box), find->replace_button);
+
+  g_object_set_data(G_OBJECT(app), "find-window", window);
+  gtk_window_present(GTK_WINDOW(window));
+}
+
+void
+find_reset(GtkApplication *app)
+{
+  GtkWidget *window = g_object_get_data(G_OBJECT(app), "find-window");
+  struct find *find;
+
+  if (window == NULL) {
+    return;
+  }
+
+  find = g_object_get_data(G_OBJECT(window), "find");
+  g_cancellable_cancel(find->cancellable);
+  g_clear_object(&find->cancellable);
+  clear_matches(find);
+  gtk_label_set_text(GTK_LABEL(find->status), "");
+}
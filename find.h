@@ -0,0 +1,17 @@
+#pragma once
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Find and replace across every page of the workspace. Searching runs off
+ * the main thread on a copy of the texts, the matches are listed for review
+ * and only change the pages once replaced.
+ */
+void find_show(GtkApplication *app, GtkWindow *parent);
+
+/* Drops the matches, for when the pages they are in are closed */
+void find_reset(GtkApplication *app);
+
+G_END_DECLS
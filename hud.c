@@ -0,0 +1,146 @@
+#include "hud.h"
+#include "editor_page.h"
+#include "perf.h"
+#include <glib.h>
+#include <gtk/gtk.h>
+
+struct hud {
+  GtkApplication *app;
+  GdkFrameClock *clock;
+  gulong paint_handler;
+  guint refresh_source;
+};
+
+static void
+hud_free(gpointer data)
+{
+  struct hud *hud = data;
+
+  g_clear_handle_id(&hud->refresh_source, g_source_remove);
+  g_clear_signal_handler(&hud->paint_handler, hud->clock);
+  g_free(hud);
+}
+
+static void
+after_paint(GdkFrameClock *clock, G_GNUC_UNUSED gpointer user_data)
+{
+  perf_frame(gdk_frame_clock_get_frame_time(clock));
+}
+
+static gboolean
+refresh(gpointer user_data)
+{
+  GtkLabel *label = GTK_LABEL(user_data);
+  struct hud *hud = g_object_get_data(G_OBJECT(label), "hud");
+  GQueue *pages_list;
+  guint loaded = 0;
+  guint loading = 0;
+  gint64 frame_avg;
+  gint64 frame_max;
+  GString *text;
+
+  pages_list = g_object_get_data(G_OBJECT(hud->app), "pages_list");
+
+  for (GList *iter = pages_list->head; iter != NULL; iter = iter->next) {
+    EditorPage *page = EDITOR_PAGE(iter->data);
+
+    if (page->pending != NULL) {
+      loading++;
+    } else {
+      loaded++;
+    }
+  }
+
+  perf_frame_stats(&frame_avg, &frame_max);
+
+  text = g_string_new("");
+  g_string_printf(text, "pages          %u\n"
+                  "loaded         %u (%u loading)\n"
+                  "links          %u\n"
+                  "text tags      %d\n"
+                  "css providers  %" G_GINT64_FORMAT "\n"
+                  "first page     %.1f ms\n"
+                  "load_repo      %.1f ms\n"
+                  "save           %.1f ms\n"
+                  "set_page       %.1f ms\n"
+                  "frames         %.1f ms avg, %.1f ms max, %.0f fps",
+                  g_queue_get_length(pages_list), loaded, loading,
+                  link_graph_n_links(editor_page_links()),
+                  gtk_text_tag_table_get_size(editor_page_tag_table()),
+                  perf_counter(PERF_CSS_PROVIDERS),
+                  perf_last(PERF_FIRST_PAGE) / 1000.0,
+                  perf_last(PERF_LOAD_REPO) / 1000.0,
+                  perf_last(PERF_SAVE) / 1000.0,
+                  perf_last(PERF_SET_PAGE) / 1000.0, frame_avg / 1000.0,
+                  frame_max / 1000.0,
+                  hud->clock != NULL ? gdk_frame_clock_get_fps(hud->clock)
+                                     : 0.0);
+
+  /* Nearest rank percentiles of the recent samples */
+  for (guint i = 0; perf_latency_enabled() && i < PERF_N_LATENCIES; i++) {
+    gint64 p50;
+    gint64 p95;
+    gint64 p99;
+    guint n;
+
+    n = perf_latency_stats(i, &p50, &p95, &p99);
+    g_string_append_printf(text,
+                           "\n%-14s %.2f / %.2f / %.2f ms p50/95/99 (%u)",
+                           perf_latency_name(i), p50 / 1000.0, p95 / 1000.0,
+                           p99 / 1000.0, n);
+  }
+
+  gtk_label_set_text(label, text->str);
+  g_string_free(text, TRUE);
+
+  return G_SOURCE_CONTINUE;
+}
+
+GtkWidget *
+hud_new(GtkApplication *app)
+{
+  GtkWidget *label;
+  struct hud *hud;
+
+  label = gtk_label_new("");
+  gtk_widget_add_css_class(label, "hud");
+  gtk_widget_add_css_class(label, "monospace");
+  gtk_widget_set_halign(label, GTK_ALIGN_END);
+  gtk_widget_set_valign(label, GTK_ALIGN_START);
+  gtk_widget_set_margin_top(label, 60);
+  gtk_widget_set_margin_end(label, 20);
+  gtk_widget_set_can_target(label, FALSE);
+  gtk_widget_set_visible(label, FALSE);
+
+  hud = g_malloc0(sizeof(*hud));
+  hud->app = app;
+  g_object_set_data_full(G_OBJECT(label), "hud", hud, hud_free);
+
+  return label;
+}
+
+void
+hud_toggle(GtkWidget *label)
+{
+  struct hud *hud = g_object_get_data(G_OBJECT(label), "hud");
+
+  if (gtk_widget_get_visible(label)) {
+    gtk_widget_set_visible(label, FALSE);
+    g_clear_handle_id(&hud->refresh_source, g_source_remove);
+    g_clear_signal_handler(&hud->paint_handler, hud->clock);
+    hud->clock = NULL;
+    return;
+  }
+
+  gtk_widget_set_visible(label, TRUE);
+
+  perf_frame_reset();
+  hud->clock = gtk_widget_get_frame_clock(label);
+  if (hud->clock != NULL) {
+    hud->paint_handler = g_signal_connect(hud->clock, "after-paint",
+                                          G_CALLBACK(after_paint), NULL);
+  }
+
+  refresh(label);
+  hud->refresh_source = g_timeout_add_seconds(1, refresh, label);
+}
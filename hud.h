@@ -0,0 +1,15 @@
+#pragma once
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Overlay with live workspace statistics. Hidden until toggled, and only
+ * refreshed and hooked up to the frame clock while it is shown.
+ */
+GtkWidget *hud_new(GtkApplication *app);
+
+void hud_toggle(GtkWidget *hud);
+
+G_END_DECLS
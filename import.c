@@ -0,0 +1,503 @@
+#include "import.h"
+#include "markdown.h"
+#include <gio/gio.h>
+#include <glib.h>
+
+#include <string.h>
+
+/* Directory symlinks are not followed, this only bounds very deep trees */
+#define IMPORT_MAX_DEPTH 32
+
+#define IMPORT_FALLBACK_HEADING "Imported page"
+
+struct import_file {
+  gchar *path;
+  gchar *stem;
+  gchar *heading;
+
+  gchar *contents;
+  gsize len;
+
+  /* The "# heading" line, left out of the page body */
+  gsize head_start;
+  gsize head_end;
+
+  GArray *links;
+};
+
+struct import_ctx {
+  gchar *src;
+  GStrv existing;
+  GPtrArray *files;
+
+  GMutex lock;
+  GError *error;
+};
+
+static void
+import_file_free(gpointer data)
+{
+  struct import_file *file = data;
+
+  g_free(file->path);
+  g_free(file->stem);
+  g_free(file->heading);
+  g_free(file->contents);
+  if (file->links != NULL) {
+    g_array_unref(file->links);
+  }
+  g_free(file);
+}
+
+static void
+import_ctx_free(gpointer data)
+{
+  struct import_ctx *ctx = data;
+
+  g_free(ctx->src);
+  g_strfreev(ctx->existing);
+  g_ptr_array_unref(ctx->files);
+  g_mutex_clear(&ctx->lock);
+  g_clear_error(&ctx->error);
+  g_free(ctx);
+}
+
+static void
+free_page(gpointer data)
+{
+  g_string_free(data, TRUE);
+}
+
+/* Keeps the first error, the pool keeps draining but skips the work */
+static void
+set_error(struct import_ctx *ctx, GError *error)
+{
+  g_mutex_lock(&ctx->lock);
+  if (ctx->error == NULL) {
+    ctx->error = error;
+  } else {
+    g_error_free(error);
+  }
+  g_mutex_unlock(&ctx->lock);
+}
+
+static gboolean
+has_error(struct import_ctx *ctx)
+{
+  gboolean ret;
+
+  g_mutex_lock(&ctx->lock);
+  ret = ctx->error != NULL;
+  g_mutex_unlock(&ctx->lock);
+
+  return ret;
+}
+
+/* A heading has to survive being written as a [[link]] */
+static gboolean
+valid_heading(const gchar *heading)
+{
+  return md_valid_link_name(heading, strlen(heading)) &&
+         strpbrk(heading, "|#") == NULL;
+}
+
+static gint
+compare_path(gconstpointer a, gconstpointer b)
+{
+  const struct import_file *file_a = *(struct import_file **) a;
+  const struct import_file *file_b = *(struct import_file **) b;
+
+  return strcmp(file_a->path, file_b->path);
+}
+
+static gboolean
+collect(struct import_ctx *ctx, const gchar *rel, guint depth, GError **error)
+{
+  const gchar *name;
+  gchar *path;
+  GDir *dir;
+  gboolean ok = TRUE;
+
+  path = rel != NULL ? g_build_filename(ctx->src, rel, NULL)
+                     : g_strdup(ctx->src);
+
+  dir = g_dir_open(path, 0, error);
+  if (dir == NULL) {
+    g_free(path);
+    return FALSE;
+  }
+
+  while (ok && (name = g_dir_read_name(dir)) != NULL) {
+    gchar *child_rel;
+    gchar *child;
+
+    /* Hidden folders hold the settings and caches of other tools */
+    if (name[0] == '.') {
+      continue;
+    }
+
+    child_rel = rel != NULL ? g_build_filename(rel, name, NULL)
+                            : g_strdup(name);
+    child = g_build_filename(path, name, NULL);
+
+    if (g_file_test(child, G_FILE_TEST_IS_DIR)) {
+      if (depth < IMPORT_MAX_DEPTH &&
+          !g_file_test(child, G_FILE_TEST_IS_SYMLINK)) {
+        ok = collect(ctx, child_rel, depth + 1, error);
+      }
+    } else if (g_str_has_suffix(name, ".md")) {
+      struct import_file *file = g_malloc0(sizeof(*file));
+
+      file->path = g_steal_pointer(&child_rel);
+      file->stem = g_strndup(name, strlen(name) - strlen(".md"));
+      g_ptr_array_add(ctx->files, file);
+    }
+
+    g_free(child_rel);
+    g_free(child);
+  }
+
+  g_dir_close(dir);
+  g_free(path);
+
+  return ok;
+}
+
+static void
+parse_file(gpointer data, gpointer user_data)
+{
+  struct import_file *file = data;
+  GTask *task = G_TASK(user_data);
+  struct import_ctx *ctx = g_task_get_task_data(task);
+  GCancellable *cancellable = g_task_get_cancellable(task);
+  GError *lerr = NULL;
+  GArray *tokens;
+  gchar *full_path;
+  gboolean found_heading = FALSE;
+
+  if (has_error(ctx)) {
+    return;
+  }
+
+  if (g_cancellable_set_error_if_cancelled(cancellable, &lerr)) {
+    set_error(ctx, lerr);
+    return;
+  }
+
+  full_path = g_build_filename(ctx->src, file->path, NULL);
+  if (!g_file_get_contents(full_path, &file->contents, &file->len, &lerr)) {
+    g_free(full_path);
+    set_error(ctx, lerr);
+    return;
+  }
+  g_free(full_path);
+
+  if (!g_utf8_validate_len(file->contents, file->len, NULL)) {
+    gchar *valid = g_utf8_make_valid(file->contents, file->len);
+
+    g_free(file->contents);
+    file->contents = valid;
+    file->len = strlen(valid);
+  }
+
+  /* The tokenizer already knows to skip code blocks for both the heading and
+   * the links */
+  tokens = md_tokenize(file->contents, file->len, MD_PARSE_DEFAULT);
+  file->links = g_array_new(FALSE, FALSE, sizeof(MdToken));
+
+  for (guint i = 0; i < tokens->len; i++) {
+    MdToken *token = &g_array_index(tokens, MdToken, i);
+
+    if (token->type == MD_TOKEN_LINK || token->type == MD_TOKEN_EMBED) {
+      g_array_append_val(file->links, *token);
+    } else if (!found_heading && token->type == MD_TOKEN_OPEN &&
+               token->style == MD_H1) {
+      const gchar *line = file->contents + token->offset;
+      const gchar *nl = memchr(line, '\n', file->len - token->offset);
+      gsize end = nl != NULL ? (gsize) (nl - file->contents) : file->len;
+      gchar *heading;
+
+      found_heading = TRUE;
+
+      heading = g_strndup(line + token->len, end - token->offset - token->len);
+      g_strstrip(heading);
+
+      if (valid_heading(heading)) {
+        file->heading = heading;
+        file->head_start = token->offset;
+        file->head_end = nl != NULL ? end + 1 : end;
+      } else {
+        g_free(heading);
+      }
+    }
+  }
+
+  g_array_unref(tokens);
+}
+
+/* Makes every heading unique, files keep their order */
+static void
+assign_headings(struct import_ctx *ctx)
+{
+  GHashTable *used = g_hash_table_new(g_str_hash, g_str_equal);
+
+  for (guint i = 0; ctx->existing[i] != NULL; i++) {
+    g_hash_table_add(used, ctx->existing[i]);
+  }
+
+  for (guint i = 0; i < ctx->files->len; i++) {
+    struct import_file *file = g_ptr_array_index(ctx->files, i);
+    const gchar *base;
+    gchar *heading;
+    guint n = 2;
+
+    if (file->heading != NULL) {
+      base = file->heading;
+    } else if (valid_heading(file->stem)) {
+      base = file->stem;
+    } else {
+      base = IMPORT_FALLBACK_HEADING;
+    }
+
+    heading = g_strdup(base);
+    while (g_hash_table_contains(used, heading)) {
+      g_free(heading);
+      heading = g_strdup_printf("%s (%u)", base, n++);
+    }
+
+    g_free(file->heading);
+    file->heading = heading;
+    g_hash_table_add(used, heading);
+  }
+
+  g_hash_table_unref(used);
+}
+
+static void
+claim(GHashTable *names, gchar *key, struct import_file *file)
+{
+  if (g_hash_table_contains(names, key)) {
+    g_free(key);
+    return;
+  }
+
+  g_hash_table_insert(names, key, file);
+}
+
+/*
+ * Link targets are looked up by heading, then by path and then by file name,
+ * the first file claiming a name wins. folded holds the same names case
+ * folded, as some tools match links regardless of case.
+ */
+static void
+build_names(struct import_ctx *ctx, GHashTable *names, GHashTable *folded)
+{
+  for (guint pass = 0; pass < 3; pass++) {
+    for (guint i = 0; i < ctx->files->len; i++) {
+      struct import_file *file = g_ptr_array_index(ctx->files, i);
+      gchar *key;
+
+      switch (pass) {
+      case 0:
+        key = g_strdup(file->heading);
+        break;
+      case 1:
+        key = g_strndup(file->path, strlen(file->path) - strlen(".md"));
+        if (G_DIR_SEPARATOR != '/') {
+          g_strdelimit(key, G_DIR_SEPARATOR_S, '/');
+        }
+        break;
+      default:
+        key = g_strdup(file->stem);
+        break;
+      }
+
+      claim(folded, g_utf8_casefold(key, -1), file);
+      claim(names, key, file);
+    }
+  }
+}
+
+static struct import_file *
+resolve(gchar *target, GHashTable *names, GHashTable *folded)
+{
+  struct import_file *file;
+  gchar *cut;
+  gchar *key;
+
+  /* [[Name#Section|Alias]], sections and aliases have no equivalent here */
+  cut = strpbrk(target, "|#");
+  if (cut != NULL) {
+    *cut = '\0';
+  }
+  g_strstrip(target);
+
+  if (g_str_has_suffix(target, ".md")) {
+    target[strlen(target) - strlen(".md")] = '\0';
+  }
+
+  file = g_hash_table_lookup(names, target);
+  if (file != NULL) {
+    return file;
+  }
+
+  key = g_utf8_casefold(target, -1);
+  file = g_hash_table_lookup(folded, key);
+  g_free(key);
+
+  return file;
+}
+
+/* Appends [from, to) of the file, minus the heading line */
+static void
+append_body(GString *md, struct import_file *file, gsize from, gsize to)
+{
+  if (file->head_end > 0 && from <= file->head_start && to >= file->head_end) {
+    g_string_append_len(md, file->contents + from, file->head_start - from);
+    from = file->head_end;
+  }
+
+  g_string_append_len(md, file->contents + from, to - from);
+}
+
+static GString *
+build_page(struct import_file *file, GHashTable *names, GHashTable *folded)
+{
+  GString *md = g_string_sized_new(file->len + strlen(file->heading) + 2);
+  gsize cursor = 0;
+
+  g_string_append_c(md, '#');
+  g_string_append(md, file->heading);
+  g_string_append_c(md, '\n');
+
+  for (guint i = 0; i < file->links->len; i++) {
+    MdToken *token = &g_array_index(file->links, MdToken, i);
+    struct import_file *target_file;
+    gchar *target;
+
+    append_body(md, file, cursor, token->offset);
+
+    target = md_link_target(file->contents, token);
+    target_file = resolve(target, names, folded);
+
+    /* [[#Section]] points into the page itself */
+    if (target_file == NULL && target[0] == '\0') {
+      target_file = file;
+    }
+
+    /* Unresolved links stay, loading turns them into new empty pages */
+    g_string_append(md, token->type == MD_TOKEN_EMBED ? "![[" : "[[");
+    g_string_append(md, target_file != NULL ? target_file->heading : target);
+    g_string_append(md, "]]");
+
+    g_free(target);
+    cursor = token->offset + token->len;
+  }
+
+  append_body(md, file, cursor, file->len);
+
+  return md;
+}
+
+static void
+import_thread(GTask *task,
+              G_GNUC_UNUSED gpointer source_object,
+              gpointer task_data,
+              GCancellable *cancellable)
+{
+  struct import_ctx *ctx = task_data;
+  GError *lerr = NULL;
+  GThreadPool *pool;
+  GHashTable *names;
+  GHashTable *folded;
+  GPtrArray *pages;
+
+  if (!collect(ctx, NULL, 0, &lerr)) {
+    g_task_return_error(task, lerr);
+    return;
+  }
+
+  if (ctx->files->len == 0) {
+    g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                            "No markdown files in %s", ctx->src);
+    return;
+  }
+
+  /* Directory order is arbitrary, keep the sidebar predictable */
+  g_ptr_array_sort(ctx->files, compare_path);
+
+  pool = g_thread_pool_new(parse_file, task, g_get_num_processors(), FALSE,
+                           &lerr);
+  if (pool == NULL) {
+    g_task_return_error(task, lerr);
+    return;
+  }
+
+  for (guint i = 0; i < ctx->files->len; i++) {
+    g_thread_pool_push(pool, g_ptr_array_index(ctx->files, i), NULL);
+  }
+
+  /* Waits for all files to be parsed */
+  g_thread_pool_free(pool, FALSE, TRUE);
+
+  if (ctx->error != NULL) {
+    g_task_return_error(task, g_steal_pointer(&ctx->error));
+    return;
+  }
+
+  if (g_task_return_error_if_cancelled(task)) {
+    return;
+  }
+
+  assign_headings(ctx);
+
+  names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  folded = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  build_names(ctx, names, folded);
+
+  pages = g_ptr_array_new_full(ctx->files->len, free_page);
+  for (guint i = 0; i < ctx->files->len; i++) {
+    g_ptr_array_add(pages, build_page(g_ptr_array_index(ctx->files, i), names,
+                                      folded));
+  }
+
+  g_hash_table_unref(names);
+  g_hash_table_unref(folded);
+
+  g_task_return_pointer(task, pages, (GDestroyNotify) g_ptr_array_unref);
+}
+
+void
+import_vault_async(const gchar *src,
+                   const gchar *const *existing,
+                   GCancellable *cancellable,
+                   GAsyncReadyCallback callback,
+                   gpointer user_data)
+{
+  struct import_ctx *ctx;
+  GTask *task;
+
+  g_assert(src);
+
+  ctx = g_malloc0(sizeof(*ctx));
+  ctx->src = g_strdup(src);
+  ctx->existing = existing != NULL ? g_strdupv((gchar **) existing)
+                                   : g_new0(gchar *, 1);
+  ctx->files = g_ptr_array_new_with_free_func(import_file_free);
+  g_mutex_init(&ctx->lock);
+
+  task = g_task_new(NULL, cancellable, callback, user_data);
+  g_task_set_source_tag(task, import_vault_async);
+  g_task_set_task_data(task, ctx, import_ctx_free);
+
+  g_task_run_in_thread(task, import_thread);
+  g_object_unref(task);
+}
+
+GPtrArray *
+import_vault_finish(GAsyncResult *res, GError **error)
+{
+  g_return_val_if_fail(g_task_is_valid(res, NULL), NULL);
+
+  return g_task_propagate_pointer(G_TASK(res), error);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Import a directory tree of markdown files, as written by other notes tools.
+ *
+ * The files are parsed concurrently on a thread pool. A page heading is the
+ * first "# " line of a file, or the file name without ".md". Links may name
+ * a heading, a file name or a path relative to src, optionally followed by a
+ * "#section" or "|alias" which are dropped, and are rewritten to the heading
+ * of the page they resolve to. Headings already in use, as listed in
+ * existing, and duplicate headings get a " (n)" suffix.
+ *
+ * The result is a GPtrArray of GString, each holding the contents of a page
+ * file in the workspace format, see editor_page_load_data().
+ */
+void import_vault_async(const gchar *src,
+                        const gchar *const *existing,
+                        GCancellable *cancellable,
+                        GAsyncReadyCallback callback,
+                        gpointer user_data);
+
+GPtrArray *import_vault_finish(GAsyncResult *res, GError **error);
+
+G_END_DECLS
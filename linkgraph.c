@@ -0,0 +1,277 @@
+#include "linkgraph.h"
+#include <glib.h>
+
+struct node {
+  gpointer page;
+  /* node -> number of links */
+  GHashTable *out;
+  GHashTable *in;
+  gboolean stub;
+  gboolean removed;
+};
+
+struct _LinkGraph {
+  GHashTable *nodes;
+  GHashTable *stubs;
+  GHashTable *orphans;
+  GHashTable *dangling;
+  guint n_links;
+};
+
+static void
+node_free(gpointer data)
+{
+  struct node *node = data;
+
+  g_hash_table_unref(node->out);
+  g_hash_table_unref(node->in);
+  g_free(node);
+}
+
+static struct node *
+get_node(LinkGraph *graph, gpointer page)
+{
+  struct node *node = g_hash_table_lookup(graph->nodes, page);
+
+  if (node == NULL) {
+    node = g_malloc0(sizeof(*node));
+    node->page = page;
+    node->out = g_hash_table_new(NULL, NULL);
+    node->in = g_hash_table_new(NULL, NULL);
+    g_hash_table_insert(graph->nodes, page, node);
+  }
+
+  return node;
+}
+
+static void
+set_member(GHashTable *set, gpointer page, gboolean member)
+{
+  if (member) {
+    g_hash_table_add(set, page);
+  } else {
+    g_hash_table_remove(set, page);
+  }
+}
+
+/* Self links do not keep a page from being an orphan */
+static gboolean
+has_sources(struct node *node)
+{
+  guint n = g_hash_table_size(node->in);
+
+  return n > 1 || (n == 1 && !g_hash_table_contains(node->in, node));
+}
+
+/* Puts node in the right sets, and forgets it once nothing refers to it */
+static void
+update(LinkGraph *graph, struct node *node)
+{
+  gpointer page = node->page;
+
+  set_member(graph->stubs, page, node->stub && !node->removed);
+  set_member(graph->orphans, page, !node->removed && !has_sources(node));
+  set_member(graph->dangling, page, node->removed && has_sources(node));
+
+  if (node->removed && g_hash_table_size(node->in) == 0 &&
+      g_hash_table_size(node->out) == 0) {
+    g_hash_table_remove(graph->nodes, page);
+  }
+}
+
+static void
+count(GHashTable *counts, struct node *node, gint delta)
+{
+  guint n = GPOINTER_TO_UINT(g_hash_table_lookup(counts, node));
+
+  g_assert(delta > 0 || n > 0);
+
+  n += delta;
+  if (n == 0) {
+    g_hash_table_remove(counts, node);
+  } else {
+    g_hash_table_insert(counts, node, GUINT_TO_POINTER(n));
+  }
+}
+
+LinkGraph *
+link_graph_new(void)
+{
+  LinkGraph *graph = g_malloc0(sizeof(*graph));
+
+  graph->nodes = g_hash_table_new_full(NULL, NULL, NULL, node_free);
+  graph->stubs = g_hash_table_new(NULL, NULL);
+  graph->orphans = g_hash_table_new(NULL, NULL);
+  graph->dangling = g_hash_table_new(NULL, NULL);
+
+  return graph;
+}
+
+void
+link_graph_free(LinkGraph *graph)
+{
+  if (graph == NULL) {
+    return;
+  }
+
+  g_hash_table_unref(graph->nodes);
+  g_hash_table_unref(graph->stubs);
+  g_hash_table_unref(graph->orphans);
+  g_hash_table_unref(graph->dangling);
+  g_free(graph);
+}
+
+void
+link_graph_add_page(LinkGraph *graph, gpointer page, gboolean stub)
+{
+  struct node *node = get_node(graph, page);
+
+  node->removed = FALSE;
+  node->stub = stub;
+  update(graph, node);
+}
+
+void
+link_graph_remove_page(LinkGraph *graph, gpointer page)
+{
+  struct node *node = g_hash_table_lookup(graph->nodes, page);
+  GHashTableIter iter;
+  gpointer target;
+
+  if (node == NULL) {
+    return;
+  }
+
+  node->removed = TRUE;
+
+  g_hash_table_iter_init(&iter, node->out);
+  while (g_hash_table_iter_next(&iter, &target, NULL)) {
+    struct node *other = target;
+
+    graph->n_links -= GPOINTER_TO_UINT(g_hash_table_lookup(other->in, node));
+    g_hash_table_remove(other->in, node);
+    g_hash_table_iter_remove(&iter);
+    if (other != node) {
+      update(graph, other);
+    }
+  }
+
+  update(graph, node);
+}
+
+void
+link_graph_set_stub(LinkGraph *graph, gpointer page, gboolean stub)
+{
+  struct node *node = g_hash_table_lookup(graph->nodes, page);
+
+  if (node != NULL && node->stub != stub) {
+    node->stub = stub;
+    update(graph, node);
+  }
+}
+
+gboolean
+link_graph_is_stub(LinkGraph *graph, gpointer page)
+{
+  return g_hash_table_contains(graph->stubs, page);
+}
+
+void
+link_graph_add_link(LinkGraph *graph, gpointer from, gpointer to)
+{
+  struct node *source = get_node(graph, from);
+  struct node *target = get_node(graph, to);
+
+  count(source->out, target, 1);
+  count(target->in, source, 1);
+  graph->n_links++;
+
+  update(graph, source);
+  update(graph, target);
+}
+
+void
+link_graph_remove_link(LinkGraph *graph, gpointer from, gpointer to)
+{
+  struct node *source = g_hash_table_lookup(graph->nodes, from);
+  struct node *target = g_hash_table_lookup(graph->nodes, to);
+
+  /* Links of a removed page are already gone */
+  if (source == NULL || target == NULL ||
+      !g_hash_table_contains(source->out, target)) {
+    return;
+  }
+
+  count(source->out, target, -1);
+  count(target->in, source, -1);
+  graph->n_links--;
+
+  update(graph, source);
+  if (target != source) {
+    update(graph, target);
+  }
+}
+
+guint
+link_graph_n_links(LinkGraph *graph)
+{
+  return graph->n_links;
+}
+
+GList *
+link_graph_stubs(LinkGraph *graph)
+{
+  return g_hash_table_get_keys(graph->stubs);
+}
+
+GList *
+link_graph_orphans(LinkGraph *graph)
+{
+  return g_hash_table_get_keys(graph->orphans);
+}
+
+GList *
+link_graph_dangling(LinkGraph *graph)
+{
+  return g_hash_table_get_keys(graph->dangling);
+}
+
+GList *
+link_graph_sources(LinkGraph *graph, gpointer page)
+{
+  struct node *node = g_hash_table_lookup(graph->nodes, page);
+  GHashTableIter iter;
+  gpointer source;
+  GList *sources = NULL;
+
+  if (node == NULL) {
+    return NULL;
+  }
+
+  g_hash_table_iter_init(&iter, node->in);
+  while (g_hash_table_iter_next(&iter, &source, NULL)) {
+    sources = g_list_prepend(sources, ((struct node *) source)->page);
+  }
+
+  return sources;
+}
+
+GList *
+link_graph_targets(LinkGraph *graph, gpointer page)
+{
+  struct node *node = g_hash_table_lookup(graph->nodes, page);
+  GHashTableIter iter;
+  gpointer target;
+  GList *targets = NULL;
+
+  if (node == NULL) {
+    return NULL;
+  }
+
+  g_hash_table_iter_init(&iter, node->out);
+  while (g_hash_table_iter_next(&iter, &target, NULL)) {
+    targets = g_list_prepend(targets, ((struct node *) target)->page);
+  }
+
+  return targets;
+}
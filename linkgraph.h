@@ -0,0 +1,53 @@
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * The links between the pages of a workspace, updated one page or link at a
+ * time. Pages are opaque pointers. Every update only touches the two pages
+ * involved, and the sets below are kept up to date along the way:
+ *
+ *   stubs     pages created by a link that never got content of their own
+ *   orphans   pages no other page links to
+ *   dangling  removed pages that are still linked to
+ *
+ * Links are counted, a page may link to another one several times.
+ */
+typedef struct _LinkGraph LinkGraph;
+
+LinkGraph *link_graph_new(void);
+
+void link_graph_free(LinkGraph *graph);
+
+void link_graph_add_page(LinkGraph *graph, gpointer page, gboolean stub);
+
+/* Drops the links of page, links to it become dangling */
+void link_graph_remove_page(LinkGraph *graph, gpointer page);
+
+void link_graph_set_stub(LinkGraph *graph, gpointer page, gboolean stub);
+
+gboolean link_graph_is_stub(LinkGraph *graph, gpointer page);
+
+void link_graph_add_link(LinkGraph *graph, gpointer from, gpointer to);
+
+void link_graph_remove_link(LinkGraph *graph, gpointer from, gpointer to);
+
+/* Number of links between all pages */
+guint link_graph_n_links(LinkGraph *graph);
+
+/* Lists of pages, in no particular order. Free with g_list_free() */
+GList *link_graph_stubs(LinkGraph *graph);
+GList *link_graph_orphans(LinkGraph *graph);
+GList *link_graph_dangling(LinkGraph *graph);
+
+/* The pages linking to page */
+GList *link_graph_sources(LinkGraph *graph, gpointer page);
+
+/* The pages page links to */
+GList *link_graph_targets(LinkGraph *graph, gpointer page);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(LinkGraph, link_graph_free)
+
+G_END_DECLS
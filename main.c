@@ -1,17 +1,26 @@
 #include <adwaita.h>
 #include <gdk/gdk.h>
 #include <glib.h>
-#include <glib/gstdio.h>
 #include <gtk/gtk.h>
 
 #include "editor_page.h"
+#include "export.h"
+#include "find.h"
+#include "hud.h"
+#include "outline.h"
+#include "tabs.h"
+#include "import.h"
+#include "manifest.h"
+#include "perf.h"
+#include "session.h"
+#include "snapshot.h"
+#include "trace.h"
+#include "workspace.h"
 
 // static GHashTable *entries;
 
 /*
 TODO
-- Implement codeblock?
-- Implement sub headers / bold / italic
 - Scroll page list
 */
 
@@ -56,23 +65,6 @@ save_current_ws(const gchar *path)
   g_free(save_file);
 }
 
-static void
-anchors_foreach(gpointer data, gpointer user_data)
-{
-  GtkTextView *view = GTK_TEXT_VIEW(user_data);
-  GtkTextChildAnchor *anchor = GTK_TEXT_CHILD_ANCHOR(data);
-  EditorPage *target;
-
-  if (gtk_text_child_anchor_get_deleted(anchor)) {
-    return;
-  }
-
-  target = g_object_get_data(G_OBJECT(anchor), "target");
-
-  gtk_text_view_add_child_at_anchor(view, editor_page_in_content_button(target),
-                                    anchor);
-}
-
 static void
 header_changed(GtkEditable *self, gpointer user_data)
 {
@@ -87,29 +79,22 @@ add_style(G_GNUC_UNUSED gpointer key, gpointer val, gpointer user_data)
   GString *style = (GString *) user_data;
   EditorPage *page = EDITOR_PAGE(val);
 
-  g_print("Creating style %s\n", page->css_name);
   g_string_append_printf(style, ".%s {background-color: %s;}", page->css_name,
                          gdk_rgba_to_string(&page->color));
 }
 
+/* Each workspace has one provider, restyling replaces its rules */
 static void
-update_css(GHashTable *pages)
+update_css(GtkApplication *app)
 {
-  GdkDisplay *display;
-  GtkCssProvider *provider;
-  GString *style = g_string_new(".in-text-button {padding: 0px; margin: 0px;  "
-                                "margin-bottom: -8px;}");
-
-  g_hash_table_foreach(pages, add_style, style);
-
-  display = gdk_display_get_default();
+  Session *session = g_object_get_data(G_OBJECT(app), "session");
+  GString *style = g_string_new(".hud {padding: 8px; border-radius: 6px; "
+                                "color: white; "
+                                "background-color: rgba(0,0,0,0.7);}");
 
-  provider = gtk_css_provider_new();
-  gtk_css_provider_load_from_string(provider, style->str);
+  g_hash_table_foreach(session->pages, add_style, style);
 
-  gtk_style_context_add_provider_for_display(display,
-                                             GTK_STYLE_PROVIDER(provider),
-                                             GTK_STYLE_PROVIDER_PRIORITY_USER);
+  session_set_style(session, style->str);
 
   g_string_free(style, TRUE);
 }
@@ -125,21 +110,67 @@ color_changed(GtkColorDialogButton *self,
 
   color = gtk_color_dialog_button_get_rgba(self);
 
-  page->color.red = color->red;
-  page->color.green = color->green;
-  page->color.blue = color->blue;
-  page->color.alpha = color->alpha;
+  editor_page_set_color(page, color);
 
-  update_css(page->pages);
+  update_css(GTK_APPLICATION(page->user_data));
+}
+
+static void set_page(EditorPage *page, GtkApplication *app);
+static void load_now(GtkApplication *app, EditorPage *page);
 
-  g_print("Color change\n");
+static gboolean
+is_page(G_GNUC_UNUSED gpointer key, gpointer value, gpointer user_data)
+{
+  return value == user_data;
 }
 
 static void
-remove_choice_cb(G_GNUC_UNUSED GObject *source_object,
-                 G_GNUC_UNUSED GAsyncResult *res,
-                 G_GNUC_UNUSED gpointer data)
+remove_choice_cb(GObject *source_object, GAsyncResult *res, gpointer data)
 {
+  EditorPage *page = EDITOR_PAGE(data);
+  GtkApplication *app = GTK_APPLICATION(page->user_data);
+  GQueue *pages_list;
+  GtkWidget *pages_box;
+  gchar *key = NULL;
+
+  if (gtk_alert_dialog_choose_finish(GTK_ALERT_DIALOG(source_object), res,
+                                     NULL) != 0) {
+    return;
+  }
+
+  pages_list = g_object_get_data(G_OBJECT(app), "pages_list");
+  pages_box = g_object_get_data(G_OBJECT(app), "pages_box");
+
+  if (g_queue_get_length(pages_list) < 2) {
+    g_message("Not removing %s, the workspace needs a page", page->heading);
+    return;
+  }
+
+  /* Pages made while loading join the sidebar once it is done */
+  if (g_object_get_data(G_OBJECT(app), "loader") != NULL) {
+    g_message("Not removing %s, the workspace is still loading",
+              page->heading);
+    return;
+  }
+
+  /* The key can be an older heading if the page has been renamed */
+  key = g_hash_table_find(page->pages, is_page, page);
+  if (key != NULL) {
+    g_hash_table_remove(page->pages, key);
+    g_free(key);
+  }
+
+  g_queue_remove(pages_list, page);
+  /* The page keeps its button, finalize drops it */
+  gtk_box_remove(GTK_BOX(pages_box), page->page_button);
+
+  if (g_object_get_data(G_OBJECT(app), "current_page") == page) {
+    set_page(g_queue_peek_head(pages_list), app);
+  }
+  tabs_close(g_object_get_data(G_OBJECT(app), "tabs"), page);
+
+  /* Still referenced by the links to it */
+  editor_page_remove(page);
 }
 
 static void
@@ -147,7 +178,6 @@ remove_page(G_GNUC_UNUSED GObject *button, EditorPage *self)
 {
   GtkAlertDialog *dia;
   const gchar *buttons[3] = { "Yes", "No", NULL };
-  g_print("Creating dialog\n");
 
   dia = gtk_alert_dialog_new("Are you certain that you wish to remove page %s",
                              self->heading);
@@ -160,6 +190,24 @@ remove_page(G_GNUC_UNUSED GObject *button, EditorPage *self)
   gtk_alert_dialog_choose(dia, app_window, NULL, remove_choice_cb, self);
 }
 
+/* Disconnects the page controls from the current page */
+static void
+unbind_page(GtkApplication *app)
+{
+  g_signal_handlers_disconnect_matched(g_object_get_data(G_OBJECT(app),
+                                                         "color_picker"),
+                                       G_SIGNAL_MATCH_FUNC, 0, 0, NULL,
+                                       color_changed, NULL);
+  g_signal_handlers_disconnect_matched(g_object_get_data(G_OBJECT(app),
+                                                         "content_header"),
+                                       G_SIGNAL_MATCH_FUNC, 0, 0, NULL,
+                                       header_changed, NULL);
+  g_signal_handlers_disconnect_matched(g_object_get_data(G_OBJECT(app),
+                                                         "remove_button"),
+                                       G_SIGNAL_MATCH_FUNC, 0, 0, NULL,
+                                       remove_page, NULL);
+}
+
 static void
 set_page(EditorPage *page, GtkApplication *app)
 {
@@ -168,9 +216,9 @@ set_page(EditorPage *page, GtkApplication *app)
   GtkWidget *color_picker;
   EditorPage *current_page;
   GtkWidget *remove_button;
+  gint64 begin = perf_begin();
 
   content_header = g_object_get_data(G_OBJECT(app), "content_header");
-  textarea = g_object_get_data(G_OBJECT(app), "textarea");
   current_page = g_object_get_data(G_OBJECT(app), "current_page");
   color_picker = g_object_get_data(G_OBJECT(app), "color_picker");
   remove_button = g_object_get_data(G_OBJECT(app), "remove_button");
@@ -178,50 +226,120 @@ set_page(EditorPage *page, GtkApplication *app)
   if (current_page == page) {
     return;
   }
-  g_signal_handlers_disconnect_matched(color_picker, G_SIGNAL_MATCH_FUNC, 0, 0,
-                                       NULL, color_changed, NULL);
-  g_signal_handlers_disconnect_matched(content_header, G_SIGNAL_MATCH_FUNC, 0,
-                                       0, NULL, header_changed, NULL);
-  g_signal_handlers_disconnect_matched(remove_button, G_SIGNAL_MATCH_FUNC, 0, 0,
-                                       NULL, remove_page, NULL);
+  load_now(app, page);
+  unbind_page(app);
 
-  gtk_text_view_set_buffer(GTK_TEXT_VIEW(textarea), page->content);
+  textarea = GTK_WIDGET(tabs_show(g_object_get_data(G_OBJECT(app), "tabs"),
+                                  page));
+  g_object_set_data(G_OBJECT(app), "textarea", textarea);
 
   gtk_editable_set_text(GTK_EDITABLE(content_header), page->heading);
 
   gtk_color_dialog_button_set_rgba(GTK_COLOR_DIALOG_BUTTON(color_picker),
                                    &page->color);
 
-  g_ptr_array_foreach(page->anchors, anchors_foreach, textarea);
-
   g_signal_connect(color_picker, "notify::rgba", G_CALLBACK(color_changed),
                    page);
   g_signal_connect(content_header, "changed", G_CALLBACK(header_changed), page);
   g_signal_connect(remove_button, "clicked", G_CALLBACK(remove_page), page);
 
+  outline_panel_set_page(g_object_get_data(G_OBJECT(app), "outline"),
+                         GTK_TEXT_VIEW(textarea), page);
+
   g_object_set_data(G_OBJECT(app), "current_page", page);
-  g_print("Set current Page %p , app %p\n", page, app);
+
+  perf_end(PERF_SET_PAGE, begin);
+}
+
+static EditorPage *
+link_at_point(GtkTextView *view, gdouble x, gdouble y)
+{
+  GtkTextIter iter;
+  gint buffer_x;
+  gint buffer_y;
+
+  gtk_text_view_window_to_buffer_coords(view, GTK_TEXT_WINDOW_WIDGET, x, y,
+                                        &buffer_x, &buffer_y);
+  if (!gtk_text_view_get_iter_at_location(view, &iter, buffer_x, buffer_y)) {
+    return NULL;
+  }
+
+  return editor_page_link_at(&iter);
 }
 
 static void
-single_anchor(EditorPage *page,
-              GtkTextChildAnchor *anchor,
-              GtkWidget *button,
-              GObject *app)
+link_released(GtkGestureClick *gesture,
+              gint n_press,
+              gdouble x,
+              gdouble y,
+              gpointer user_data)
 {
-  GtkTextView *textarea;
-  EditorPage *current_page;
+  GtkApplication *app = GTK_APPLICATION(user_data);
+  GtkWidget *textarea;
+  EditorPage *target;
 
-  current_page = g_object_get_data(app, "current_page");
-  g_print("Page %p vs %p, app %p\n", page, current_page, app);
-  if (page != current_page) {
-    g_print("Bailing due to not active page\n");
+  textarea = gtk_event_controller_get_widget(GTK_EVENT_CONTROLLER(gesture));
+
+  /* Selecting text across a link does not follow it */
+  if (n_press != 1 ||
+      gtk_text_buffer_get_has_selection(
+        gtk_text_view_get_buffer(GTK_TEXT_VIEW(textarea)))) {
     return;
   }
 
-  textarea = g_object_get_data(app, "textarea");
+  target = link_at_point(GTK_TEXT_VIEW(textarea), x, y);
+  if (target != NULL && !target->removed) {
+    set_page(target, app);
+  }
+}
+
+static void
+link_motion(GtkEventControllerMotion *controller,
+            gdouble x,
+            gdouble y,
+            G_GNUC_UNUSED gpointer user_data)
+{
+  GtkWidget *textarea;
+  EditorPage *target;
+
+  textarea = gtk_event_controller_get_widget(GTK_EVENT_CONTROLLER(controller));
+  target = link_at_point(GTK_TEXT_VIEW(textarea), x, y);
+
+  gtk_widget_set_cursor_from_name(textarea, target != NULL && !target->removed
+                                              ? "pointer"
+                                              : "text");
+}
+
+/* Previews the page under the pointer, without switching to it */
+static gboolean
+link_tooltip(GtkWidget *textarea,
+             gint x,
+             gint y,
+             gboolean keyboard_mode,
+             GtkTooltip *tooltip,
+             G_GNUC_UNUSED gpointer user_data)
+{
+  GtkTextView *view = GTK_TEXT_VIEW(textarea);
+  EditorPage *target;
+
+  if (keyboard_mode) {
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(view);
+    GtkTextIter iter;
+
+    gtk_text_buffer_get_iter_at_mark(buffer, &iter,
+                                     gtk_text_buffer_get_insert(buffer));
+    target = editor_page_link_at(&iter);
+  } else {
+    target = link_at_point(view, x, y);
+  }
+
+  if (target == NULL || target->removed) {
+    return FALSE;
+  }
+
+  gtk_tooltip_set_markup(tooltip, editor_page_preview(target));
 
-  gtk_text_view_add_child_at_anchor(textarea, button, anchor);
+  return TRUE;
 }
 
 static void
@@ -283,8 +401,6 @@ on_drop(GtkDropTarget *target,
   GList *link = g_queue_find(pages_list, target_page);
   g_queue_insert_before(pages_list, link, dropped_page);
 
-  g_print("Sorting buttons with %p after %p: \n", dropped_button, target_button);
-
   return TRUE;
 }
 
@@ -295,7 +411,9 @@ page_created(EditorPage *page, GObject *app)
   GQueue *pages_list;
   GtkDragSource *drag_source;
   GtkDropTarget *drop_target;
+  GtkWidget *page_button;
 
+  page_button = editor_page_button(page);
   pages_box = g_object_get_data(app, "pages_box");
   pages_list = g_object_get_data(app, "pages_list");
 
@@ -308,227 +426,654 @@ page_created(EditorPage *page, GObject *app)
   g_object_set_data(G_OBJECT(drop_target), "pages_list", pages_list);
 
   g_signal_connect(drag_source, "prepare", G_CALLBACK(on_drag_prepare),
-                   page->page_button);
+                   page_button);
   g_signal_connect(drag_source, "drag-begin", G_CALLBACK(on_drag_begin),
-                   page->page_button);
-  g_signal_connect(drop_target, "drop", G_CALLBACK(on_drop), page->page_button);
+                   page_button);
+  g_signal_connect(drop_target, "drop", G_CALLBACK(on_drop), page_button);
 
-  gtk_widget_add_controller(GTK_WIDGET(page->page_button),
+  gtk_widget_add_controller(GTK_WIDGET(page_button),
                             GTK_EVENT_CONTROLLER(drag_source));
-  gtk_widget_add_controller(GTK_WIDGET(page->page_button),
+  gtk_widget_add_controller(GTK_WIDGET(page_button),
                             GTK_EVENT_CONTROLLER(drop_target));
 
-  gtk_box_append(pages_box, page->page_button);
+  gtk_box_append(pages_box, page_button);
   g_queue_push_tail(pages_list, page);
+  session_add_page(g_object_get_data(app, "session"), page);
 
   g_signal_connect(page, "switch-page", G_CALLBACK(set_page), app);
 
-  g_signal_connect(page, "new-anchor", G_CALLBACK(single_anchor), app);
+  /* Bulk loads update the style once when done */
+  if (!editor_page_bulk_active()) {
+    update_css(GTK_APPLICATION(app));
+  }
+}
+
+static void
+set_compression(GtkApplication *app, ManifestCompression compression)
+{
+  GAction *action;
+
+  g_object_set_data(G_OBJECT(app), "compression",
+                    GINT_TO_POINTER(compression));
 
-  update_css(page->pages);
-  g_print("Page created: %s\n", page->heading);
+  action = g_action_map_lookup_action(G_ACTION_MAP(app), "compress");
+  g_simple_action_set_state(G_SIMPLE_ACTION(action),
+                            g_variant_new_boolean(compression !=
+                                                  MANIFEST_COMPRESSION_NONE));
 }
 
-static gboolean
-prepare_folder(const gchar *base_path)
+/*
+ * Loads the pages of a workspace after the first one is shown, one page per
+ * idle run: first the pages the shown page links to, then the rest in
+ * sidebar order. Only the shown session loads, what needs all pages waits
+ * for it, see when_loaded(). The whole load is one editor_page bulk, the
+ * pages it makes reach the sidebar together at the end.
+ */
+typedef void (*LoadedFunc)(GtkApplication *app, gpointer data);
+
+struct waiter {
+  LoadedFunc func;
+  gpointer data;
+  GDestroyNotify destroy;
+};
+
+struct loader {
+  GtkApplication *app;
+  Manifest *manifest;
+  gchar *path;
+  /* Indexes of the manifest entries still to load */
+  GQueue queue;
+  /* The page of each manifest entry, NULL until loaded */
+  GPtrArray *loaded;
+  /* Of when_loaded(), called in order once the last page is loaded */
+  GQueue waiters;
+  guint source;
+  gint64 begin;
+};
+
+static void
+waiter_free(gpointer data)
 {
-  GDir *dir;
-  gchar *content = NULL;
-  gchar *meta_name;
-  gchar **rows;
+  struct waiter *waiter = data;
 
-  if (base_path == NULL) {
-    return FALSE;
+  if (waiter->destroy != NULL) {
+    waiter->destroy(waiter->data);
+  }
+  g_free(waiter);
+}
+
+static void
+loader_free(gpointer data)
+{
+  struct loader *loader = data;
+
+  g_clear_handle_id(&loader->source, g_source_remove);
+  g_queue_clear_full(&loader->waiters, waiter_free);
+  manifest_free(loader->manifest);
+  g_free(loader->path);
+  g_queue_clear(&loader->queue);
+  g_ptr_array_unref(loader->loaded);
+  g_free(loader);
+}
+
+static EditorPage *
+load_entry(struct loader *loader, guint index)
+{
+  ManifestEntry *entry = &g_array_index(loader->manifest->entries,
+                                        ManifestEntry, index);
+  Session *session = g_object_get_data(G_OBJECT(loader->app), "session");
+  gchar *filename;
+  EditorPage *page;
+  GdkRGBA color;
+
+  filename = g_build_filename(loader->path, entry->file, NULL);
+
+  if (entry->color == NULL || !gdk_rgba_parse(&color, entry->color)) {
+    gdk_rgba_parse(&color, "rgb(179,179,255)");
+  }
+
+  page = editor_page_load(session->pages, filename, &color,
+                          G_CALLBACK(page_created), loader->app);
+  if (page != NULL) {
+    editor_page_set_id(page, entry->id);
+    /* Links to pages not loaded yet make stubs, loading fills them in */
+    editor_page_fix_content(page);
   }
 
-  /* OK if we either have a meta.tab file or if we have an empty folder.
-   * Remove all existing files if there is a meta.tab file
-   */
+  g_ptr_array_index(loader->loaded, index) = page;
+  g_free(filename);
 
-  meta_name = g_build_filename(base_path, "meta.tab", NULL);
-  if (g_file_get_contents(meta_name, &content, NULL, NULL)) {
-    rows = g_strsplit(content, "\n", -1);
+  return page;
+}
+
+/* Queues the pages page links to ahead of the rest */
+static void
+queue_entries(struct loader *loader, EditorPage *page, guint first)
+{
+  GArray *entries = loader->manifest->entries;
+  GHashTable *linked = g_hash_table_new(g_str_hash, g_str_equal);
+  GList *targets = NULL;
 
-    for (gint i = 0; rows[i] != NULL; i++) {
-      gchar **meta;
-      gchar *filename;
+  if (page != NULL) {
+    targets = link_graph_targets(editor_page_links(), page);
+  }
+  for (GList *iter = targets; iter != NULL; iter = iter->next) {
+    g_hash_table_add(linked, EDITOR_PAGE(iter->data)->heading);
+  }
+  g_list_free(targets);
 
-      meta = g_strsplit(rows[i], "\t", 2);
+  for (guint pass = 0; pass < 2; pass++) {
+    for (guint i = 0; i < entries->len; i++) {
+      const gchar *heading = g_array_index(entries, ManifestEntry, i).heading;
+      gboolean is_linked = heading != NULL &&
+                           g_hash_table_contains(linked, heading);
 
-      if (meta[0] == NULL || !g_str_has_suffix(meta[0], ".md")) {
-        g_strfreev(meta);
-        continue;
+      if (i != first && is_linked == (pass == 0)) {
+        g_queue_push_tail(&loader->queue, GUINT_TO_POINTER(i));
       }
+    }
+  }
+
+  g_hash_table_unref(linked);
+}
+
+/* Stubs for pages not loaded yet got their button when first linked to.
+ * Puts the sidebar back in manifest order, pages made otherwise after. */
+static void
+sort_pages(struct loader *loader)
+{
+  GtkBox *box = g_object_get_data(G_OBJECT(loader->app), "pages_box");
+  GQueue *pages_list = g_object_get_data(G_OBJECT(loader->app),
+                                         "pages_list");
+  GHashTable *seen = g_hash_table_new(NULL, NULL);
+  GQueue order = G_QUEUE_INIT;
+  GtkWidget *prev = NULL;
+
+  for (guint i = 0; i < loader->loaded->len; i++) {
+    EditorPage *page = g_ptr_array_index(loader->loaded, i);
+
+    if (page != NULL && !page->removed && g_hash_table_add(seen, page)) {
+      g_queue_push_tail(&order, page);
+    }
+  }
+  for (GList *iter = pages_list->head; iter != NULL; iter = iter->next) {
+    if (g_hash_table_add(seen, iter->data)) {
+      g_queue_push_tail(&order, iter->data);
+    }
+  }
+
+  g_queue_clear(pages_list);
+  for (GList *iter = order.head; iter != NULL; iter = iter->next) {
+    EditorPage *page = EDITOR_PAGE(iter->data);
+
+    g_queue_push_tail(pages_list, page);
+    gtk_box_reorder_child_after(box, page->page_button, prev);
+    prev = page->page_button;
+  }
+
+  g_queue_clear(&order);
+  g_hash_table_unref(seen);
+}
 
-      filename = g_build_filename(base_path, meta[0], NULL);
+static gboolean
+load_next(gpointer user_data)
+{
+  struct loader *loader = user_data;
+  GtkApplication *app = loader->app;
+  GQueue waiters = G_QUEUE_INIT;
 
-      g_unlink(filename);
+  if (!g_queue_is_empty(&loader->queue)) {
+    EditorPage *page;
 
-      g_free(filename);
-      g_strfreev(meta);
+    page = load_entry(loader,
+                      GPOINTER_TO_UINT(g_queue_pop_head(&loader->queue)));
+    /* The first page could not be read */
+    if (page != NULL &&
+        g_object_get_data(G_OBJECT(app), "current_page") == NULL) {
+      set_page(page, app);
     }
+    return G_SOURCE_CONTINUE;
+  }
+
+  /* The sidebar and its style take every page made while loading at once */
+  editor_page_bulk_commit();
+  sort_pages(loader);
+  update_css(app);
+  perf_end(PERF_LOAD_REPO, loader->begin);
+  g_message("Loaded %u pages of %s", loader->loaded->len, loader->path);
 
-    g_free(meta_name);
-    g_strfreev(rows);
-    g_free(content);
+  /* Run once the loader is gone, so that they see a loaded workspace */
+  loader->source = 0;
+  waiters = loader->waiters;
+  g_queue_init(&loader->waiters);
+  g_object_set_data(G_OBJECT(app), "loader", NULL);
 
-    return TRUE;
+  while (!g_queue_is_empty(&waiters)) {
+    struct waiter *waiter = g_queue_pop_head(&waiters);
+
+    waiter->func(app, waiter->data);
+    waiter_free(waiter);
   }
 
-  dir = g_dir_open(base_path, 0, NULL);
+  return G_SOURCE_REMOVE;
+}
+
+/* A page shown before its turn is loaded first, so that it is never edited
+ * as the stub its links made */
+static void
+load_now(GtkApplication *app, EditorPage *page)
+{
+  struct loader *loader = g_object_get_data(G_OBJECT(app), "loader");
 
-  /* No meta file */
-  if (g_dir_read_name(dir) != NULL) {
-    g_dir_close(dir);
-    return FALSE;
+  if (loader == NULL || !link_graph_is_stub(editor_page_links(), page)) {
+    return;
+  }
+
+  for (GList *iter = loader->queue.head; iter != NULL; iter = iter->next) {
+    guint index = GPOINTER_TO_UINT(iter->data);
+    ManifestEntry *entry = &g_array_index(loader->manifest->entries,
+                                          ManifestEntry, index);
+
+    if (g_strcmp0(entry->heading, page->heading) == 0) {
+      g_queue_delete_link(&loader->queue, iter);
+      load_entry(loader, index);
+      return;
+    }
   }
-  g_dir_close(dir);
-  return TRUE;
 }
 
+/* Loads the rest of the shown workspace right away, if it is still loading */
 static void
-save(GtkApplication *app, const gchar *base_path)
+finish_loading(GtkApplication *app)
+{
+  struct loader *loader = g_object_get_data(G_OBJECT(app), "loader");
+
+  if (loader != NULL) {
+    g_clear_handle_id(&loader->source, g_source_remove);
+    while (load_next(loader) == G_SOURCE_CONTINUE) {
+    }
+  }
+}
+
+/* Calls func once every page of the shown workspace is loaded, right away
+ * if it is. Loading goes on from idle meanwhile, the window stays live. */
+static void
+when_loaded(GtkApplication *app,
+            LoadedFunc func,
+            gpointer data,
+            GDestroyNotify destroy)
+{
+  struct loader *loader = g_object_get_data(G_OBJECT(app), "loader");
+  struct waiter *waiter;
+
+  if (loader == NULL) {
+    func(app, data);
+    if (destroy != NULL) {
+      destroy(data);
+    }
+    return;
+  }
+
+  waiter = g_malloc0(sizeof(*waiter));
+  waiter->func = func;
+  waiter->data = data;
+  waiter->destroy = destroy;
+  g_queue_push_tail(&loader->waiters, waiter);
+}
+
+/* Scrolls the current page so that offset is at the top */
+static void
+scroll_to(GtkApplication *app, gint offset)
+{
+  GtkTextView *view = g_object_get_data(G_OBJECT(app), "textarea");
+  GtkTextBuffer *buffer;
+  GtkTextMark *mark;
+  GtkTextIter iter;
+
+  if (view == NULL) {
+    return;
+  }
+
+  /* The view scrolls once it is laid out, to a mark of its own */
+  buffer = gtk_text_view_get_buffer(view);
+  gtk_text_buffer_get_iter_at_offset(buffer, &iter, offset);
+  mark = gtk_text_buffer_create_mark(buffer, NULL, &iter, TRUE);
+  gtk_text_view_scroll_to_mark(view, mark, 0.0, TRUE, 0.0, 0.0);
+  gtk_text_buffer_delete_mark(buffer, mark);
+}
+
+/* Records the current page and scroll position of the shown workspace in
+ * its session and folder */
+static void
+store_view(GtkApplication *app)
+{
+  Session *session = g_object_get_data(G_OBJECT(app), "session");
+  EditorPage *page = g_object_get_data(G_OBJECT(app), "current_page");
+  GtkTextView *view = g_object_get_data(G_OBJECT(app), "textarea");
+  WorkspaceView state = { 0 };
+  GError *lerr = NULL;
+  GdkRectangle rect;
+  GtkTextIter iter;
+
+  if (session == NULL || page == NULL || view == NULL) {
+    return;
+  }
+
+  gtk_text_view_get_visible_rect(view, &rect);
+  gtk_text_view_get_iter_at_location(view, &iter, rect.x, rect.y);
+
+  session->current = page;
+  session->top = gtk_text_iter_get_offset(&iter);
+
+  if (session->path == NULL) {
+    return;
+  }
+
+  state.page_id = page->id;
+  state.top = session->top;
+  if (!workspace_view_save(session->path, &state, &lerr)) {
+    g_warning("Could not save the view of %s: %s", session->path,
+              lerr->message);
+    g_clear_error(&lerr);
+  }
+}
+
+/* Takes the shown workspace out of the window and keeps it warm */
+static void
+close_session(GtkApplication *app)
+{
+  Session *session = g_object_get_data(G_OBJECT(app), "session");
+
+  if (session == NULL) {
+    return;
+  }
+
+  finish_loading(app);
+  store_view(app);
+  session->compression = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(app),
+                                                           "compression"));
+
+  unbind_page(app);
+  tabs_clear(g_object_get_data(G_OBJECT(app), "tabs"));
+  outline_panel_set_page(g_object_get_data(G_OBJECT(app), "outline"), NULL,
+                         NULL);
+  find_reset(app);
+  g_object_set_data(G_OBJECT(app), "current_page", NULL);
+  g_object_set_data(G_OBJECT(app), "textarea", NULL);
+
+  session_hide(session, g_object_get_data(G_OBJECT(app), "pages_box"));
+  g_object_set_data(G_OBJECT(app), "session", NULL);
+  session_stash(session);
+}
+
+/* Closes the shown workspace and shows session in its place */
+static void
+open_session(GtkApplication *app, Session *session)
+{
+  close_session(app);
+
+  g_object_set_data(G_OBJECT(app), "session", session);
+  g_object_set_data(G_OBJECT(app), "pages_list", session->pages_list);
+  g_object_set_data_full(G_OBJECT(app), "save-path", g_strdup(session->path),
+                         g_free);
+  set_compression(app, session->compression);
+
+  session_show(session, g_object_get_data(G_OBJECT(app), "pages_box"));
+
+  if (session->current == NULL) {
+    session->current = g_queue_peek_head(session->pages_list);
+  }
+  if (session->current != NULL) {
+    set_page(session->current, app);
+    scroll_to(app, session->top);
+  }
+}
+
+static void
+save_loaded(GtkApplication *app, gpointer data)
 {
+  const gchar *base_path = data;
+  g_autoptr(WorkspaceCommit) commit = NULL;
   GQueue *pages_list;
-  GString *meta;
-  gchar *meta_path;
+  ManifestCompression compression;
+  GChecksum *checksum;
+  guint order = 0;
   GError *lerr = NULL;
+  gboolean same_folder;
+  gboolean ok = TRUE;
+  Session *warm;
   gchar *root;
+  gint64 begin = perf_begin();
 
   if (base_path == NULL) {
     root = (gchar *) g_object_get_data(G_OBJECT(app), "save-path");
-    g_print("USING OLD BASE PATH: %s\n",
-            (gchar *) g_object_get_data(G_OBJECT(app), "save-path"));
   } else {
     root = (gchar *) base_path;
   }
 
-  if (!prepare_folder(root)) {
+  if (root == NULL) {
     g_warning("Can not save to %s", base_path);
     return;
   }
 
-  g_print("Before Saving file: %s\n", root);
+  /* A warm copy of the folder would be dropped below, with its changes */
+  warm = session_peek(root);
+  if (warm != NULL && session_modified(warm)) {
+    g_warning("Not saving to %s, it has unsaved changes of its own, open "
+              "and save it first", root);
+    return;
+  }
+
+  compression = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(app),
+                                                  "compression"));
+
+  commit = workspace_commit_begin(root, compression, &lerr);
+  if (commit == NULL) {
+    g_warning("Can not save to %s: %s", root, lerr->message);
+    g_clear_error(&lerr);
+    return;
+  }
+
+  /* Unchanged pages keep their file, but only in the folder they are from */
+  same_folder = g_strcmp0(root, g_object_get_data(G_OBJECT(app),
+                                                  "save-path")) == 0;
+
   if (base_path != NULL) {
     g_object_set_data_full(G_OBJECT(app), "save-path", g_strdup(base_path),
                            g_free);
   }
 
   pages_list = g_object_get_data(G_OBJECT(app), "pages_list");
-  meta = g_string_new("");
+  checksum = g_checksum_new(G_CHECKSUM_SHA256);
 
-  for (GList *iter = pages_list->head; iter != NULL; iter = iter->next) {
+  for (GList *iter = pages_list->head; ok && iter != NULL; iter = iter->next) {
     EditorPage *page = EDITOR_PAGE(iter->data);
-    gchar *name;
-    gchar *file;
-    gchar *full_path;
-    GString *content;
+    const ManifestEntry *last = NULL;
+    ManifestEntry entry = { 0 };
+    gchar *file = NULL;
+    gchar *color;
+
+    if (same_folder && !gtk_text_buffer_get_modified(page->content)) {
+      last = workspace_commit_find(commit, page->id, page->heading);
+    }
 
-    name = g_str_to_ascii(page->heading, NULL);
-    file = g_strdup_printf("%s.md", name);
-    full_path = g_build_filename(root, file, NULL);
+    if (last != NULL) {
+      entry = *last;
+    } else {
+      GOutputStream *stream;
+      gchar *name;
+
+      name = g_str_to_ascii(page->heading, NULL);
+
+      /* Streamed so that the page is never held twice in memory. The length
+       * and hash are of the page itself, not the compressed file. */
+      g_checksum_reset(checksum);
+      stream = workspace_commit_open(commit, name, &file, &lerr);
+      ok = stream != NULL &&
+           editor_page_write_md(page, stream, checksum, &entry.length, NULL,
+                                &lerr) &&
+           g_output_stream_close(stream, NULL, &lerr);
+
+      if (!ok) {
+        g_warning("Could not save %s: %s", page->heading, lerr->message);
+        g_clear_error(&lerr);
+      }
 
-    g_print("Saving file... %s + %s -> %s -> %s\n", root, name, file, full_path);
+      entry.file = file;
+      entry.hash = g_checksum_get_string(checksum);
 
-    g_string_append_printf(meta, "%s\t%s\n", file,
-                           gdk_rgba_to_string(&page->color));
+      g_clear_object(&stream);
+      g_free(name);
+    }
 
-    content = editor_page_to_md(page);
+    color = gdk_rgba_to_string(&page->color);
 
-    if (!g_file_set_contents(full_path, content->str, content->len, &lerr)) {
-      g_warning("Could not save %s: %s", full_path, lerr->message);
-      g_clear_error(&lerr);
+    entry.id = page->id;
+    entry.order = order++;
+    entry.color = color;
+    entry.heading = page->heading;
+    if (ok) {
+      workspace_commit_add(commit, &entry);
     }
 
-    g_free(name);
+    g_free(color);
     g_free(file);
-    g_free(full_path);
-    g_string_free(content, TRUE);
   }
 
-  meta_path = g_build_filename(root, "meta.tab", NULL);
+  g_checksum_free(checksum);
 
-  if (!g_file_set_contents(meta_path, meta->str, meta->len, &lerr)) {
-    g_warning("Could not save %s: %s", meta_path, lerr->message);
+  /* On any error the folder keeps the last save as a whole */
+  if (!ok) {
+    g_warning("Nothing saved in %s", root);
+  } else if (!workspace_commit_finish(commit, &lerr)) {
+    g_warning("Could not save manifest in %s: %s", root, lerr->message);
     g_clear_error(&lerr);
+  } else {
+    for (GList *iter = pages_list->head; iter != NULL; iter = iter->next) {
+      gtk_text_buffer_set_modified(EDITOR_PAGE(iter->data)->content, FALSE);
+    }
+
+    /* A warm copy of the folder saved over is out of date */
+    session_forget(root);
+    session_saved(g_object_get_data(G_OBJECT(app), "session"), root);
+
+    if (!snapshot_take(root, workspace_commit_manifest(commit), &lerr)) {
+      g_warning("Could not take a snapshot of %s: %s", root, lerr->message);
+      g_clear_error(&lerr);
+    }
   }
 
   save_current_ws(root);
 
-  g_free(meta_path);
-  g_string_free(meta, TRUE);
+  perf_end(PERF_SAVE, begin);
 }
 
+/* Saves to base_path, or where the workspace was loaded from or last saved
+ * to if NULL */
 static void
-pages_load_iter(G_GNUC_UNUSED gpointer key,
-                gpointer value,
-                G_GNUC_UNUSED gpointer user_data)
+save(GtkApplication *app, const gchar *base_path)
 {
-  g_assert(value);
-
-  editor_page_fix_content(value);
+  /* Pages not loaded yet would be left out of the manifest */
+  when_loaded(app, save_loaded, g_strdup(base_path), g_free);
 }
 
+/* Shows the page the workspace in name was left on, and loads the rest of
+ * it from idle. The new session replaces the one shown. */
 static void
-load_repo(const gchar *name, GHashTable *pages, GtkApplication *app)
+load_repo(const gchar *name, GtkApplication *app)
 {
-  gchar *content = NULL;
-  gchar *meta_name;
+  Manifest *manifest;
+  WorkspaceView view;
+  struct loader *loader;
+  EditorPage *first = NULL;
+  Session *session;
   GError *lerr = NULL;
-  gchar **rows;
+  guint first_index = 0;
+  gint64 begin = perf_begin();
 
   g_message("Loading name: %s", name);
 
-  g_object_set_data_full(G_OBJECT(app), "save-path", g_strdup(name), g_free);
-
-  g_message("Saved name as: %s",
-            (gchar *) g_object_get_data(G_OBJECT(app), "save-path"));
-
-  meta_name = g_build_filename(name, "meta.tab", NULL);
-  if (!g_file_get_contents(meta_name, &content, NULL, &lerr)) {
-    g_warning("Could not open meta file for %s! %s", name, lerr->message);
+  manifest = manifest_load(name, &lerr);
+  if (manifest == NULL) {
+    g_warning("Could not open manifest for %s! %s", name, lerr->message);
     g_clear_error(&lerr);
-    g_free(meta_name);
     return;
   }
 
-  rows = g_strsplit(content, "\n", -1);
+  if (!workspace_view_load(name, &view, &lerr)) {
+    g_warning("Could not read the view of %s: %s", name, lerr->message);
+    g_clear_error(&lerr);
+  }
+
+  session = session_new(name);
+  open_session(app, session);
 
-  for (gint i = 0; rows[i] != NULL; i++) {
-    gchar **meta;
-    gchar *filename;
-    EditorPage *page;
-    GdkRGBA color;
+  set_compression(app, manifest->compression);
 
-    meta = g_strsplit(rows[i], "\t", 2);
+  loader = g_malloc0(sizeof(*loader));
+  loader->app = app;
+  loader->manifest = manifest;
+  loader->path = g_strdup(name);
+  loader->loaded = g_ptr_array_new();
+  g_ptr_array_set_size(loader->loaded, manifest->entries->len);
+  loader->begin = begin;
 
-    if (meta[0] == NULL || !g_str_has_suffix(meta[0], ".md")) {
-      g_strfreev(meta);
-      continue;
-    }
+  for (guint i = 0; i < manifest->entries->len; i++) {
+    ManifestEntry *entry = &g_array_index(manifest->entries, ManifestEntry, i);
 
-    filename = g_build_filename(name, meta[0], NULL);
+    /* Stubs made before the rest is loaded must not take their ids */
+    editor_page_reserve_id(entry->id);
+    if (entry->id == view.page_id) {
+      first_index = i;
+    }
+  }
 
-    gdk_rgba_parse(&color, meta[1]);
+  /* Committed by load_next() when the last page is loaded */
+  editor_page_bulk_begin();
 
-    page = editor_page_load(pages, filename, &color, G_CALLBACK(page_created),
-                            app);
+  if (manifest->entries->len > 0) {
+    first = load_entry(loader, first_index);
+  }
 
-    if (i == 0) {
-      set_page(page, app);
+  if (first != NULL) {
+    set_page(first, app);
+    if (first->id == view.page_id) {
+      scroll_to(app, view.top);
     }
+  }
+  perf_end(PERF_FIRST_PAGE, begin);
+
+  queue_entries(loader, first, first_index);
+  g_object_set_data_full(G_OBJECT(app), "loader", loader, loader_free);
+  loader->source = g_idle_add(load_next, loader);
+
+  session_saved(session, name);
+}
 
-    g_free(filename);
-    g_strfreev(meta);
+/* Shows the workspace in path, without loading it if it was open recently */
+static void
+open_workspace(GtkApplication *app, const gchar *path)
+{
+  Session *current = g_object_get_data(G_OBJECT(app), "session");
+  Session *session;
+  gint64 begin = perf_begin();
+
+  if (current != NULL && g_strcmp0(current->path, path) == 0) {
+    g_message("%s is already open", path);
+    return;
   }
 
-  g_hash_table_foreach(pages, pages_load_iter, NULL);
+  session = session_take(path);
+  if (session == NULL) {
+    load_repo(path, app);
+    return;
+  }
 
-  update_css(pages);
+  g_message("Reopening %s", path);
+  open_session(app, session);
 
-  g_free(meta_name);
-  g_strfreev(rows);
-  g_free(content);
+  perf_end(PERF_FIRST_PAGE, begin);
+  perf_end(PERF_LOAD_REPO, begin);
 }
 
 static void
@@ -544,8 +1089,7 @@ open_file_cb(GObject *source_object, GAsyncResult *res, gpointer data)
     g_warning("Error opening file: %s",
               lerr != NULL ? lerr->message : "no error message");
   } else {
-    load_repo(g_file_peek_path(file), g_hash_table_new(g_str_hash, g_str_equal),
-              app);
+    open_workspace(app, g_file_peek_path(file));
     g_clear_object(&file);
   }
 }
@@ -569,36 +1113,489 @@ save_file_cb(GObject *source_object, GAsyncResult *res, gpointer data)
 }
 
 static void
-open_menu_cb(GSimpleAction *simple_action, GVariant *parameter, gpointer *data)
+export_done_cb(G_GNUC_UNUSED GObject *source_object,
+               GAsyncResult *res,
+               G_GNUC_UNUSED gpointer data)
 {
-  g_print("Hello\n");
-  GtkFileDialog *dialog = gtk_file_dialog_new();
-
-  gtk_file_dialog_select_folder(dialog, app_window, NULL, open_file_cb, data);
-}
+  GError *lerr = NULL;
+
+  if (!export_html_finish(res, &lerr)) {
+    g_warning("Could not export workspace: %s", lerr->message);
+    g_clear_error(&lerr);
+    return;
+  }
+
+  g_message("Workspace exported");
+}
+
+static void
+export_loaded(GtkApplication *app, gpointer data)
+{
+  export_html_async(g_object_get_data(G_OBJECT(app), "pages_list"), data,
+                    NULL, export_done_cb, app);
+}
+
+static void
+export_file_cb(GObject *source_object, GAsyncResult *res, gpointer data)
+{
+  GtkApplication *app = GTK_APPLICATION(data);
+  GError *lerr = NULL;
+  GFile *file = gtk_file_dialog_select_folder_finish(GTK_FILE_DIALOG(
+                                                       source_object),
+                                                     res, &lerr);
+
+  if (file == NULL) {
+    g_warning("Error exporting: %s",
+              lerr != NULL ? lerr->message : "no error message");
+  } else {
+    when_loaded(app, export_loaded, g_file_get_path(file), g_free);
+    g_clear_object(&file);
+  }
+}
+
+static void
+open_menu_cb(GSimpleAction *simple_action, GVariant *parameter, gpointer *data)
+{
+  GtkFileDialog *dialog = gtk_file_dialog_new();
+
+  gtk_file_dialog_select_folder(dialog, app_window, NULL, open_file_cb, data);
+}
 
 static void
 save_menu_cb(GSimpleAction *simple_action, GVariant *parameter, gpointer *data)
 {
-  g_print("Hello\n");
   GtkFileDialog *dialog = gtk_file_dialog_new();
 
   gtk_file_dialog_select_folder(dialog, app_window, NULL, save_file_cb, data);
 }
 
+static void
+export_menu_cb(GSimpleAction *simple_action, GVariant *parameter, gpointer *data)
+{
+  GtkFileDialog *dialog = gtk_file_dialog_new();
+
+  gtk_file_dialog_select_folder(dialog, app_window, NULL, export_file_cb, data);
+}
+
+/* Merges the imported pages into the open workspace, once it is all there */
+static void
+import_loaded(GtkApplication *app, gpointer data)
+{
+  GPtrArray *imported = data;
+  EditorPage *current_page;
+  GHashTable *pages;
+  GPtrArray *created;
+  GString **mds;
+  guint n_pages;
+
+  current_page = g_object_get_data(G_OBJECT(app), "current_page");
+  pages = ((Session *) g_object_get_data(G_OBJECT(app), "session"))->pages;
+
+  mds = (GString **) g_ptr_array_steal(imported, &n_pages);
+
+  created = g_ptr_array_new();
+
+  editor_page_bulk_begin();
+
+  for (guint i = 0; i < n_pages; i++) {
+    gsize len = mds[i]->len;
+    EditorPage *page;
+
+    page = editor_page_load_data(pages, g_string_free(mds[i], FALSE), len,
+                                 NULL, G_CALLBACK(page_created), app);
+    if (page != NULL) {
+      g_ptr_array_add(created, page);
+    }
+  }
+  g_free(mds);
+
+  /* Links are only resolved once every imported page exists */
+  for (guint i = 0; i < created->len; i++) {
+    editor_page_fix_content(g_ptr_array_index(created, i));
+  }
+
+  editor_page_bulk_commit();
+
+  update_css(app);
+
+  if (current_page == NULL && created->len > 0) {
+    set_page(g_ptr_array_index(created, 0), app);
+  }
+
+  g_message("Imported %u pages", created->len);
+  g_ptr_array_unref(created);
+
+  if (g_object_get_data(G_OBJECT(app), "save-path") == NULL) {
+    save_menu_cb(NULL, NULL, (gpointer) app);
+  } else {
+    save(app, NULL);
+  }
+}
+
+static void
+import_done_cb(G_GNUC_UNUSED GObject *source_object,
+               GAsyncResult *res,
+               gpointer data)
+{
+  GtkApplication *app = GTK_APPLICATION(data);
+  GPtrArray *imported;
+  GError *lerr = NULL;
+
+  imported = import_vault_finish(res, &lerr);
+  if (imported == NULL) {
+    g_warning("Could not import: %s", lerr->message);
+    g_clear_error(&lerr);
+    return;
+  }
+
+  when_loaded(app, import_loaded, imported,
+              (GDestroyNotify) g_ptr_array_unref);
+}
+
+static void
+import_file_cb(GObject *source_object, GAsyncResult *res, gpointer data)
+{
+  GtkApplication *app = GTK_APPLICATION(data);
+  Session *session;
+  GError *lerr = NULL;
+  gchar **existing;
+  GFile *file = gtk_file_dialog_select_folder_finish(GTK_FILE_DIALOG(
+                                                       source_object),
+                                                     res, &lerr);
+
+  if (file == NULL) {
+    g_warning("Error importing: %s",
+              lerr != NULL ? lerr->message : "no error message");
+    return;
+  }
+
+  session = g_object_get_data(G_OBJECT(app), "session");
+  existing = (gchar **) g_hash_table_get_keys_as_array(session->pages, NULL);
+
+  import_vault_async(g_file_peek_path(file), (const gchar *const *) existing,
+                     NULL, import_done_cb, app);
+
+  g_free(existing);
+  g_clear_object(&file);
+}
+
+/* Whether the workspace in path has unsaved changes, shown or warm */
+static gboolean
+workspace_modified(GtkApplication *app, const gchar *path)
+{
+  Session *current = g_object_get_data(G_OBJECT(app), "session");
+  Session *warm = session_peek(path);
+
+  return (current != NULL && g_strcmp0(current->path, path) == 0 &&
+          session_modified(current)) ||
+         (warm != NULL && session_modified(warm));
+}
+
+struct restore {
+  GtkApplication *app;
+  gchar *path;
+  gchar *name;
+};
+
+static void
+restore_free(struct restore *restore)
+{
+  g_free(restore->path);
+  g_free(restore->name);
+  g_free(restore);
+}
+
+static void
+restore_snapshot(struct restore *restore)
+{
+  GError *lerr = NULL;
+
+  if (!snapshot_restore(restore->path, restore->name, &lerr)) {
+    g_warning("Could not restore %s: %s", restore->name, lerr->message);
+    g_clear_error(&lerr);
+  } else {
+    load_repo(restore->path, restore->app);
+    /* The workspace as it was before the restore */
+    session_forget(restore->path);
+  }
+
+  restore_free(restore);
+}
+
+static void
+restore_choice_cb(GObject *source_object, GAsyncResult *res, gpointer data)
+{
+  struct restore *restore = data;
+
+  if (gtk_alert_dialog_choose_finish(GTK_ALERT_DIALOG(source_object), res,
+                                     NULL) != 0) {
+    restore_free(restore);
+    return;
+  }
+
+  restore_snapshot(restore);
+}
+
+static void
+restore_file_cb(GObject *source_object, GAsyncResult *res, gpointer data)
+{
+  GtkApplication *app = GTK_APPLICATION(data);
+  struct restore *restore;
+  GError *lerr = NULL;
+  GFile *snapshots;
+  GFile *workspace;
+  GFile *file = gtk_file_dialog_open_finish(GTK_FILE_DIALOG(source_object),
+                                            res, &lerr);
+
+  if (file == NULL) {
+    g_warning("Error restoring: %s",
+              lerr != NULL ? lerr->message : "no error message");
+    return;
+  }
+
+  /* workspace/.snapshots/name */
+  snapshots = g_file_get_parent(file);
+  workspace = g_file_get_parent(snapshots);
+
+  restore = g_malloc0(sizeof(*restore));
+  restore->app = app;
+  restore->path = g_file_get_path(workspace);
+  restore->name = g_file_get_basename(file);
+
+  /* Edits that are not saved would be lost with the pages they are in */
+  if (workspace_modified(app, restore->path)) {
+    GtkAlertDialog *dia;
+    const gchar *buttons[3] = { "Restore", "Cancel", NULL };
+
+    dia = gtk_alert_dialog_new("%s has unsaved changes, restoring %s "
+                               "discards them",
+                               restore->path, restore->name);
+    gtk_alert_dialog_set_buttons(dia, buttons);
+    gtk_alert_dialog_set_cancel_button(dia, 1);
+    gtk_alert_dialog_set_default_button(dia, 1);
+    gtk_alert_dialog_set_modal(dia, TRUE);
+
+    gtk_alert_dialog_choose(dia, app_window, NULL, restore_choice_cb,
+                            restore);
+    g_object_unref(dia);
+  } else {
+    restore_snapshot(restore);
+  }
+
+  g_object_unref(workspace);
+  g_object_unref(snapshots);
+  g_object_unref(file);
+}
+
+static void
+restore_menu_cb(GSimpleAction *simple_action, GVariant *parameter, gpointer *data)
+{
+  GtkApplication *app = GTK_APPLICATION(data);
+  GtkFileDialog *dialog = gtk_file_dialog_new();
+  gchar *save_path = g_object_get_data(G_OBJECT(app), "save-path");
+
+  if (save_path != NULL) {
+    gchar *path = g_build_filename(save_path, SNAPSHOT_DIR, NULL);
+    GFile *folder = g_file_new_for_path(path);
+
+    gtk_file_dialog_set_initial_folder(dialog, folder);
+    g_object_unref(folder);
+    g_free(path);
+  }
+
+  gtk_file_dialog_open(dialog, app_window, NULL, restore_file_cb, data);
+}
+
+static void
+import_menu_cb(GSimpleAction *simple_action, GVariant *parameter, gpointer *data)
+{
+  GtkFileDialog *dialog = gtk_file_dialog_new();
+
+  gtk_file_dialog_select_folder(dialog, app_window, NULL, import_file_cb, data);
+}
+
 static void
 new_menu_cb(GSimpleAction *simple_action, GVariant *parameter, gpointer *data)
 {
   GtkApplication *app = GTK_APPLICATION(data);
+  Session *session;
   EditorPage *page;
-  g_print("Setting new page!");
 
-  page = editor_page_new("Overview", g_hash_table_new(g_str_hash, g_str_equal),
-                         NULL, G_CALLBACK(page_created), app);
+  session = session_new(NULL);
+  open_session(app, session);
+
+  page = editor_page_new("Overview", session->pages, NULL,
+                         G_CALLBACK(page_created), app);
 
   set_page(page, app);
 }
 
+static void
+compress_changed_cb(GSimpleAction *simple_action,
+                    GVariant *value,
+                    gpointer data)
+{
+  /* Applies to the next save, which rewrites every page file */
+  set_compression(GTK_APPLICATION(data),
+                  g_variant_get_boolean(value) ? MANIFEST_COMPRESSION_GZIP
+                                               : MANIFEST_COMPRESSION_NONE);
+}
+
+static void
+outline_changed_cb(GSimpleAction *simple_action, GVariant *value, gpointer data)
+{
+  GtkApplication *app = GTK_APPLICATION(data);
+
+  g_simple_action_set_state(simple_action, value);
+  gtk_widget_set_visible(g_object_get_data(G_OBJECT(app), "outline"),
+                         g_variant_get_boolean(value));
+}
+
+static void
+append_pages(GString *report, const gchar *title, GList *pages)
+{
+  g_string_append_printf(report, "%s (%u)\n", title, g_list_length(pages));
+
+  for (GList *iter = pages; iter != NULL; iter = iter->next) {
+    g_string_append_printf(report, "  %s\n", EDITOR_PAGE(iter->data)->heading);
+  }
+
+  g_string_append_c(report, '\n');
+}
+
+static void
+links_menu_cb(GSimpleAction *simple_action, GVariant *parameter, gpointer *data)
+{
+  LinkGraph *links = editor_page_links();
+  Session *session = g_object_get_data(G_OBJECT(data), "session");
+  GtkAlertDialog *dia;
+  GString *report;
+  GList *pages;
+
+  report = g_string_new(NULL);
+
+  /* The graph also has the pages of warm workspaces */
+  pages = session_filter(session, link_graph_stubs(links));
+  append_pages(report, "Stubs, only created by a link", pages);
+  g_list_free(pages);
+
+  pages = session_filter(session, link_graph_orphans(links));
+  append_pages(report, "Orphans, not linked from other pages", pages);
+  g_list_free(pages);
+
+  pages = session_filter(session, link_graph_dangling(links));
+  g_string_append_printf(report, "Links to removed pages (%u)\n",
+                         g_list_length(pages));
+  for (GList *iter = pages; iter != NULL; iter = iter->next) {
+    GList *sources = link_graph_sources(links, iter->data);
+
+    g_string_append_printf(report, "  %s, from",
+                           EDITOR_PAGE(iter->data)->heading);
+    for (GList *source = sources; source != NULL; source = source->next) {
+      g_string_append_printf(report, " %s%s",
+                             EDITOR_PAGE(source->data)->heading,
+                             source->next != NULL ? "," : "");
+    }
+    g_string_append_c(report, '\n');
+    g_list_free(sources);
+  }
+  g_list_free(pages);
+
+  dia = gtk_alert_dialog_new("Links");
+  gtk_alert_dialog_set_detail(dia, report->str);
+  gtk_alert_dialog_show(dia, app_window);
+
+  g_object_unref(dia);
+  g_string_free(report, TRUE);
+}
+
+static void
+find_menu_cb(GSimpleAction *simple_action, GVariant *parameter, gpointer *data)
+{
+  find_show(GTK_APPLICATION(data), app_window);
+}
+
+static void
+stats_menu_cb(GSimpleAction *simple_action, GVariant *parameter, gpointer *data)
+{
+  GtkApplication *app = GTK_APPLICATION(data);
+
+  hud_toggle(g_object_get_data(G_OBJECT(app), "hud"));
+}
+
+/* A key press waiting for the next frame, see latency_key_pressed() */
+static struct {
+  gint64 pressed;
+  GdkFrameClock *clock;
+  gulong paint_handler;
+} key_latency;
+
+static void
+latency_painted(G_GNUC_UNUSED GdkFrameClock *clock,
+                G_GNUC_UNUSED gpointer user_data)
+{
+  perf_sample(PERF_KEY_TO_FRAME, key_latency.pressed);
+  g_clear_signal_handler(&key_latency.paint_handler, key_latency.clock);
+}
+
+/* Runs before the text view handles the key. Presses while one is waiting
+ * are shown by the same frame and are not counted again. */
+static gboolean
+latency_key_pressed(GtkEventControllerKey *controller,
+                    guint keyval,
+                    G_GNUC_UNUSED guint keycode,
+                    G_GNUC_UNUSED GdkModifierType state,
+                    G_GNUC_UNUSED gpointer user_data)
+{
+  GtkWidget *textarea;
+
+  /* Modifiers alone change nothing on screen */
+  if (key_latency.paint_handler != 0 ||
+      (keyval >= GDK_KEY_Shift_L && keyval <= GDK_KEY_Hyper_R)) {
+    return FALSE;
+  }
+
+  textarea = gtk_event_controller_get_widget(GTK_EVENT_CONTROLLER(controller));
+  key_latency.clock = gtk_widget_get_frame_clock(textarea);
+  if (key_latency.clock == NULL) {
+    return FALSE;
+  }
+
+  key_latency.pressed = perf_begin();
+  key_latency.paint_handler = g_signal_connect(key_latency.clock,
+                                               "after-paint",
+                                               G_CALLBACK(latency_painted),
+                                               NULL);
+
+  return FALSE;
+}
+
+static void
+dump_latency(G_GNUC_UNUSED GApplication *app, G_GNUC_UNUSED gpointer user_data)
+{
+  GError *lerr = NULL;
+
+  if (!perf_latency_dump(g_getenv(PERF_LATENCY_ENV), &lerr)) {
+    g_warning("Could not write latencies: %s", lerr->message);
+    g_clear_error(&lerr);
+  }
+}
+
+static void
+write_trace(G_GNUC_UNUSED GApplication *app, gpointer user_data)
+{
+  Trace *trace = user_data;
+  GError *lerr = NULL;
+
+  editor_page_set_trace(NULL);
+
+  if (!trace_write(trace, g_getenv(TRACE_ENV), &lerr)) {
+    g_warning("Could not write the editing trace: %s", lerr->message);
+    g_clear_error(&lerr);
+  }
+  trace_free(trace);
+}
+
 static void
 event_key_released(G_GNUC_UNUSED GtkEventController *self,
                    guint keyval,
@@ -621,9 +1618,98 @@ event_key_released(G_GNUC_UNUSED GtkEventController *self,
   } else if (keyval == 98 && (state & GDK_CONTROL_MASK)) {
     /* ctrl + b*/
     set_heading(NULL, G_OBJECT(app));
+  } else if (gdk_keyval_to_lower(keyval) == GDK_KEY_f &&
+             (state & GDK_CONTROL_MASK) &&
+             (state & GDK_SHIFT_MASK)) {
+    find_show(app, app_window);
+  } else if (keyval == GDK_KEY_F12) {
+    hud_toggle(g_object_get_data(G_OBJECT(app), "hud"));
   }
 }
 
+/* Embeds are read-only, Backspace after one or Delete before it takes the
+ * whole embed out */
+static gboolean
+embed_key_pressed(GtkEventControllerKey *controller,
+                  guint keyval,
+                  G_GNUC_UNUSED guint keycode,
+                  G_GNUC_UNUSED GdkModifierType state,
+                  gpointer user_data)
+{
+  GtkApplication *app = GTK_APPLICATION(user_data);
+  GtkWidget *textarea;
+  GtkTextBuffer *buffer;
+  EditorPage *page;
+  GtkTextIter iter;
+
+  if (keyval != GDK_KEY_BackSpace && keyval != GDK_KEY_Delete) {
+    return FALSE;
+  }
+
+  textarea = gtk_event_controller_get_widget(GTK_EVENT_CONTROLLER(controller));
+  buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(textarea));
+  page = g_object_get_data(G_OBJECT(app), "current_page");
+  if (page == NULL || page->content != buffer ||
+      gtk_text_buffer_get_has_selection(buffer)) {
+    return FALSE;
+  }
+
+  gtk_text_buffer_get_iter_at_mark(buffer, &iter,
+                                   gtk_text_buffer_get_insert(buffer));
+  if (keyval == GDK_KEY_BackSpace && !gtk_text_iter_backward_char(&iter)) {
+    return FALSE;
+  }
+
+  return editor_page_delete_embed(page, &iter);
+}
+
+/* Every tab has a view of its own, see tabs_show() */
+static void
+setup_view(GtkTextView *view, gpointer user_data)
+{
+  GtkWidget *textarea = GTK_WIDGET(view);
+  GtkEventController *link_hover;
+  GtkEventController *embed_keys;
+  GtkGesture *link_click;
+
+  link_click = gtk_gesture_click_new();
+  gtk_gesture_single_set_button(GTK_GESTURE_SINGLE(link_click),
+                                GDK_BUTTON_PRIMARY);
+  g_signal_connect(link_click, "released", G_CALLBACK(link_released),
+                   user_data);
+  gtk_widget_add_controller(textarea, GTK_EVENT_CONTROLLER(link_click));
+
+  link_hover = gtk_event_controller_motion_new();
+  g_signal_connect(link_hover, "motion", G_CALLBACK(link_motion), NULL);
+  gtk_widget_add_controller(textarea, link_hover);
+
+  gtk_widget_set_has_tooltip(textarea, TRUE);
+  g_signal_connect(textarea, "query-tooltip", G_CALLBACK(link_tooltip), NULL);
+
+  /* Ahead of the view's own handling of the keys */
+  embed_keys = gtk_event_controller_key_new();
+  gtk_event_controller_set_propagation_phase(embed_keys, GTK_PHASE_CAPTURE);
+  g_signal_connect(embed_keys, "key-pressed", G_CALLBACK(embed_key_pressed),
+                   user_data);
+  gtk_widget_add_controller(textarea, embed_keys);
+
+  if (perf_latency_enabled()) {
+    GtkEventController *latency_keys = gtk_event_controller_key_new();
+
+    gtk_event_controller_set_propagation_phase(latency_keys,
+                                               GTK_PHASE_CAPTURE);
+    g_signal_connect(latency_keys, "key-pressed",
+                     G_CALLBACK(latency_key_pressed), NULL);
+    gtk_widget_add_controller(textarea, latency_keys);
+  }
+}
+
+static void
+tab_selected(EditorPage *page, gpointer user_data)
+{
+  set_page(page, GTK_APPLICATION(user_data));
+}
+
 static void
 build_menu(GtkWidget *header, GtkApplication *app)
 {
@@ -643,6 +1729,38 @@ build_menu(GtkWidget *header, GtkApplication *app)
   g_menu_append_item(menubar, menu_item_menu);
   g_object_unref(menu_item_menu);
 
+  menu_item_menu = g_menu_item_new("Restore snapshot", "app.restore");
+  g_menu_append_item(menubar, menu_item_menu);
+  g_object_unref(menu_item_menu);
+
+  menu_item_menu = g_menu_item_new("Import folder", "app.import");
+  g_menu_append_item(menubar, menu_item_menu);
+  g_object_unref(menu_item_menu);
+
+  menu_item_menu = g_menu_item_new("Export HTML", "app.export");
+  g_menu_append_item(menubar, menu_item_menu);
+  g_object_unref(menu_item_menu);
+
+  menu_item_menu = g_menu_item_new("Compress pages", "app.compress");
+  g_menu_append_item(menubar, menu_item_menu);
+  g_object_unref(menu_item_menu);
+
+  menu_item_menu = g_menu_item_new("Outline", "app.outline");
+  g_menu_append_item(menubar, menu_item_menu);
+  g_object_unref(menu_item_menu);
+
+  menu_item_menu = g_menu_item_new("Find and replace", "app.find");
+  g_menu_append_item(menubar, menu_item_menu);
+  g_object_unref(menu_item_menu);
+
+  menu_item_menu = g_menu_item_new("Link report", "app.links");
+  g_menu_append_item(menubar, menu_item_menu);
+  g_object_unref(menu_item_menu);
+
+  menu_item_menu = g_menu_item_new("Statistics", "app.stats");
+  g_menu_append_item(menubar, menu_item_menu);
+  g_object_unref(menu_item_menu);
+
   GSimpleAction *act_open = g_simple_action_new("open", NULL);
   g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(act_open));
   g_signal_connect(act_open, "activate", G_CALLBACK(open_menu_cb), app);
@@ -651,22 +1769,67 @@ build_menu(GtkWidget *header, GtkApplication *app)
   g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(act_save));
   g_signal_connect(act_save, "activate", G_CALLBACK(save_menu_cb), app);
 
+  GSimpleAction *act_restore = g_simple_action_new("restore", NULL);
+  g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(act_restore));
+  g_signal_connect(act_restore, "activate", G_CALLBACK(restore_menu_cb), app);
+
+  GSimpleAction *act_import = g_simple_action_new("import", NULL);
+  g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(act_import));
+  g_signal_connect(act_import, "activate", G_CALLBACK(import_menu_cb), app);
+
+  GSimpleAction *act_export = g_simple_action_new("export", NULL);
+  g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(act_export));
+  g_signal_connect(act_export, "activate", G_CALLBACK(export_menu_cb), app);
+
   GSimpleAction *act_new = g_simple_action_new("new", NULL);
   g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(act_new));
   g_signal_connect(act_new, "activate", G_CALLBACK(new_menu_cb), app);
 
+  GSimpleAction *act_compress = g_simple_action_new_stateful(
+    "compress", NULL, g_variant_new_boolean(FALSE));
+  g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(act_compress));
+  g_signal_connect(act_compress, "change-state",
+                   G_CALLBACK(compress_changed_cb), app);
+
+  GSimpleAction *act_links = g_simple_action_new("links", NULL);
+  g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(act_links));
+  g_signal_connect(act_links, "activate", G_CALLBACK(links_menu_cb), app);
+
+  GSimpleAction *act_outline = g_simple_action_new_stateful(
+    "outline", NULL, g_variant_new_boolean(FALSE));
+  g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(act_outline));
+  g_signal_connect(act_outline, "change-state",
+                   G_CALLBACK(outline_changed_cb), app);
+
+  GSimpleAction *act_find = g_simple_action_new("find", NULL);
+  g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(act_find));
+  g_signal_connect(act_find, "activate", G_CALLBACK(find_menu_cb), app);
+
+  GSimpleAction *act_stats = g_simple_action_new("stats", NULL);
+  g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(act_stats));
+  g_signal_connect(act_stats, "activate", G_CALLBACK(stats_menu_cb), app);
+
   gtk_menu_button_set_menu_model(GTK_MENU_BUTTON(menu_button),
                                  G_MENU_MODEL(menubar));
   adw_header_bar_pack_end(ADW_HEADER_BAR(header), menu_button);
 }
 
+static gboolean
+window_close_request(G_GNUC_UNUSED GtkWindow *window, gpointer user_data)
+{
+  store_view(GTK_APPLICATION(user_data));
+
+  return FALSE;
+}
+
 static void
 activate(GtkApplication *app, gpointer user_data)
 {
   GtkWidget *window;
-  GtkWidget *textarea;
 
   GtkWidget *box;
+  GtkWidget *overlay;
+  GtkWidget *hud;
   GtkWidget *splitbar;
   GtkWidget *pages_box;
   GtkWidget *content_box;
@@ -675,15 +1838,15 @@ activate(GtkApplication *app, gpointer user_data)
   GtkWidget *color_picker;
   GtkWidget *heading_button;
   GtkWidget *remove_button;
-  GtkWidget *scroll;
+  GtkWidget *tabs;
+  GtkWidget *text_box;
+  GtkWidget *outline;
   GtkEventController *event_controller;
   // EditorPage *page;
 
   pages_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 10);
 
-  textarea = gtk_text_view_new();
-
-  scroll = gtk_scrolled_window_new();
+  tabs = tabs_new(setup_view, tab_selected, app);
 
   splitbar = adw_overlay_split_view_new();
 
@@ -713,17 +1876,23 @@ activate(GtkApplication *app, gpointer user_data)
   gtk_box_append(GTK_BOX(content_header_box), color_picker);
   gtk_box_append(GTK_BOX(content_header_box), remove_button);
 
-  gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(scroll), textarea);
+  /* Hidden until turned on from the menu */
+  outline = outline_panel_new();
+  gtk_widget_set_visible(outline, FALSE);
+
+  text_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+  gtk_box_append(GTK_BOX(text_box), tabs);
+  gtk_box_append(GTK_BOX(text_box), outline);
+
   gtk_box_append(GTK_BOX(content_box), content_header_box);
-  gtk_box_append(GTK_BOX(content_box), scroll);
+  gtk_box_append(GTK_BOX(content_box), text_box);
 
   adw_overlay_split_view_set_content(ADW_OVERLAY_SPLIT_VIEW(splitbar),
                                      content_box);
 
-  gtk_text_view_set_left_margin(GTK_TEXT_VIEW(textarea), 20);
-  gtk_text_view_set_wrap_mode(GTK_TEXT_VIEW(textarea), GTK_WRAP_WORD);
-
   window = adw_application_window_new(app);
+  g_signal_connect(window, "close-request", G_CALLBACK(window_close_request),
+                   app);
   GtkWidget *title = adw_window_title_new("Editor", NULL);
   GtkWidget *header = adw_header_bar_new();
   adw_header_bar_set_title_widget(ADW_HEADER_BAR(header), title);
@@ -732,15 +1901,19 @@ activate(GtkApplication *app, gpointer user_data)
   box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 10);
   gtk_box_append(GTK_BOX(box), header);
   gtk_box_append(GTK_BOX(box), splitbar);
-  GQueue *pages_list = g_queue_new();
+
+  hud = hud_new(app);
+  overlay = gtk_overlay_new();
+  gtk_overlay_set_child(GTK_OVERLAY(overlay), box);
+  gtk_overlay_add_overlay(GTK_OVERLAY(overlay), hud);
 
   g_object_set_data(G_OBJECT(app), "content_header", content_header);
-  g_object_set_data(G_OBJECT(app), "textarea", textarea);
+  g_object_set_data(G_OBJECT(app), "tabs", tabs);
   g_object_set_data(G_OBJECT(app), "pages_box", pages_box);
-  g_object_set_data(G_OBJECT(app), "pages_list", pages_list);
   g_object_set_data(G_OBJECT(app), "color_picker", color_picker);
   g_object_set_data(G_OBJECT(app), "remove_button", remove_button);
-  g_object_set_data(G_OBJECT(textarea), "app", app);
+  g_object_set_data(G_OBJECT(app), "hud", hud);
+  g_object_set_data(G_OBJECT(app), "outline", outline);
 
   // page = editor_page_new("Overview", g_hash_table_new(g_str_hash,
   // g_str_equal),
@@ -748,11 +1921,15 @@ activate(GtkApplication *app, gpointer user_data)
 
   /* set_page(page, app); */
 
+  /* Empty until a workspace is loaded or made */
+  open_session(app, session_new(NULL));
+  update_css(app);
+
   gchar *saved_path = get_current_ws();
 
   if (saved_path != NULL && strlen(saved_path) > 3) {
     g_message("Loading pages from %s", saved_path);
-    load_repo(saved_path, g_hash_table_new(g_str_hash, g_str_equal), app);
+    open_workspace(app, saved_path);
   }
 
   g_free(saved_path);
@@ -764,12 +1941,8 @@ activate(GtkApplication *app, gpointer user_data)
                    G_CALLBACK(event_key_released), app);
   gtk_widget_add_controller(window, event_controller);
 
-  adw_application_window_set_content(ADW_APPLICATION_WINDOW(window), box);
+  adw_application_window_set_content(ADW_APPLICATION_WINDOW(window), overlay);
 
-  gtk_scrolled_window_set_propagate_natural_height(GTK_SCROLLED_WINDOW(scroll),
-                                                   TRUE);
-  gtk_scrolled_window_set_min_content_width(GTK_SCROLLED_WINDOW(scroll), 300);
-  gtk_scrolled_window_set_min_content_height(GTK_SCROLLED_WINDOW(scroll), 400);
 
   gtk_window_set_default_size(GTK_WINDOW(window), 1200, 720);
   gtk_window_present(GTK_WINDOW(window));
@@ -785,6 +1958,15 @@ main(int argc, char *argv[])
 
   app = adw_application_new("org.gtk.example", G_APPLICATION_DEFAULT_FLAGS);
   g_signal_connect(app, "activate", G_CALLBACK(activate), NULL);
+  if (perf_latency_enabled()) {
+    g_signal_connect(app, "shutdown", G_CALLBACK(dump_latency), NULL);
+  }
+  if (g_getenv(TRACE_ENV) != NULL) {
+    Trace *trace = trace_new();
+
+    editor_page_set_trace(trace);
+    g_signal_connect(app, "shutdown", G_CALLBACK(write_trace), trace);
+  }
   g_application_run(G_APPLICATION(app), argc, argv);
 
   g_object_unref(app);
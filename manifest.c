@@ -0,0 +1,318 @@
+#include "manifest.h"
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <string.h>
+
+#define MANIFEST_MAGIC "rpgeditor-manifest"
+#define MANIFEST_FIELDS 7
+#define MANIFEST_COMPRESSION "compression"
+
+static const gchar *const compression_names[] = {
+  [MANIFEST_COMPRESSION_NONE] = "none",
+  [MANIFEST_COMPRESSION_GZIP] = "gzip",
+};
+
+/* Splits line in place on tabs, the last field gets the rest of the line */
+static guint
+split_fields(gchar *line, gchar *end, gchar **fields, guint max)
+{
+  guint n = 0;
+
+  fields[n++] = line;
+  while (n < max) {
+    gchar *tab = memchr(line, '\t', end - line);
+
+    if (tab == NULL) {
+      break;
+    }
+    *tab = '\0';
+    line = tab + 1;
+    fields[n++] = line;
+  }
+
+  return n;
+}
+
+static gint
+compare_order(gconstpointer a, gconstpointer b)
+{
+  const ManifestEntry *ea = a;
+  const ManifestEntry *eb = b;
+
+  return (ea->order > eb->order) - (ea->order < eb->order);
+}
+
+static gboolean
+parse_compression(Manifest *manifest, const gchar *name, GError **error)
+{
+  for (guint i = 0; i < G_N_ELEMENTS(compression_names); i++) {
+    if (g_str_equal(name, compression_names[i])) {
+      manifest->compression = i;
+      return TRUE;
+    }
+  }
+
+  g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+              "Unsupported page compression %s", name);
+
+  return FALSE;
+}
+
+/* Page files are slots right in the workspace folder. A name with a
+ * directory separator could point anywhere, so could "..", which has no
+ * ".md" suffix either. */
+static gboolean
+valid_file(const gchar *file)
+{
+  return strchr(file, '/') == NULL && strchr(file, '\\') == NULL &&
+         (g_str_has_suffix(file, ".md") || g_str_has_suffix(file, ".md.gz"));
+}
+
+static Manifest *
+parse(gchar *data, gsize len, gboolean legacy, GError **error)
+{
+  Manifest *manifest;
+  gchar *iter = data;
+  gchar *end = data + len;
+
+  g_assert(data[len] == '\0');
+
+  manifest = g_malloc0(sizeof(*manifest));
+  manifest->data = data;
+  manifest->entries = g_array_new(FALSE, TRUE, sizeof(ManifestEntry));
+  manifest->version = legacy ? 0 : MANIFEST_VERSION;
+
+  /* One pass over the buffer, the entries point into it */
+  while (iter < end) {
+    gchar *fields[MANIFEST_FIELDS];
+    gchar *line_end;
+    ManifestEntry entry = { 0 };
+    guint n;
+
+    line_end = memchr(iter, '\n', end - iter);
+    if (line_end == NULL) {
+      line_end = end;
+    }
+    *line_end = '\0';
+
+    n = split_fields(iter, line_end, fields, legacy ? 2 : MANIFEST_FIELDS);
+    iter = line_end + 1;
+
+    if (!legacy && g_str_equal(fields[0], MANIFEST_MAGIC)) {
+      manifest->version = n > 1 ? strtoul(fields[1], NULL, 10) : 0;
+      if (manifest->version == 0 || manifest->version > MANIFEST_VERSION) {
+        g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                    "Unsupported manifest version %s",
+                    n > 1 ? fields[1] : "(none)");
+        manifest_free(manifest);
+        return NULL;
+      }
+      continue;
+    }
+
+    if (!legacy && g_str_equal(fields[0], MANIFEST_COMPRESSION)) {
+      if (!parse_compression(manifest, n > 1 ? fields[1] : "", error)) {
+        manifest_free(manifest);
+        return NULL;
+      }
+      continue;
+    }
+
+    if (legacy) {
+      if (!g_str_has_suffix(fields[0], ".md") || !valid_file(fields[0])) {
+        continue;
+      }
+      entry.id = manifest->entries->len + 1;
+      entry.order = manifest->entries->len;
+      entry.file = fields[0];
+      entry.color = n > 1 ? fields[1] : NULL;
+    } else {
+      if (n < MANIFEST_FIELDS) {
+        continue;
+      }
+      entry.id = strtoul(fields[0], NULL, 10);
+      entry.order = strtoul(fields[1], NULL, 10);
+      entry.file = fields[2];
+      entry.color = fields[3];
+      entry.length = g_ascii_strtoull(fields[4], NULL, 10);
+      entry.hash = fields[5];
+      entry.heading = fields[6];
+
+      if (!valid_file(entry.file)) {
+        g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                    "Page file %s is not in the workspace", entry.file);
+        manifest_free(manifest);
+        return NULL;
+      }
+    }
+
+    g_array_append_val(manifest->entries, entry);
+  }
+
+  g_array_sort(manifest->entries, compare_order);
+
+  return manifest;
+}
+
+Manifest *
+manifest_parse(gchar *data, gsize len, GError **error)
+{
+  return parse(data, len, FALSE, error);
+}
+
+void
+manifest_free(Manifest *manifest)
+{
+  if (manifest == NULL) {
+    return;
+  }
+
+  g_array_unref(manifest->entries);
+  g_free(manifest->data);
+  g_free(manifest);
+}
+
+GString *
+manifest_begin(ManifestCompression compression)
+{
+  GString *contents;
+
+  contents = g_string_new(MANIFEST_MAGIC "\t" G_STRINGIFY(MANIFEST_VERSION)
+                                         "\n");
+
+  if (compression != MANIFEST_COMPRESSION_NONE) {
+    g_string_append_printf(contents, MANIFEST_COMPRESSION "\t%s\n",
+                           compression_names[compression]);
+  }
+
+  return contents;
+}
+
+void
+manifest_append(GString *contents, const ManifestEntry *entry)
+{
+  gchar *heading;
+
+  heading = g_strdup(entry->heading != NULL ? entry->heading : "");
+  g_strdelimit(heading, "\t\r\n", ' ');
+
+  g_string_append_printf(contents, "%u\t%u\t%s\t%s\t%" G_GSIZE_FORMAT "\t%s\t%s\n",
+                         entry->id, entry->order, entry->file,
+                         entry->color != NULL ? entry->color : "",
+                         entry->length,
+                         entry->hash != NULL ? entry->hash : "", heading);
+
+  g_free(heading);
+}
+
+gboolean
+manifest_commit(const gchar *base_path, GString *contents, GError **error)
+{
+  gchar *path;
+  gchar *legacy;
+  gboolean ok;
+
+  path = g_build_filename(base_path, MANIFEST_FILE, NULL);
+  ok = g_file_set_contents(path, contents->str, contents->len, error);
+  g_free(path);
+
+  if (ok) {
+    legacy = g_build_filename(base_path, MANIFEST_LEGACY_FILE, NULL);
+    g_unlink(legacy);
+    g_free(legacy);
+  }
+
+  return ok;
+}
+
+/* Fills in what meta.tab lacks from the page files, as manifest contents */
+static GString *
+upgrade(const gchar *base_path, Manifest *legacy)
+{
+  GString *contents;
+
+  contents = manifest_begin(MANIFEST_COMPRESSION_NONE);
+
+  for (guint i = 0; i < legacy->entries->len; i++) {
+    ManifestEntry *entry = &g_array_index(legacy->entries, ManifestEntry, i);
+    gchar *filename;
+    gchar *data = NULL;
+    gchar *hash = NULL;
+    gchar *heading = NULL;
+    gsize len = 0;
+
+    filename = g_build_filename(base_path, entry->file, NULL);
+
+    if (g_file_get_contents(filename, &data, &len, NULL)) {
+      const gchar *nl = memchr(data, '\n', len);
+
+      hash = g_compute_checksum_for_data(G_CHECKSUM_SHA256,
+                                         (const guchar *) data, len);
+      if (data[0] == '#' && nl != NULL) {
+        heading = g_strndup(data + 1, nl - data - 1);
+      }
+    }
+
+    entry->length = len;
+    entry->hash = hash;
+    entry->heading = heading;
+    manifest_append(contents, entry);
+
+    g_free(filename);
+    g_free(data);
+    g_free(hash);
+    g_free(heading);
+  }
+
+  return contents;
+}
+
+Manifest *
+manifest_load(const gchar *base_path, GError **error)
+{
+  GError *lerr = NULL;
+  Manifest *legacy;
+  GString *contents;
+  gchar *path;
+  gchar *data = NULL;
+  gsize len;
+
+  path = g_build_filename(base_path, MANIFEST_FILE, NULL);
+  if (g_file_get_contents(path, &data, &len, &lerr)) {
+    g_free(path);
+    return manifest_parse(data, len, error);
+  }
+  g_free(path);
+
+  if (!g_error_matches(lerr, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+    g_propagate_error(error, lerr);
+    return NULL;
+  }
+  g_clear_error(&lerr);
+
+  path = g_build_filename(base_path, MANIFEST_LEGACY_FILE, NULL);
+  if (!g_file_get_contents(path, &data, &len, error)) {
+    g_free(path);
+    return NULL;
+  }
+  g_free(path);
+
+  legacy = parse(data, len, TRUE, error);
+  if (legacy == NULL) {
+    return NULL;
+  }
+  contents = upgrade(base_path, legacy);
+  manifest_free(legacy);
+
+  /* A workspace that can not be written to still opens, the manifest is
+   * written by the next save that gets through */
+  if (!manifest_commit(base_path, contents, &lerr)) {
+    g_warning("Could not upgrade %s to a manifest: %s", base_path,
+              lerr->message);
+    g_clear_error(&lerr);
+  }
+
+  len = contents->len;
+  return manifest_parse(g_string_free(contents, FALSE), len, error);
+}
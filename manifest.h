@@ -0,0 +1,68 @@
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define MANIFEST_FILE "manifest.tab"
+#define MANIFEST_LEGACY_FILE "meta.tab"
+#define MANIFEST_VERSION 2
+
+/*
+ * Version 2 adds an optional "compression<TAB>gzip" line after the header.
+ * Compressed page files are gzip streams named "<name>.md.gz".
+ */
+typedef enum {
+  MANIFEST_COMPRESSION_NONE = 0,
+  MANIFEST_COMPRESSION_GZIP,
+} ManifestCompression;
+
+/*
+ * One row of the workspace manifest:
+ *
+ *   id<TAB>order<TAB>file<TAB>color<TAB>length<TAB>hash<TAB>heading
+ *
+ * length and hash (SHA-256, hex) describe the page as written by the last
+ * save, before any compression. The strings point into the buffer owned by
+ * the Manifest.
+ */
+typedef struct {
+  guint id;
+  guint order;
+  const gchar *file;
+  const gchar *color;
+  gsize length;
+  const gchar *hash;
+  const gchar *heading;
+} ManifestEntry;
+
+typedef struct {
+  guint version;
+  ManifestCompression compression;
+  gchar *data;
+  GArray *entries;
+} Manifest;
+
+/* Takes ownership of data, which must be NUL terminated */
+Manifest *manifest_parse(gchar *data, gsize len, GError **error);
+
+/* Reads the manifest in base_path, upgrading a meta.tab if that is all there
+ * is. If the upgrade can not be written the manifest is still returned, and
+ * the next manifest_commit() upgrades the folder. Returns NULL with
+ * G_FILE_ERROR_NOENT if the folder has neither. */
+Manifest *manifest_load(const gchar *base_path, GError **error);
+
+void manifest_free(Manifest *manifest);
+
+GString *manifest_begin(ManifestCompression compression);
+
+void manifest_append(GString *contents, const ManifestEntry *entry);
+
+/* Atomically replaces the manifest in base_path and drops any meta.tab */
+gboolean manifest_commit(const gchar *base_path,
+                         GString *contents,
+                         GError **error);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(Manifest, manifest_free)
+
+G_END_DECLS
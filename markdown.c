@@ -0,0 +1,644 @@
+#include "markdown.h"
+#include <glib.h>
+
+#include <string.h>
+
+static const MdRule rules[MD_N_STYLES] = {
+  [MD_BOLD] = { MD_BOLD, "bold", "**", "**", "<strong>", "</strong>", "<b>",
+                "</b>" },
+  [MD_ITALIC] = { MD_ITALIC, "italic", "*", "*", "<em>", "</em>", "<i>",
+                  "</i>" },
+  [MD_CODE] = { MD_CODE, "code", "`", "`", "<code>", "</code>", "<tt>",
+                "</tt>" },
+  /* The page heading is the only first level header in exported pages */
+  [MD_H1] = { MD_H1, "h1", "# ", "", "<h2>", "</h2>",
+              "<span weight=\"bold\" size=\"x-large\">", "</span>" },
+  [MD_H2] = { MD_H2, "h2", "## ", "", "<h3>", "</h3>",
+              "<span weight=\"bold\" size=\"large\">", "</span>" },
+  [MD_H3] = { MD_H3, "h3", "### ", "", "<h4>", "</h4>", "<b>", "</b>" },
+  [MD_CODE_BLOCK] = { MD_CODE_BLOCK, "code-block", "```\n", "```\n",
+                      "<pre><code>", "</code></pre>", "<tt>", "</tt>" },
+};
+
+/* Tried in order at every position of a paragraph, longest marker first */
+static const struct {
+  MdStyle style;
+  gboolean verbatim;
+} inline_rules[] = {
+  { MD_CODE, TRUE },
+  { MD_BOLD, FALSE },
+  { MD_ITALIC, FALSE },
+};
+
+/* Tried in order at the start of every line, longest marker first */
+static const MdStyle header_rules[] = { MD_H3, MD_H2, MD_H1 };
+
+#define FENCE "```"
+
+struct delim {
+  MdToken token;
+  /* Emphasis markers that may start or end a span, see flanking() */
+  gboolean can_open;
+  gboolean can_close;
+};
+
+/*
+ * Where a closing marker next starts at or after a position. Positions only
+ * grow while a text is tokenized, so a result stays good until it is passed
+ * and no byte is scanned twice.
+ */
+struct scan {
+  gsize from;
+  gsize at;
+};
+
+#define SCAN_INIT { G_MAXSIZE, 0 }
+
+const MdRule *
+md_rule(MdStyle style)
+{
+  g_assert(style < MD_N_STYLES);
+
+  return &rules[style];
+}
+
+gboolean
+md_valid_link_name(const gchar *name, gsize len)
+{
+  const gchar *end = name + len;
+
+  if (len == 0) {
+    return FALSE;
+  }
+
+  while (name < end) {
+    gunichar utf_c;
+
+    utf_c = g_utf8_get_char_validated(name, end - name);
+
+    if (utf_c == (gunichar) -1 || utf_c == (gunichar) -2) {
+      return FALSE;
+    }
+
+    if (!g_unichar_isprint(utf_c) || utf_c == '[' || utf_c == ']') {
+      return FALSE;
+    }
+
+    if (g_unichar_isspace(utf_c) && name[0] != ' ') {
+      return FALSE;
+    }
+
+    name = g_utf8_next_char(name);
+  }
+
+  return TRUE;
+}
+
+gchar *
+md_link_target(const gchar *text, const MdToken *token)
+{
+  gsize skip = token->type == MD_TOKEN_EMBED ? 3 : 2;
+
+  g_assert(token->type == MD_TOKEN_LINK || token->type == MD_TOKEN_EMBED);
+
+  return g_strndup(text + token->offset + skip, token->len - skip - 2);
+}
+
+static void
+push(GArray *tokens, MdTokenType type, MdStyle style, gsize offset, gsize len)
+{
+  MdToken token = { type, style, offset, len };
+
+  if (type == MD_TOKEN_TEXT) {
+    MdToken *last;
+
+    if (len == 0) {
+      return;
+    }
+
+    last = tokens->len > 0 ? &g_array_index(tokens, MdToken, tokens->len - 1)
+                           : NULL;
+    if (last != NULL && last->type == MD_TOKEN_TEXT &&
+        last->offset + last->len == offset) {
+      last->len += len;
+      return;
+    }
+  }
+
+  g_array_append_val(tokens, token);
+}
+
+static gboolean
+has_prefix(const gchar *text, gsize len, const gchar *prefix)
+{
+  gsize plen = strlen(prefix);
+
+  return len >= plen && memcmp(text, prefix, plen) == 0;
+}
+
+/* Opens a code block, anything after the fence is its info string */
+static gboolean
+is_fence(const gchar *line, gsize len)
+{
+  return has_prefix(line, len, FENCE);
+}
+
+/* Closes a code block, the fence alone */
+static gboolean
+is_closing_fence(const gchar *line, gsize len)
+{
+  return len == strlen(FENCE) && is_fence(line, len);
+}
+
+/* The header a line starts, -1 if none. A header needs text. */
+static gint
+header_style(const gchar *line, gsize len)
+{
+  for (guint i = 0; i < G_N_ELEMENTS(header_rules); i++) {
+    const gchar *open = rules[header_rules[i]].open;
+
+    if (has_prefix(line, len, open)) {
+      return len > strlen(open) ? (gint) header_rules[i] : -1;
+    }
+  }
+
+  return -1;
+}
+
+static gsize
+line_end(const gchar *text, gsize pos, gsize len)
+{
+  const gchar *nl = memchr(text + pos, '\n', len - pos);
+
+  return nl != NULL ? (gsize) (nl - text) : len;
+}
+
+/* The start of the next closing fence line at or after pos, len if there
+ * is none */
+static gsize
+next_closing_fence(const gchar *text, gsize pos, gsize len, struct scan *scan)
+{
+  if (pos >= scan->from && pos <= scan->at) {
+    return scan->at;
+  }
+
+  scan->from = pos;
+  while (pos < len) {
+    gsize end = line_end(text, pos, len);
+
+    if (is_closing_fence(text + pos, end - pos)) {
+      break;
+    }
+    pos = end + 1;
+  }
+  scan->at = MIN(pos, len);
+
+  return scan->at;
+}
+
+/* The next needle at or after pos, end if there is none */
+static gsize
+next_marker(const gchar *text,
+            gsize pos,
+            gsize end,
+            const gchar *needle,
+            struct scan *scan)
+{
+  const gchar *stop;
+
+  if (pos >= scan->from && pos <= scan->at) {
+    return scan->at;
+  }
+
+  stop = g_strstr_len(text + pos, end - pos, needle);
+  scan->from = pos;
+  scan->at = stop != NULL ? (gsize) (stop - text) : end;
+
+  return scan->at;
+}
+
+static gsize
+find_link(const gchar *text, gsize pos, gsize end, struct scan *scan)
+{
+  gsize stop;
+
+  if (end - pos < 4 || text[pos] != '[' || text[pos + 1] != '[') {
+    return 0;
+  }
+
+  stop = next_marker(text, pos + 2, end, "]]", scan);
+  if (stop == end || !md_valid_link_name(text + pos + 2, stop - pos - 2)) {
+    return 0;
+  }
+
+  return stop + 2 - pos;
+}
+
+/* The character before or at pos in [start, end), 0 past either end */
+static gunichar
+char_at(const gchar *text, gsize start, gsize end, gssize pos)
+{
+  const gchar *at;
+  gunichar c;
+
+  if (pos < (gssize) start || pos >= (gssize) end) {
+    return 0;
+  }
+
+  at = g_utf8_find_prev_char(text + start, text + pos + 1);
+  c = at != NULL ? g_utf8_get_char_validated(at, text + end - at) : 0;
+
+  /* Broken text counts as a letter */
+  return c == (gunichar) -1 || c == (gunichar) -2 ? 'a' : c;
+}
+
+static gboolean
+is_space(gunichar c)
+{
+  return c == 0 || g_unichar_isspace(c);
+}
+
+/*
+ * CommonMark flanking rules: a marker can open a span when text follows it
+ * and close one when it follows text, so "2 * 3 * 4" has no emphasis.
+ * Punctuation on the inside needs space or punctuation on the outside.
+ */
+static void
+flanking(const gchar *text, gsize start, gsize end, struct delim *delim)
+{
+  gunichar before = char_at(text, start, end, (gssize) delim->token.offset - 1);
+  gunichar after = char_at(text, start, end,
+                           delim->token.offset + delim->token.len);
+
+  delim->can_open = !is_space(after) &&
+                    (!g_unichar_ispunct(after) || is_space(before) ||
+                     g_unichar_ispunct(before));
+  delim->can_close = !is_space(before) &&
+                     (!g_unichar_ispunct(before) || is_space(after) ||
+                      g_unichar_ispunct(after));
+}
+
+/*
+ * Pairs the emphasis markers, a closer with the nearest opener of its style.
+ * Openers passed over stay text, so spans nest and never overlap. Spans with
+ * nothing in them, or with a span of the same style in them, are not made:
+ * their markers could not be written back.
+ */
+static void
+pair_delims(GArray *delims, GArray *openers)
+{
+  gsize last_close[MD_N_STYLES] = { 0 };
+
+  g_array_set_size(openers, 0);
+
+  for (guint i = 0; i < delims->len; i++) {
+    struct delim *delim = &g_array_index(delims, struct delim, i);
+    MdStyle style = delim->token.style;
+    gint k = openers->len - 1;
+
+    if (delim->can_close) {
+      while (k >= 0 && g_array_index(delims, struct delim,
+                                     g_array_index(openers, guint, k))
+                           .token.style != style) {
+        k--;
+      }
+    }
+
+    if (delim->can_close && k >= 0) {
+      struct delim *open = &g_array_index(delims, struct delim,
+                                          g_array_index(openers, guint, k));
+
+      if (open->token.offset + open->token.len < delim->token.offset &&
+          open->token.offset >= last_close[style]) {
+        open->token.type = MD_TOKEN_OPEN;
+        delim->token.type = MD_TOKEN_CLOSE;
+        last_close[style] = delim->token.offset + delim->token.len;
+        g_array_set_size(openers, k);
+        continue;
+      }
+    }
+
+    if (delim->can_open) {
+      g_array_append_val(openers, i);
+    }
+  }
+}
+
+static void
+tokenize_inline(const gchar *text,
+                gsize start,
+                gsize end,
+                MdParseFlags flags,
+                GArray *delims,
+                GArray *openers,
+                GArray *tokens)
+{
+  struct scan links = SCAN_INIT;
+  struct scan code = SCAN_INIT;
+  gsize pos = start;
+  gsize cursor = start;
+
+  g_array_set_size(delims, 0);
+
+  while (pos < end) {
+    gboolean matched = FALSE;
+    gsize len;
+
+    if (!(flags & MD_PARSE_NO_LINKS) && text[pos] == '[' &&
+        (len = find_link(text, pos, end, &links)) > 0) {
+      struct delim delim = { { MD_TOKEN_LINK, 0, pos, len }, FALSE, FALSE };
+
+      g_array_append_val(delims, delim);
+      pos += len;
+      continue;
+    }
+
+    if (!(flags & MD_PARSE_NO_LINKS) && text[pos] == '!' &&
+        (len = find_link(text, pos + 1, end, &links)) > 0) {
+      struct delim delim = { { MD_TOKEN_EMBED, 0, pos, len + 1 }, FALSE,
+                             FALSE };
+
+      g_array_append_val(delims, delim);
+      pos += len + 1;
+      continue;
+    }
+
+    for (guint i = 0; i < G_N_ELEMENTS(inline_rules) && !matched; i++) {
+      const MdRule *rule = &rules[inline_rules[i].style];
+      gsize olen = strlen(rule->open);
+      gsize clen = strlen(rule->close);
+      gsize close;
+
+      if (!has_prefix(text + pos, end - pos, rule->open)) {
+        continue;
+      }
+      matched = TRUE;
+
+      if (!inline_rules[i].verbatim) {
+        struct delim delim = { { MD_TOKEN_TEXT, rule->style, pos, olen },
+                               FALSE, FALSE };
+
+        flanking(text, start, end, &delim);
+        g_array_append_val(delims, delim);
+        pos += olen;
+        continue;
+      }
+
+      /* Nothing is parsed inside a verbatim span, an empty one is text */
+      close = next_marker(text, pos + olen, end, rule->close, &code);
+      if (close == end || close == pos + olen) {
+        pos = close == end ? pos + olen : close + clen;
+        continue;
+      }
+
+      struct delim open = { { MD_TOKEN_OPEN, rule->style, pos, olen }, FALSE,
+                            FALSE };
+      struct delim stop = { { MD_TOKEN_CLOSE, rule->style, close, clen },
+                            FALSE, FALSE };
+      g_array_append_val(delims, open);
+      g_array_append_val(delims, stop);
+      pos = close + clen;
+    }
+
+    if (!matched) {
+      pos++;
+    }
+  }
+
+  pair_delims(delims, openers);
+
+  for (guint i = 0; i < delims->len; i++) {
+    MdToken *token = &g_array_index(delims, struct delim, i).token;
+
+    if (token->type == MD_TOKEN_TEXT) {
+      continue;
+    }
+
+    push(tokens, MD_TOKEN_TEXT, 0, cursor, token->offset - cursor);
+    push(tokens, token->type, token->style, token->offset, token->len);
+    cursor = token->offset + token->len;
+  }
+
+  push(tokens, MD_TOKEN_TEXT, 0, cursor, end - cursor);
+}
+
+GArray *
+md_tokenize(const gchar *text, gsize len, MdParseFlags flags)
+{
+  GArray *tokens;
+  GArray *delims;
+  GArray *openers;
+  struct scan fences = SCAN_INIT;
+  gboolean in_code = FALSE;
+  gsize pos = 0;
+
+  tokens = g_array_new(FALSE, FALSE, sizeof(MdToken));
+  delims = g_array_new(FALSE, FALSE, sizeof(struct delim));
+  openers = g_array_new(FALSE, FALSE, sizeof(guint));
+
+  while (pos < len) {
+    gsize end = line_end(text, pos, len);
+    gsize next = end < len ? end + 1 : len;
+    gint header;
+    gsize para;
+
+    if (in_code) {
+      if (is_closing_fence(text + pos, end - pos)) {
+        push(tokens, MD_TOKEN_CLOSE, MD_CODE_BLOCK, pos, next - pos);
+        in_code = FALSE;
+      } else {
+        push(tokens, MD_TOKEN_TEXT, 0, pos, next - pos);
+      }
+      pos = next;
+      continue;
+    }
+
+    if (is_fence(text + pos, end - pos)) {
+      gsize close = next_closing_fence(text, next, len, &fences);
+
+      /* An empty block keeps its fences as text */
+      if (close == next) {
+        gsize after = line_end(text, close, len);
+
+        after = after < len ? after + 1 : len;
+        push(tokens, MD_TOKEN_TEXT, 0, pos, after - pos);
+        pos = after;
+        continue;
+      }
+
+      if (close < len) {
+        /* A fence with an info string stays in the block as its first line,
+         * the serializer writes no fence of its own before text that starts
+         * with one. So does a fence followed by another. */
+        if (is_closing_fence(text + pos, end - pos) &&
+            !is_fence(text + next, len - next)) {
+          push(tokens, MD_TOKEN_OPEN, MD_CODE_BLOCK, pos, next - pos);
+        } else {
+          push(tokens, MD_TOKEN_OPEN, MD_CODE_BLOCK, pos, 0);
+          push(tokens, MD_TOKEN_TEXT, 0, pos, next - pos);
+        }
+        in_code = TRUE;
+        pos = next;
+        continue;
+      }
+    }
+
+    header = header_style(text + pos, end - pos);
+    if (header >= 0) {
+      gsize olen = strlen(rules[header].open);
+
+      push(tokens, MD_TOKEN_OPEN, header, pos, olen);
+      tokenize_inline(text, pos + olen, end, flags, delims, openers, tokens);
+      push(tokens, MD_TOKEN_CLOSE, header, end, 0);
+      push(tokens, MD_TOKEN_TEXT, 0, end, next - end);
+      pos = next;
+      continue;
+    }
+
+    /* A paragraph runs to a blank line or the next block construct */
+    para = pos;
+    while (para < len) {
+      gsize para_end = line_end(text, para, len);
+      gboolean blank = para_end == para;
+
+      if (para != pos && (is_fence(text + para, para_end - para) ||
+                          header_style(text + para, para_end - para) >= 0)) {
+        break;
+      }
+
+      para = para_end < len ? para_end + 1 : len;
+      if (blank) {
+        break;
+      }
+    }
+
+    tokenize_inline(text, pos, para, flags, delims, openers, tokens);
+    pos = para;
+  }
+
+  g_array_unref(openers);
+  g_array_unref(delims);
+
+  return tokens;
+}
+
+gsize
+md_block_break(const gchar *text, gsize len, gsize limit)
+{
+  struct scan fences = SCAN_INIT;
+  gsize cut = 0;
+  gsize pos = 0;
+
+  /* Line by line like md_tokenize(), a code block as a whole */
+  while (pos < len && (pos < limit || cut == 0)) {
+    gsize end = line_end(text, pos, len);
+    gsize next = end < len ? end + 1 : len;
+
+    if (is_fence(text + pos, end - pos)) {
+      gsize close = next_closing_fence(text, next, len, &fences);
+
+      if (close < len) {
+        next = line_end(text, close, len);
+        next = next < len ? next + 1 : len;
+      }
+    } else if (end == pos) {
+      cut = next;
+    }
+
+    pos = next;
+  }
+
+  return cut > 0 ? cut : len;
+}
+
+static gboolean
+is_blank(const gchar *line, const gchar *end)
+{
+  for (; line < end; line++) {
+    if (!g_ascii_isspace(*line)) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+static void
+append_escaped(GString *markup, const gchar *text, gsize len)
+{
+  gchar *escaped = g_markup_escape_text(text, len);
+
+  g_string_append(markup, escaped);
+  g_free(escaped);
+}
+
+gchar *
+md_preview_markup(const gchar *text, gsize len, guint max_paragraphs)
+{
+  const gchar *end;
+  const gchar *iter;
+  gboolean blank = TRUE;
+  guint paragraphs = 0;
+  GArray *tokens;
+  GString *markup;
+
+  g_utf8_validate(text, len, &end);
+
+  /* Up to the start of the first paragraph past max_paragraphs */
+  for (iter = text; iter < end;) {
+    const gchar *stop = memchr(iter, '\n', end - iter);
+    gboolean empty;
+
+    if (stop == NULL) {
+      stop = end;
+    }
+
+    empty = is_blank(iter, stop);
+    if (!empty && blank && paragraphs++ == max_paragraphs) {
+      end = iter;
+      break;
+    }
+    blank = empty;
+    iter = stop < end ? stop + 1 : end;
+  }
+
+  while (text < end && g_ascii_isspace(*text)) {
+    text++;
+  }
+  while (end > text && g_ascii_isspace(end[-1])) {
+    end--;
+  }
+
+  markup = g_string_new("");
+  tokens = md_tokenize(text, end - text, MD_PARSE_DEFAULT);
+
+  for (guint i = 0; i < tokens->len; i++) {
+    MdToken *token = &g_array_index(tokens, MdToken, i);
+
+    switch (token->type) {
+    case MD_TOKEN_TEXT:
+      append_escaped(markup, text + token->offset, token->len);
+      break;
+    case MD_TOKEN_OPEN:
+      g_string_append(markup, rules[token->style].pango_open);
+      break;
+    case MD_TOKEN_CLOSE:
+      g_string_append(markup, rules[token->style].pango_close);
+      break;
+    case MD_TOKEN_LINK:
+      g_string_append(markup, "<u>");
+      append_escaped(markup, text + token->offset + 2, token->len - 4);
+      g_string_append(markup, "</u>");
+      break;
+    case MD_TOKEN_EMBED:
+      g_string_append(markup, "<i>\u29c9 ");
+      append_escaped(markup, text + token->offset + 3, token->len - 5);
+      g_string_append(markup, "</i>");
+      break;
+    }
+  }
+
+  g_array_unref(tokens);
+
+  return g_string_free(markup, FALSE);
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+  MD_BOLD = 0,
+  MD_ITALIC,
+  MD_CODE,
+  MD_H1,
+  MD_H2,
+  MD_H3,
+  MD_CODE_BLOCK,
+  MD_N_STYLES
+} MdStyle;
+
+typedef enum {
+  MD_TOKEN_TEXT,
+  MD_TOKEN_OPEN,
+  MD_TOKEN_CLOSE,
+  MD_TOKEN_LINK,
+  MD_TOKEN_EMBED,
+} MdTokenType;
+
+typedef enum {
+  MD_PARSE_DEFAULT = 0,
+  /* Leave [[links]] and ![[embeds]] as text */
+  MD_PARSE_NO_LINKS = 1 << 0,
+} MdParseFlags;
+
+/*
+ * A run of the parsed text. OPEN and CLOSE cover the markdown markers of a
+ * style, LINK covers a whole [[Name]] and EMBED a whole ![[Name]].
+ * Everything between them is TEXT.
+ * offset and len are in bytes into the parsed text.
+ */
+typedef struct {
+  MdTokenType type;
+  MdStyle style;
+  gsize offset;
+  gsize len;
+} MdToken;
+
+/*
+ * How a style is written in markdown, HTML and Pango markup and the name of
+ * its text tag.
+ * Adding a construct means adding a row to the rule table in markdown.c.
+ */
+typedef struct {
+  MdStyle style;
+  const gchar *tag;
+  const gchar *open;
+  const gchar *close;
+  const gchar *html_open;
+  const gchar *html_close;
+  const gchar *pango_open;
+  const gchar *pango_close;
+} MdRule;
+
+const MdRule *md_rule(MdStyle style);
+
+/* Headers, code blocks, bold, italic, inline code and links in one pass */
+GArray *md_tokenize(const gchar *text, gsize len, MdParseFlags flags);
+
+/* Where text can be cut so that both parts tokenize as they do in the
+ * whole: after the last blank line outside code blocks up to limit, or the
+ * first one past it, or len if there is none */
+gsize md_block_break(const gchar *text, gsize len, gsize limit);
+
+/* The target of a LINK or EMBED token, newly allocated */
+gchar *md_link_target(const gchar *text, const MdToken *token);
+
+gboolean md_valid_link_name(const gchar *name, gsize len);
+
+/* Pango markup of the first max_paragraphs paragraphs of text, with links
+ * underlined. text may be cut anywhere, an incomplete character at the end
+ * is dropped. */
+gchar *md_preview_markup(const gchar *text, gsize len, guint max_paragraphs);
+
+G_END_DECLS
@@ -0,0 +1,506 @@
+#include "outline.h"
+#include "editor_page.h"
+#include "markdown.h"
+#include <glib.h>
+#include <gtk/gtk.h>
+
+struct _Outline {
+  GtkTextBuffer *content;
+  GSequence *entries;
+  /* Lines edited since the last update, see mark_dirty() */
+  GtkTextMark *dirty_start;
+  GtkTextMark *dirty_end;
+  guint update_source;
+  OutlineChanged changed;
+  gpointer changed_data;
+};
+
+struct outline_panel {
+  GtkTextView *view;
+  GtkWidget *list;
+  EditorPage *page;
+  Outline *outline;
+};
+
+/* Header tags first, a bold header line is still a header */
+static const struct {
+  MdStyle style;
+  guint level;
+} heading_styles[] = {
+  { MD_H1, 1 },
+  { MD_H2, 2 },
+  { MD_H3, 3 },
+  /* Bold lines were the only headings before headers */
+  { MD_BOLD, 1 },
+};
+
+static GtkTextTag *
+heading_tag(guint i)
+{
+  static GtkTextTag *tags[G_N_ELEMENTS(heading_styles)];
+
+  if (tags[i] == NULL) {
+    tags[i] = gtk_text_tag_table_lookup(editor_page_tag_table(),
+                                        md_rule(heading_styles[i].style)->tag);
+  }
+
+  return tags[i];
+}
+
+static gboolean
+is_heading_tag(GtkTextTag *tag)
+{
+  for (guint i = 0; i < G_N_ELEMENTS(heading_styles); i++) {
+    if (heading_tag(i) == tag) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+static void
+entry_free(gpointer data)
+{
+  OutlineEntry *entry = data;
+  GtkTextBuffer *buffer = gtk_text_mark_get_buffer(entry->mark);
+
+  if (buffer != NULL) {
+    gtk_text_buffer_delete_mark(buffer, entry->mark);
+  }
+  g_object_unref(entry->mark);
+  g_free(entry->title);
+  g_free(entry);
+}
+
+/* Twice the offset, so that a search key without a title can sit just
+ * before the entry at its offset */
+static gint
+entry_position(const OutlineEntry *entry, GtkTextBuffer *buffer)
+{
+  GtkTextIter iter;
+
+  gtk_text_buffer_get_iter_at_mark(buffer, &iter, entry->mark);
+
+  return gtk_text_iter_get_offset(&iter) * 2 - (entry->title == NULL);
+}
+
+static gint
+compare_entries(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  return entry_position(a, user_data) - entry_position(b, user_data);
+}
+
+/* The first entry at or after iter */
+static GSequenceIter *
+first_entry_from(Outline *outline, const GtkTextIter *iter)
+{
+  OutlineEntry key = { NULL, NULL, 0 };
+  GSequenceIter *found;
+
+  key.mark = gtk_text_buffer_create_mark(outline->content, NULL, iter, TRUE);
+  found = g_sequence_search(outline->entries, &key, compare_entries,
+                            outline->content);
+  gtk_text_buffer_delete_mark(outline->content, key.mark);
+
+  return found;
+}
+
+/* The entry for the line starting at line, if it is a heading */
+static OutlineEntry *
+heading_at(Outline *outline, const GtkTextIter *line)
+{
+  GtkTextIter line_end = *line;
+  GtkTextIter run_end;
+  OutlineEntry *entry;
+  gchar *rest;
+  gboolean whole;
+  guint i;
+
+  if (gtk_text_iter_ends_line(line)) {
+    return NULL;
+  }
+
+  for (i = 0; i < G_N_ELEMENTS(heading_styles); i++) {
+    if (gtk_text_iter_has_tag(line, heading_tag(i))) {
+      break;
+    }
+  }
+  if (i == G_N_ELEMENTS(heading_styles)) {
+    return NULL;
+  }
+
+  gtk_text_iter_forward_to_line_end(&line_end);
+  run_end = *line;
+  gtk_text_iter_forward_to_tag_toggle(&run_end, heading_tag(i));
+
+  /* Bold words leading a paragraph are not a heading */
+  if (gtk_text_iter_compare(&run_end, &line_end) < 0) {
+    rest = gtk_text_iter_get_text(&run_end, &line_end);
+    whole = g_strstrip(rest)[0] == '\0';
+    g_free(rest);
+    if (!whole) {
+      return NULL;
+    }
+  } else {
+    run_end = line_end;
+  }
+
+  entry = g_malloc0(sizeof(*entry));
+  entry->title = g_strstrip(gtk_text_iter_get_text(line, &run_end));
+  if (entry->title[0] == '\0') {
+    g_free(entry->title);
+    g_free(entry);
+    return NULL;
+  }
+  entry->level = heading_styles[i].level;
+  entry->mark = g_object_ref(gtk_text_buffer_create_mark(outline->content,
+                                                         NULL, line, TRUE));
+
+  return entry;
+}
+
+/* Looks at the dirty lines again, entries around them stay as they are */
+static gboolean
+update(gpointer user_data)
+{
+  Outline *outline = user_data;
+  GtkTextTag *loading;
+  GtkTextIter start;
+  GtkTextIter end;
+  GtkTextIter line;
+  GSequenceIter *iter;
+  gboolean changed = FALSE;
+
+  outline->update_source = 0;
+
+  gtk_text_buffer_get_iter_at_mark(outline->content, &start,
+                                   outline->dirty_start);
+  gtk_text_buffer_get_iter_at_mark(outline->content, &end, outline->dirty_end);
+  gtk_text_buffer_delete_mark(outline->content, outline->dirty_start);
+  gtk_text_buffer_delete_mark(outline->content, outline->dirty_end);
+  outline->dirty_start = NULL;
+  outline->dirty_end = NULL;
+
+  gtk_text_iter_set_line_offset(&start, 0);
+  if (!gtk_text_iter_ends_line(&end)) {
+    gtk_text_iter_forward_to_line_end(&end);
+  }
+
+  iter = first_entry_from(outline, &start);
+  while (!g_sequence_iter_is_end(iter)) {
+    GSequenceIter *next = g_sequence_iter_next(iter);
+    OutlineEntry *entry = g_sequence_get(iter);
+    GtkTextIter at;
+
+    gtk_text_buffer_get_iter_at_mark(outline->content, &at, entry->mark);
+    if (gtk_text_iter_compare(&at, &end) > 0) {
+      break;
+    }
+    g_sequence_remove(iter);
+    iter = next;
+    changed = TRUE;
+  }
+
+  /* The placeholder of a page still loading is no heading */
+  loading = gtk_text_tag_table_lookup(editor_page_tag_table(), "loading");
+
+  /* New entries all go in the gap left above, in order */
+  line = start;
+  do {
+    OutlineEntry *entry;
+
+    if (gtk_text_iter_has_tag(&line, loading)) {
+      break;
+    }
+
+    entry = heading_at(outline, &line);
+    if (entry != NULL) {
+      g_sequence_insert_before(iter, entry);
+      changed = TRUE;
+    }
+  } while (gtk_text_iter_forward_line(&line) &&
+           gtk_text_iter_compare(&line, &end) <= 0);
+
+  if (changed && outline->changed != NULL) {
+    outline->changed(outline, outline->changed_data);
+  }
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+mark_dirty(Outline *outline, const GtkTextIter *start, const GtkTextIter *end)
+{
+  GtkTextIter iter;
+
+  if (outline->dirty_start == NULL) {
+    outline->dirty_start = gtk_text_buffer_create_mark(outline->content, NULL,
+                                                       start, TRUE);
+    outline->dirty_end = gtk_text_buffer_create_mark(outline->content, NULL,
+                                                     end, FALSE);
+  } else {
+    gtk_text_buffer_get_iter_at_mark(outline->content, &iter,
+                                     outline->dirty_start);
+    if (gtk_text_iter_compare(start, &iter) < 0) {
+      gtk_text_buffer_move_mark(outline->content, outline->dirty_start, start);
+    }
+    gtk_text_buffer_get_iter_at_mark(outline->content, &iter,
+                                     outline->dirty_end);
+    if (gtk_text_iter_compare(end, &iter) > 0) {
+      gtk_text_buffer_move_mark(outline->content, outline->dirty_end, end);
+    }
+  }
+
+  if (outline->update_source == 0) {
+    outline->update_source = g_idle_add(update, outline);
+  }
+}
+
+static void
+inserted_text(G_GNUC_UNUSED GtkTextBuffer *buffer,
+              const GtkTextIter *location,
+              gchar *text,
+              gint len,
+              gpointer user_data)
+{
+  GtkTextIter start = *location;
+
+  gtk_text_iter_backward_chars(&start, g_utf8_strlen(text, len));
+  mark_dirty(user_data, &start, location);
+}
+
+static void
+deleted_range(G_GNUC_UNUSED GtkTextBuffer *buffer,
+              GtkTextIter *start,
+              GtkTextIter *end,
+              gpointer user_data)
+{
+  mark_dirty(user_data, start, end);
+}
+
+static void
+tag_changed(G_GNUC_UNUSED GtkTextBuffer *buffer,
+            GtkTextTag *tag,
+            GtkTextIter *start,
+            GtkTextIter *end,
+            gpointer user_data)
+{
+  if (is_heading_tag(tag)) {
+    mark_dirty(user_data, start, end);
+  }
+}
+
+static void
+outline_free(gpointer data)
+{
+  Outline *outline = data;
+
+  g_signal_handlers_disconnect_by_data(outline->content, outline);
+  g_clear_handle_id(&outline->update_source, g_source_remove);
+  if (outline->dirty_start != NULL) {
+    gtk_text_buffer_delete_mark(outline->content, outline->dirty_start);
+    gtk_text_buffer_delete_mark(outline->content, outline->dirty_end);
+  }
+  g_sequence_free(outline->entries);
+  g_object_unref(outline->content);
+  g_free(outline);
+}
+
+Outline *
+outline_get(EditorPage *page)
+{
+  Outline *outline = g_object_get_data(G_OBJECT(page), "outline");
+  GtkTextIter start;
+  GtkTextIter end;
+
+  if (outline != NULL) {
+    return outline;
+  }
+
+  outline = g_malloc0(sizeof(*outline));
+  /* Finalizing the page drops the content before its data */
+  outline->content = g_object_ref(page->content);
+  outline->entries = g_sequence_new(entry_free);
+  g_object_set_data_full(G_OBJECT(page), "outline", outline, outline_free);
+
+  g_signal_connect_after(outline->content, "insert-text",
+                         G_CALLBACK(inserted_text), outline);
+  g_signal_connect_after(outline->content, "delete-range",
+                         G_CALLBACK(deleted_range), outline);
+  g_signal_connect_after(outline->content, "apply-tag",
+                         G_CALLBACK(tag_changed), outline);
+  g_signal_connect_after(outline->content, "remove-tag",
+                         G_CALLBACK(tag_changed), outline);
+
+  /* The one full scan, from idle like every later update */
+  gtk_text_buffer_get_bounds(outline->content, &start, &end);
+  mark_dirty(outline, &start, &end);
+
+  return outline;
+}
+
+GSequence *
+outline_entries(Outline *outline)
+{
+  return outline->entries;
+}
+
+void
+outline_set_changed(Outline *outline,
+                    OutlineChanged changed,
+                    gpointer user_data)
+{
+  outline->changed = changed;
+  outline->changed_data = user_data;
+}
+
+static void
+clear_rows(struct outline_panel *panel)
+{
+  GtkWidget *row;
+
+  while ((row = gtk_widget_get_first_child(panel->list)) != NULL) {
+    gtk_list_box_remove(GTK_LIST_BOX(panel->list), row);
+  }
+}
+
+static void
+refresh(Outline *outline, gpointer user_data)
+{
+  struct outline_panel *panel = user_data;
+  GSequenceIter *iter;
+  GtkWidget *row;
+
+  clear_rows(panel);
+
+  iter = g_sequence_get_begin_iter(outline_entries(outline));
+  for (; !g_sequence_iter_is_end(iter); iter = g_sequence_iter_next(iter)) {
+    OutlineEntry *entry = g_sequence_get(iter);
+    GtkWidget *label = gtk_label_new(entry->title);
+
+    gtk_label_set_xalign(GTK_LABEL(label), 0);
+    gtk_label_set_ellipsize(GTK_LABEL(label), PANGO_ELLIPSIZE_END);
+    gtk_widget_set_margin_start(label, 6 + (entry->level - 1) * 12);
+
+    row = gtk_list_box_row_new();
+    gtk_list_box_row_set_child(GTK_LIST_BOX_ROW(row), label);
+    /* The entry may be gone by the time the row is clicked */
+    g_object_set_data_full(G_OBJECT(row), "mark", g_object_ref(entry->mark),
+                           g_object_unref);
+    gtk_list_box_append(GTK_LIST_BOX(panel->list), row);
+  }
+}
+
+static void
+attach(struct outline_panel *panel)
+{
+  if (panel->page == NULL || panel->outline != NULL) {
+    return;
+  }
+
+  panel->outline = outline_get(panel->page);
+  outline_set_changed(panel->outline, refresh, panel);
+  refresh(panel->outline, panel);
+}
+
+static void
+detach(struct outline_panel *panel)
+{
+  if (panel->outline != NULL) {
+    outline_set_changed(panel->outline, NULL, NULL);
+    panel->outline = NULL;
+  }
+}
+
+static void
+panel_mapped(GtkWidget *widget, G_GNUC_UNUSED gpointer user_data)
+{
+  attach(g_object_get_data(G_OBJECT(widget), "outline-panel"));
+}
+
+static void
+panel_unmapped(GtkWidget *widget, G_GNUC_UNUSED gpointer user_data)
+{
+  detach(g_object_get_data(G_OBJECT(widget), "outline-panel"));
+}
+
+static void
+row_activated(G_GNUC_UNUSED GtkListBox *list,
+              GtkListBoxRow *row,
+              gpointer user_data)
+{
+  struct outline_panel *panel = user_data;
+  GtkTextMark *mark = g_object_get_data(G_OBJECT(row), "mark");
+  GtkTextBuffer *buffer = gtk_text_mark_get_buffer(mark);
+  GtkTextIter iter;
+
+  if (buffer == NULL || buffer != gtk_text_view_get_buffer(panel->view)) {
+    return;
+  }
+
+  gtk_text_buffer_get_iter_at_mark(buffer, &iter, mark);
+  gtk_text_buffer_place_cursor(buffer, &iter);
+  gtk_text_view_scroll_to_mark(panel->view, mark, 0.0, TRUE, 0.0, 0.0);
+  gtk_widget_grab_focus(GTK_WIDGET(panel->view));
+}
+
+static void
+panel_free(gpointer data)
+{
+  struct outline_panel *panel = data;
+
+  detach(panel);
+  g_clear_object(&panel->page);
+  g_free(panel);
+}
+
+GtkWidget *
+outline_panel_new(void)
+{
+  struct outline_panel *panel;
+  GtkWidget *scroll;
+
+  panel = g_malloc0(sizeof(*panel));
+
+  panel->list = gtk_list_box_new();
+  gtk_list_box_set_selection_mode(GTK_LIST_BOX(panel->list),
+                                  GTK_SELECTION_NONE);
+  gtk_widget_add_css_class(panel->list, "navigation-sidebar");
+  g_signal_connect(panel->list, "row-activated", G_CALLBACK(row_activated),
+                   panel);
+
+  scroll = gtk_scrolled_window_new();
+  gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scroll),
+                                 GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+  gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(scroll), panel->list);
+  gtk_widget_set_size_request(scroll, 220, -1);
+  g_object_set_data_full(G_OBJECT(scroll), "outline-panel", panel,
+                         panel_free);
+
+  g_signal_connect(scroll, "map", G_CALLBACK(panel_mapped), NULL);
+  g_signal_connect(scroll, "unmap", G_CALLBACK(panel_unmapped), NULL);
+
+  return scroll;
+}
+
+void
+outline_panel_set_page(GtkWidget *widget, GtkTextView *view, EditorPage *page)
+{
+  struct outline_panel *panel = g_object_get_data(G_OBJECT(widget),
+                                                  "outline-panel");
+
+  panel->view = view;
+  if (panel->page == page) {
+    return;
+  }
+
+  detach(panel);
+  g_set_object(&panel->page, page);
+
+  if (gtk_widget_get_mapped(widget)) {
+    attach(panel);
+  } else {
+    clear_rows(panel);
+  }
+}
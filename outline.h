@@ -0,0 +1,47 @@
+#pragma once
+
+#include <gtk/gtk.h>
+
+#include "editor_page.h"
+
+G_BEGIN_DECLS
+
+/*
+ * The sections of a page: lines that are headers, or bold as a whole as
+ * editor_page_selected_to_heading() makes them. Only the lines touched by
+ * an edit are looked at again.
+ */
+typedef struct _Outline Outline;
+
+typedef struct {
+  /* At the start of the heading line */
+  GtkTextMark *mark;
+  gchar *title;
+  /* 1 to 3 */
+  guint level;
+} OutlineEntry;
+
+typedef void (*OutlineChanged)(Outline *outline, gpointer user_data);
+
+/* The outline of page, made on first use and kept up to date from then on */
+Outline *outline_get(EditorPage *page);
+
+/* The entries in text order, a GSequence of OutlineEntry */
+GSequence *outline_entries(Outline *outline);
+
+/* Called once after each batch of edits that changed the entries, NULL
+ * stops */
+void outline_set_changed(Outline *outline,
+                         OutlineChanged changed,
+                         gpointer user_data);
+
+/* A list of the sections of a page. The outline is only followed while the
+ * panel is mapped. */
+GtkWidget *outline_panel_new(void);
+
+/* Shows the sections of page, a click scrolls view to one */
+void outline_panel_set_page(GtkWidget *panel,
+                            GtkTextView *view,
+                            EditorPage *page);
+
+G_END_DECLS
@@ -0,0 +1,84 @@
+#include "page.h"
+#include "markdown.h"
+#include <glib.h>
+
+#include <string.h>
+
+Page *
+page_new(const gchar *heading)
+{
+  Page *page = g_malloc0(sizeof(*page));
+
+  page->heading = g_strdup(heading);
+  page->body = g_string_new("");
+
+  return page;
+}
+
+void
+page_free(Page *page)
+{
+  if (page == NULL) {
+    return;
+  }
+
+  g_free(page->heading);
+  g_free(page->color);
+  g_string_free(page->body, TRUE);
+  g_free(page);
+}
+
+Page *
+page_parse(const gchar *data, gsize len, GError **error)
+{
+  const gchar *nl;
+  Page *page;
+
+  /* Same rules as editor_page_load_data() */
+  nl = len > 0 && data[0] == '#' ? memchr(data, '\n', len) : NULL;
+  if (nl == NULL) {
+    g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                "A page starts with a #heading line");
+    return NULL;
+  }
+
+  page = g_malloc0(sizeof(*page));
+  page->heading = g_strndup(data + 1, nl - data - 1);
+  page->body = g_string_new_len(nl + 1, data + len - nl - 1);
+
+  return page;
+}
+
+GString *
+page_to_md(const Page *page)
+{
+  GString *md;
+
+  md = g_string_sized_new(strlen(page->heading) + page->body->len + 2);
+  g_string_append_printf(md, "#%s\n", page->heading);
+  g_string_append_len(md, page->body->str, page->body->len);
+
+  return md;
+}
+
+GPtrArray *
+page_links(const Page *page)
+{
+  GPtrArray *links;
+  GArray *tokens;
+
+  links = g_ptr_array_new_with_free_func(g_free);
+  tokens = md_tokenize(page->body->str, page->body->len, MD_PARSE_DEFAULT);
+
+  for (guint i = 0; i < tokens->len; i++) {
+    MdToken *token = &g_array_index(tokens, MdToken, i);
+
+    if (token->type == MD_TOKEN_LINK || token->type == MD_TOKEN_EMBED) {
+      g_ptr_array_add(links, md_link_target(page->body->str, token));
+    }
+  }
+
+  g_array_unref(tokens);
+
+  return links;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * A page without any widgets: the heading and the markdown that follows it
+ * in a page file, "#<heading>\n<body>". Used to process workspaces without a
+ * display, the editor keeps its pages in an EditorPage.
+ */
+typedef struct {
+  /* Workspace id, 0 until saved */
+  guint id;
+  gchar *heading;
+  /* As in the manifest, may be NULL */
+  gchar *color;
+  GString *body;
+} Page;
+
+Page *page_new(const gchar *heading);
+
+void page_free(Page *page);
+
+/* Parses the contents of a page file */
+Page *page_parse(const gchar *data, gsize len, GError **error);
+
+/* The contents of the page file */
+GString *page_to_md(const Page *page);
+
+/* The names of the pages linked to or embedded in the body, in order,
+ * with duplicates */
+GPtrArray *page_links(const Page *page);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(Page, page_free)
+
+G_END_DECLS
@@ -0,0 +1,212 @@
+#include "perf.h"
+#include <glib.h>
+
+#include <stdlib.h>
+
+static const gchar *latency_names[PERF_N_LATENCIES] = {
+  [PERF_KEY_TO_FRAME] = "key_to_frame",
+  [PERF_INSERT_TEXT] = "insert_text",
+  [PERF_TAG_LINK] = "tag_link",
+};
+
+struct sample {
+  gint64 time;
+  gint64 latency;
+};
+
+/* The last PERF_SAMPLES samples of one latency, oldest at next once full */
+struct samples {
+  struct sample ring[PERF_SAMPLES];
+  guint next;
+  guint n;
+};
+
+/* Only touched from the main thread, a handful of integers */
+static struct {
+  gint64 last[PERF_N_TIMERS];
+  gint64 counters[PERF_N_COUNTERS];
+
+  gint64 last_frame;
+  gint64 frames[PERF_FRAMES];
+  guint next_frame;
+  guint n_frames;
+
+  gint enabled;
+  struct samples *latencies[PERF_N_LATENCIES];
+} perf;
+
+gint64
+perf_begin(void)
+{
+  return g_get_monotonic_time();
+}
+
+void
+perf_end(PerfTimer timer, gint64 begin)
+{
+  perf.last[timer] = g_get_monotonic_time() - begin;
+}
+
+gint64
+perf_last(PerfTimer timer)
+{
+  return perf.last[timer];
+}
+
+void
+perf_count(PerfCounter counter, gint64 delta)
+{
+  perf.counters[counter] += delta;
+}
+
+gint64
+perf_counter(PerfCounter counter)
+{
+  return perf.counters[counter];
+}
+
+void
+perf_frame(gint64 frame_time)
+{
+  if (perf.last_frame != 0) {
+    perf.frames[perf.next_frame] = frame_time - perf.last_frame;
+    perf.next_frame = (perf.next_frame + 1) % PERF_FRAMES;
+    perf.n_frames = MIN(perf.n_frames + 1, PERF_FRAMES);
+  }
+  perf.last_frame = frame_time;
+}
+
+/* Forget the history, the next frame starts a new interval */
+void
+perf_frame_reset(void)
+{
+  perf.last_frame = 0;
+  perf.next_frame = 0;
+  perf.n_frames = 0;
+}
+
+void
+perf_frame_stats(gint64 *avg, gint64 *max)
+{
+  gint64 sum = 0;
+
+  *max = 0;
+  for (guint i = 0; i < perf.n_frames; i++) {
+    sum += perf.frames[i];
+    *max = MAX(*max, perf.frames[i]);
+  }
+
+  *avg = perf.n_frames > 0 ? sum / perf.n_frames : 0;
+}
+
+gboolean
+perf_latency_enabled(void)
+{
+  if (perf.enabled == 0) {
+    perf.enabled = g_getenv(PERF_LATENCY_ENV) != NULL ? 1 : -1;
+  }
+
+  return perf.enabled > 0;
+}
+
+const gchar *
+perf_latency_name(PerfLatency latency)
+{
+  return latency_names[latency];
+}
+
+void
+perf_sample(PerfLatency latency, gint64 begin)
+{
+  struct samples *samples;
+  gint64 now;
+
+  if (!perf_latency_enabled()) {
+    return;
+  }
+
+  now = g_get_monotonic_time();
+
+  if (perf.latencies[latency] == NULL) {
+    perf.latencies[latency] = g_malloc0(sizeof(struct samples));
+  }
+  samples = perf.latencies[latency];
+
+  samples->ring[samples->next].time = begin;
+  samples->ring[samples->next].latency = now - begin;
+  samples->next = (samples->next + 1) % PERF_SAMPLES;
+  samples->n = MIN(samples->n + 1, PERF_SAMPLES);
+}
+
+static gint
+compare_latency(gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64 *) a;
+  gint64 y = *(const gint64 *) b;
+
+  return (x > y) - (x < y);
+}
+
+guint
+perf_latency_stats(PerfLatency latency,
+                   gint64 *p50,
+                   gint64 *p95,
+                   gint64 *p99)
+{
+  struct samples *samples = perf.latencies[latency];
+  gint64 *sorted;
+  guint n;
+
+  *p50 = *p95 = *p99 = 0;
+
+  if (samples == NULL || samples->n == 0) {
+    return 0;
+  }
+
+  n = samples->n;
+  sorted = g_new(gint64, n);
+  for (guint i = 0; i < n; i++) {
+    sorted[i] = samples->ring[i].latency;
+  }
+  qsort(sorted, n, sizeof(*sorted), compare_latency);
+
+  /* Nearest rank */
+  *p50 = sorted[(n * 50 + 99) / 100 - 1];
+  *p95 = sorted[(n * 95 + 99) / 100 - 1];
+  *p99 = sorted[(n * 99 + 99) / 100 - 1];
+
+  g_free(sorted);
+
+  return n;
+}
+
+gboolean
+perf_latency_dump(const gchar *path, GError **error)
+{
+  GString *csv = g_string_new("metric,time_us,latency_us\n");
+  gboolean ok;
+
+  for (guint i = 0; i < PERF_N_LATENCIES; i++) {
+    struct samples *samples = perf.latencies[i];
+
+    if (samples == NULL) {
+      continue;
+    }
+
+    /* Oldest first */
+    for (guint j = 0; j < samples->n; j++) {
+      guint pos = (samples->next + PERF_SAMPLES - samples->n + j) %
+                  PERF_SAMPLES;
+
+      g_string_append_printf(csv,
+                             "%s,%" G_GINT64_FORMAT ",%" G_GINT64_FORMAT "\n",
+                             latency_names[i], samples->ring[pos].time,
+                             samples->ring[pos].latency);
+    }
+  }
+
+  ok = g_file_set_contents(path, csv->str, csv->len, error);
+  g_string_free(csv, TRUE);
+
+  return ok;
+}
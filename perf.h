@@ -0,0 +1,67 @@
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+  /* Opening a workspace to all of its pages loaded */
+  PERF_LOAD_REPO = 0,
+  /* Opening a workspace to its first page shown */
+  PERF_FIRST_PAGE,
+  PERF_SAVE,
+  PERF_SET_PAGE,
+  PERF_N_TIMERS
+} PerfTimer;
+
+typedef enum {
+  PERF_CSS_PROVIDERS = 0,
+  PERF_N_COUNTERS
+} PerfCounter;
+
+typedef enum {
+  /* Key press in the text view to the next frame painted */
+  PERF_KEY_TO_FRAME = 0,
+  /* The insert-text handler of page buffers */
+  PERF_INSERT_TEXT,
+  /* Turning a typed [[Name]] into a link */
+  PERF_TAG_LINK,
+  PERF_N_LATENCIES
+} PerfLatency;
+
+/* Number of frame intervals kept for perf_frame_stats() */
+#define PERF_FRAMES 120
+
+/* Number of samples kept per latency */
+#define PERF_SAMPLES 4096
+
+/* Latencies are only sampled when this names the CSV file to write them to */
+#define PERF_LATENCY_ENV "RPGEDITOR_LATENCY"
+
+/* Timers measure the last run of an operation, in microseconds */
+gint64 perf_begin(void);
+void perf_end(PerfTimer timer, gint64 begin);
+gint64 perf_last(PerfTimer timer);
+
+void perf_count(PerfCounter counter, gint64 delta);
+gint64 perf_counter(PerfCounter counter);
+
+/* frame_time as given by gdk_frame_clock_get_frame_time() */
+void perf_frame(gint64 frame_time);
+void perf_frame_reset(void);
+void perf_frame_stats(gint64 *avg, gint64 *max);
+
+gboolean perf_latency_enabled(void);
+const gchar *perf_latency_name(PerfLatency latency);
+/* Records the time since begin, if enabled */
+void perf_sample(PerfLatency latency, gint64 begin);
+/* Percentiles of the kept samples in microseconds, returns the number of
+ * samples */
+guint perf_latency_stats(PerfLatency latency,
+                         gint64 *p50,
+                         gint64 *p95,
+                         gint64 *p99);
+/* Writes every kept sample as metric,time_us,latency_us */
+gboolean perf_latency_dump(const gchar *path, GError **error);
+
+G_END_DECLS
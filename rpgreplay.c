@@ -0,0 +1,271 @@
+#include "editor_page.h"
+#include "manifest.h"
+#include "trace.h"
+#include <glib.h>
+#include <gtk/gtk.h>
+
+#include <stdlib.h>
+
+/*
+ * Replays an editing session recorded with RPGEDITOR_TRACE against
+ * EditorPage, without a display and without waiting between events:
+ *
+ *   rpgreplay TRACE [WORKSPACE]
+ *
+ * The pages start out as saved in WORKSPACE, or empty. The idle work an edit
+ * queues, like turning a typed [[Name]] into a link, is run right after it
+ * and timed on its own.
+ */
+
+enum {
+  REPLAY_INSERT = 0,
+  REPLAY_DELETE,
+  REPLAY_IDLE,
+  REPLAY_N_KINDS
+};
+
+static const gchar *kind_names[REPLAY_N_KINDS] = {
+  [REPLAY_INSERT] = "insert",
+  [REPLAY_DELETE] = "delete",
+  [REPLAY_IDLE] = "idle",
+};
+
+#ifdef __GLIBC__
+/* Every allocation of the process goes through these, glibc only */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static guint64 n_allocs;
+static guint64 alloc_bytes;
+
+static void
+count_alloc(size_t size)
+{
+  __atomic_add_fetch(&n_allocs, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&alloc_bytes, size, __ATOMIC_RELAXED);
+}
+
+void *
+malloc(size_t size)
+{
+  count_alloc(size);
+  return __libc_malloc(size);
+}
+
+void *
+calloc(size_t n, size_t size)
+{
+  count_alloc(n * size);
+  return __libc_calloc(n, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+  count_alloc(size);
+  return __libc_realloc(ptr, size);
+}
+#endif
+
+static void
+page_created(G_GNUC_UNUSED EditorPage *page, G_GNUC_UNUSED gpointer user_data)
+{
+}
+
+/* Runs whatever is ready on the main context, -1 if there was nothing */
+static gint64
+run_idle(void)
+{
+  gint64 begin = g_get_monotonic_time();
+  gboolean ran = FALSE;
+
+  while (g_main_context_iteration(NULL, FALSE)) {
+    ran = TRUE;
+  }
+
+  return ran ? g_get_monotonic_time() - begin : -1;
+}
+
+static void
+fix_page(G_GNUC_UNUSED gpointer key,
+         gpointer value,
+         G_GNUC_UNUSED gpointer user_data)
+{
+  editor_page_fix_content(value);
+}
+
+static gboolean
+load(const gchar *dir, GHashTable *pages, GError **error)
+{
+  g_autoptr(Manifest) manifest = NULL;
+
+  manifest = manifest_load(dir, error);
+  if (manifest == NULL) {
+    return FALSE;
+  }
+
+  for (guint i = 0; i < manifest->entries->len; i++) {
+    ManifestEntry *entry = &g_array_index(manifest->entries, ManifestEntry, i);
+    gchar *filename = g_build_filename(dir, entry->file, NULL);
+    EditorPage *page;
+
+    page = editor_page_load(pages, filename, NULL, G_CALLBACK(page_created),
+                            NULL);
+    if (page != NULL) {
+      editor_page_set_id(page, entry->id);
+    }
+    g_free(filename);
+  }
+
+  g_hash_table_foreach(pages, fix_page, NULL);
+
+  /* Large pages finish loading before the clock starts */
+  run_idle();
+
+  return TRUE;
+}
+
+static gint
+compare_latency(gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64 *) a;
+  gint64 y = *(const gint64 *) b;
+
+  return (x > y) - (x < y);
+}
+
+static void
+report(const gchar *name, GArray *samples)
+{
+  gint64 *sorted = (gint64 *) samples->data;
+  guint n = samples->len;
+
+  if (n == 0) {
+    g_print("%-8s %8u\n", name, n);
+    return;
+  }
+
+  g_array_sort(samples, compare_latency);
+
+  /* Nearest rank, in microseconds */
+  g_print("%-8s %8u %8" G_GINT64_FORMAT " %8" G_GINT64_FORMAT
+          " %8" G_GINT64_FORMAT " %8" G_GINT64_FORMAT "\n",
+          name, n, sorted[(n * 50 + 99) / 100 - 1],
+          sorted[(n * 95 + 99) / 100 - 1], sorted[(n * 99 + 99) / 100 - 1],
+          sorted[n - 1]);
+}
+
+int
+main(int argc, char *argv[])
+{
+  g_autoptr(Trace) trace = NULL;
+  GArray *samples[REPLAY_N_KINDS];
+  GHashTable *pages;
+  EditorPage *page = NULL;
+  GError *lerr = NULL;
+  guint skipped = 0;
+  gint64 begin;
+  gint64 elapsed;
+#ifdef __GLIBC__
+  guint64 allocs;
+  guint64 bytes;
+#endif
+
+  if (argc < 2 || argc > 3) {
+    g_printerr("Usage: rpgreplay TRACE [WORKSPACE]\n");
+    return 2;
+  }
+
+  trace = trace_read(argv[1], &lerr);
+  if (trace == NULL) {
+    g_printerr("rpgreplay: %s\n", lerr->message);
+    g_clear_error(&lerr);
+    return 1;
+  }
+
+  pages = g_hash_table_new(g_str_hash, g_str_equal);
+  if (argc == 3 && !load(argv[2], pages, &lerr)) {
+    g_printerr("rpgreplay: %s\n", lerr->message);
+    g_clear_error(&lerr);
+    return 1;
+  }
+
+  for (guint i = 0; i < REPLAY_N_KINDS; i++) {
+    samples[i] = g_array_sized_new(FALSE, FALSE, sizeof(gint64),
+                                   trace->events->len);
+  }
+
+#ifdef __GLIBC__
+  allocs = n_allocs;
+  bytes = alloc_bytes;
+#endif
+  begin = g_get_monotonic_time();
+
+  for (guint i = 0; i < trace->events->len; i++) {
+    TraceEvent *event = &g_array_index(trace->events, TraceEvent, i);
+    GtkTextIter start;
+    GtkTextIter end;
+    gint64 latency;
+    gint chars;
+
+    if (event->type == TRACE_PAGE) {
+      page = g_hash_table_lookup(pages, event->text);
+      if (page == NULL) {
+        page = editor_page_new(event->text, pages, NULL,
+                               G_CALLBACK(page_created), NULL);
+      }
+      continue;
+    }
+
+    /* The trace does not match the pages it is replayed on */
+    chars = page != NULL ? gtk_text_buffer_get_char_count(page->content) : -1;
+    if (event->start < 0 || event->start > chars ||
+        (event->type == TRACE_DELETE &&
+         (event->end < event->start || event->end > chars))) {
+      skipped++;
+      continue;
+    }
+
+    gtk_text_buffer_get_iter_at_offset(page->content, &start, event->start);
+
+    latency = g_get_monotonic_time();
+    if (event->type == TRACE_INSERT) {
+      gtk_text_buffer_insert(page->content, &start, event->text, -1);
+    } else {
+      gtk_text_buffer_get_iter_at_offset(page->content, &end, event->end);
+      gtk_text_buffer_delete(page->content, &start, &end);
+    }
+    latency = g_get_monotonic_time() - latency;
+
+    g_array_append_val(samples[event->type == TRACE_INSERT ? REPLAY_INSERT
+                                                           : REPLAY_DELETE],
+                       latency);
+
+    latency = run_idle();
+    if (latency >= 0) {
+      g_array_append_val(samples[REPLAY_IDLE], latency);
+    }
+  }
+
+  elapsed = g_get_monotonic_time() - begin;
+#ifdef __GLIBC__
+  allocs = n_allocs - allocs;
+  bytes = alloc_bytes - bytes;
+#endif
+
+  g_print("events   %u (%u skipped)\n", trace->events->len, skipped);
+  g_print("elapsed  %.1f ms\n", elapsed / 1000.0);
+#ifdef __GLIBC__
+  g_print("allocs   %" G_GUINT64_FORMAT " (%" G_GUINT64_FORMAT " bytes)\n",
+          allocs, bytes);
+#endif
+  g_print("\n%-8s %8s %8s %8s %8s %8s\n", "us", "count", "p50", "p95", "p99",
+          "max");
+  for (guint i = 0; i < REPLAY_N_KINDS; i++) {
+    report(kind_names[i], samples[i]);
+    g_array_unref(samples[i]);
+  }
+
+  return 0;
+}
@@ -0,0 +1,254 @@
+#include "import.h"
+#include "linkgraph.h"
+#include "manifest.h"
+#include "page.h"
+#include "perf.h"
+#include "workspace.h"
+#include <gio/gio.h>
+#include <glib.h>
+
+/*
+ * Workspace jobs without a display, built on the core library only:
+ *
+ *   rpgtool stats DIR               pages and links, and the load time
+ *   rpgtool copy DIR DEST           saves the workspace in DIR to DEST
+ *   rpgtool convert DIR gzip|none   changes the page compression in place
+ *   rpgtool import SRC DEST         imports a tree of markdown files
+ */
+
+static void
+usage(void)
+{
+  g_printerr("Usage: rpgtool stats DIR\n"
+             "       rpgtool copy DIR DEST\n"
+             "       rpgtool convert DIR gzip|none\n"
+             "       rpgtool import SRC DEST\n");
+}
+
+static GPtrArray *
+load(const gchar *dir, ManifestCompression *compression, GError **error)
+{
+  GPtrArray *pages;
+  gint64 begin = perf_begin();
+
+  pages = workspace_load(dir, compression, error);
+  if (pages != NULL) {
+    g_print("load           %.1f ms\n",
+            (g_get_monotonic_time() - begin) / 1000.0);
+  }
+
+  return pages;
+}
+
+static gboolean
+save(const gchar *dir,
+     GPtrArray *pages,
+     ManifestCompression compression,
+     GError **error)
+{
+  gint64 begin = perf_begin();
+
+  if (!workspace_save(dir, pages, compression, error)) {
+    return FALSE;
+  }
+
+  g_print("save           %.1f ms\n",
+          (g_get_monotonic_time() - begin) / 1000.0);
+
+  return TRUE;
+}
+
+static gboolean
+stats(const gchar *dir, GError **error)
+{
+  g_autoptr(GPtrArray) pages = NULL;
+  g_autoptr(LinkGraph) graph = NULL;
+  g_autoptr(GPtrArray) stubs = NULL;
+  GHashTable *by_heading;
+  GList *list;
+  gsize bytes = 0;
+
+  pages = load(dir, NULL, error);
+  if (pages == NULL) {
+    return FALSE;
+  }
+
+  graph = link_graph_new();
+  stubs = g_ptr_array_new_with_free_func((GDestroyNotify) page_free);
+  by_heading = g_hash_table_new(g_str_hash, g_str_equal);
+
+  for (guint i = 0; i < pages->len; i++) {
+    Page *page = g_ptr_array_index(pages, i);
+
+    g_hash_table_insert(by_heading, page->heading, page);
+    link_graph_add_page(graph, page, FALSE);
+    bytes += page->body->len;
+  }
+
+  /* Links to missing pages make stubs, as in the editor */
+  for (guint i = 0; i < pages->len; i++) {
+    Page *page = g_ptr_array_index(pages, i);
+    g_autoptr(GPtrArray) links = page_links(page);
+
+    for (guint j = 0; j < links->len; j++) {
+      const gchar *name = g_ptr_array_index(links, j);
+      Page *target = g_hash_table_lookup(by_heading, name);
+
+      if (target == NULL) {
+        target = page_new(name);
+        g_ptr_array_add(stubs, target);
+        g_hash_table_insert(by_heading, target->heading, target);
+        link_graph_add_page(graph, target, TRUE);
+      }
+
+      link_graph_add_link(graph, page, target);
+    }
+  }
+
+  g_print("pages          %u\n", pages->len);
+  g_print("bytes          %" G_GSIZE_FORMAT "\n", bytes);
+  g_print("links          %u\n", link_graph_n_links(graph));
+
+  list = link_graph_stubs(graph);
+  g_print("stubs          %u\n", g_list_length(list));
+  g_list_free(list);
+
+  list = link_graph_orphans(graph);
+  g_print("orphans        %u\n", g_list_length(list));
+  g_list_free(list);
+
+  g_hash_table_unref(by_heading);
+
+  return TRUE;
+}
+
+static gboolean
+copy(const gchar *dir, const gchar *dest, GError **error)
+{
+  g_autoptr(GPtrArray) pages = NULL;
+  ManifestCompression compression;
+
+  pages = load(dir, &compression, error);
+
+  return pages != NULL && save(dest, pages, compression, error);
+}
+
+static gboolean
+convert(const gchar *dir, const gchar *name, GError **error)
+{
+  g_autoptr(GPtrArray) pages = NULL;
+  ManifestCompression compression;
+
+  if (g_str_equal(name, "gzip")) {
+    compression = MANIFEST_COMPRESSION_GZIP;
+  } else if (g_str_equal(name, "none")) {
+    compression = MANIFEST_COMPRESSION_NONE;
+  } else {
+    g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                "Unknown compression %s", name);
+    return FALSE;
+  }
+
+  pages = load(dir, NULL, error);
+
+  return pages != NULL && save(dir, pages, compression, error);
+}
+
+struct import_job {
+  GMainLoop *loop;
+  GPtrArray *files;
+  GError *error;
+};
+
+static void
+import_done(G_GNUC_UNUSED GObject *source_object,
+            GAsyncResult *res,
+            gpointer user_data)
+{
+  struct import_job *job = user_data;
+
+  job->files = import_vault_finish(res, &job->error);
+  g_main_loop_quit(job->loop);
+}
+
+/* Adds the pages to the workspace in dest, or makes a new one */
+static gboolean
+import(const gchar *src, const gchar *dest, GError **error)
+{
+  g_autoptr(GPtrArray) pages = NULL;
+  g_autoptr(GPtrArray) existing = NULL;
+  struct import_job job = { 0 };
+  ManifestCompression compression = MANIFEST_COMPRESSION_NONE;
+  GError *lerr = NULL;
+  gboolean ok = TRUE;
+
+  pages = workspace_load(dest, &compression, &lerr);
+  if (pages == NULL) {
+    if (!g_error_matches(lerr, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+      g_propagate_error(error, lerr);
+      return FALSE;
+    }
+    g_clear_error(&lerr);
+    pages = g_ptr_array_new_with_free_func((GDestroyNotify) page_free);
+  }
+
+  existing = g_ptr_array_new();
+  for (guint i = 0; i < pages->len; i++) {
+    g_ptr_array_add(existing, ((Page *) g_ptr_array_index(pages, i))->heading);
+  }
+  g_ptr_array_add(existing, NULL);
+
+  job.loop = g_main_loop_new(NULL, FALSE);
+  import_vault_async(src, (const gchar *const *) existing->pdata, NULL,
+                     import_done, &job);
+  g_main_loop_run(job.loop);
+  g_main_loop_unref(job.loop);
+
+  if (job.files == NULL) {
+    g_propagate_error(error, job.error);
+    return FALSE;
+  }
+
+  for (guint i = 0; ok && i < job.files->len; i++) {
+    GString *file = g_ptr_array_index(job.files, i);
+    Page *page = page_parse(file->str, file->len, error);
+
+    ok = page != NULL;
+    if (ok) {
+      g_ptr_array_add(pages, page);
+    }
+  }
+  g_ptr_array_unref(job.files);
+
+  g_print("imported       %u pages\n", pages->len - (existing->len - 1));
+
+  return ok && save(dest, pages, compression, error);
+}
+
+int
+main(int argc, char *argv[])
+{
+  GError *lerr = NULL;
+  gboolean ok;
+
+  if (argc == 3 && g_str_equal(argv[1], "stats")) {
+    ok = stats(argv[2], &lerr);
+  } else if (argc == 4 && g_str_equal(argv[1], "copy")) {
+    ok = copy(argv[2], argv[3], &lerr);
+  } else if (argc == 4 && g_str_equal(argv[1], "convert")) {
+    ok = convert(argv[2], argv[3], &lerr);
+  } else if (argc == 4 && g_str_equal(argv[1], "import")) {
+    ok = import(argv[2], argv[3], &lerr);
+  } else {
+    usage();
+    return 2;
+  }
+
+  if (!ok) {
+    g_printerr("rpgtool: %s\n", lerr->message);
+    g_clear_error(&lerr);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,294 @@
+#include "search.h"
+#include "markdown.h"
+#include <gio/gio.h>
+#include <glib.h>
+
+#include <string.h>
+
+/* Bytes of context kept on either side of a match */
+#define CONTEXT_BYTES 32
+
+struct search_item {
+  SearchText *text;
+  GPtrArray *matches;
+  /* Where the character offsets were last counted up to */
+  gsize counted_byte;
+  gint counted_chars;
+};
+
+struct search_ctx {
+  GPtrArray *texts;
+  gchar *pattern;
+  gchar *replacement;
+  SearchFlags flags;
+  GRegex *regex;
+  GCancellable *cancellable;
+  struct search_item *items;
+};
+
+SearchText *
+search_text_new(gpointer page, gchar *text, gboolean markdown)
+{
+  SearchText *search_text = g_malloc0(sizeof(*search_text));
+
+  search_text->page = page;
+  search_text->text = text;
+  search_text->markdown = markdown;
+
+  return search_text;
+}
+
+void
+search_text_free(SearchText *text)
+{
+  g_free(text->text);
+  g_free(text);
+}
+
+static void
+match_free(gpointer data)
+{
+  SearchMatch *match = data;
+
+  g_free(match->text);
+  g_free(match->replacement);
+  g_free(match->before);
+  g_free(match->after);
+  g_free(match);
+}
+
+static void
+search_ctx_free(gpointer data)
+{
+  struct search_ctx *ctx = data;
+
+  for (guint i = 0; ctx->items != NULL && i < ctx->texts->len; i++) {
+    g_clear_pointer(&ctx->items[i].matches, g_ptr_array_unref);
+  }
+  g_free(ctx->items);
+  g_ptr_array_unref(ctx->texts);
+  g_clear_pointer(&ctx->regex, g_regex_unref);
+  g_free(ctx->pattern);
+  g_free(ctx->replacement);
+  g_free(ctx);
+}
+
+/* The rest of the line before start, at most CONTEXT_BYTES of it */
+static gchar *
+context_before(const gchar *text, gsize start)
+{
+  const gchar *end = text + start;
+  const gchar *begin = end;
+
+  while (begin > text && begin[-1] != '\n' && end - begin < CONTEXT_BYTES) {
+    begin = g_utf8_find_prev_char(text, begin);
+  }
+
+  return g_strndup(begin, end - begin);
+}
+
+static gchar *
+context_after(const gchar *text, gsize end)
+{
+  const gchar *begin = text + end;
+  const gchar *stop = begin;
+
+  while (*stop != '\0' && *stop != '\n' && stop - begin < CONTEXT_BYTES) {
+    stop = g_utf8_next_char(stop);
+  }
+
+  return g_strndup(begin, stop - begin);
+}
+
+static gint
+char_offset(struct search_item *item, gsize byte)
+{
+  const gchar *text = item->text->text;
+
+  /* Matches come in order, so counting picks up where it left off */
+  item->counted_chars += g_utf8_strlen(text + item->counted_byte,
+                                       byte - item->counted_byte);
+  item->counted_byte = byte;
+
+  return item->counted_chars;
+}
+
+static void
+match_range(struct search_ctx *ctx,
+            struct search_item *item,
+            gsize from,
+            gsize to)
+{
+  const gchar *text = item->text->text;
+  GMatchInfo *info = NULL;
+
+  g_regex_match_full(ctx->regex, text, to, from, 0, &info, NULL);
+
+  while (g_match_info_matches(info)) {
+    SearchMatch *match;
+    gint start;
+    gint end;
+
+    g_match_info_fetch_pos(info, 0, &start, &end);
+
+    /* Empty matches have nothing to replace */
+    if (end > start) {
+      match = g_malloc0(sizeof(*match));
+      match->page = item->text->page;
+      match->markdown = item->text->markdown;
+      match->start_byte = start;
+      match->end_byte = end;
+      match->start = char_offset(item, start);
+      match->end = char_offset(item, end);
+      match->text = g_strndup(text + start, end - start);
+      match->before = context_before(text, start);
+      match->after = context_after(text, end);
+
+      if (ctx->flags & SEARCH_REGEX) {
+        match->replacement = g_match_info_expand_references(info,
+                                                            ctx->replacement,
+                                                            NULL);
+      }
+      if (match->replacement == NULL) {
+        match->replacement = g_strdup(ctx->replacement);
+      }
+
+      g_ptr_array_add(item->matches, match);
+    }
+
+    g_match_info_next(info, NULL);
+  }
+
+  g_match_info_free(info);
+}
+
+static void
+search_item(gpointer data, gpointer user_data)
+{
+  struct search_item *item = data;
+  struct search_ctx *ctx = g_task_get_task_data(G_TASK(user_data));
+  const gchar *text = item->text->text;
+  gsize len = strlen(text);
+  GArray *tokens;
+
+  item->matches = g_ptr_array_new_with_free_func(match_free);
+
+  if (g_cancellable_is_cancelled(ctx->cancellable)) {
+    return;
+  }
+
+  if (!item->text->markdown) {
+    match_range(ctx, item, 0, len);
+    return;
+  }
+
+  /* Markers and links are not text, replacing in them would change the
+   * markup or the page linked to */
+  tokens = md_tokenize(text, len, MD_PARSE_DEFAULT);
+  for (guint i = 0; i < tokens->len; i++) {
+    MdToken *token = &g_array_index(tokens, MdToken, i);
+    gsize end = token->offset + token->len;
+
+    if (token->type == MD_TOKEN_TEXT && end > item->text->from) {
+      match_range(ctx, item, MAX(token->offset, item->text->from), end);
+    }
+  }
+  g_array_unref(tokens);
+}
+
+static void
+search_thread(GTask *task,
+              G_GNUC_UNUSED gpointer source_object,
+              gpointer task_data,
+              GCancellable *cancellable)
+{
+  struct search_ctx *ctx = task_data;
+  GError *lerr = NULL;
+  GThreadPool *pool;
+  GPtrArray *matches;
+  gchar *pattern;
+
+  pattern = ctx->flags & SEARCH_REGEX ? g_strdup(ctx->pattern)
+                                      : g_regex_escape_string(ctx->pattern,
+                                                              -1);
+  ctx->regex = g_regex_new(pattern,
+                           G_REGEX_MULTILINE |
+                             (ctx->flags & SEARCH_CASELESS ? G_REGEX_CASELESS
+                                                           : 0),
+                           0, &lerr);
+  g_free(pattern);
+
+  if (ctx->regex == NULL ||
+      ((ctx->flags & SEARCH_REGEX) &&
+       !g_regex_check_replacement(ctx->replacement, NULL, &lerr))) {
+    g_task_return_error(task, lerr);
+    return;
+  }
+
+  ctx->cancellable = cancellable;
+  ctx->items = g_new0(struct search_item, ctx->texts->len);
+
+  pool = g_thread_pool_new(search_item, task, g_get_num_processors(), FALSE,
+                           &lerr);
+  if (pool == NULL) {
+    g_task_return_error(task, lerr);
+    return;
+  }
+
+  for (guint i = 0; i < ctx->texts->len; i++) {
+    ctx->items[i].text = g_ptr_array_index(ctx->texts, i);
+    g_thread_pool_push(pool, &ctx->items[i], NULL);
+  }
+
+  /* Waits for all texts to be searched */
+  g_thread_pool_free(pool, FALSE, TRUE);
+
+  if (g_task_return_error_if_cancelled(task)) {
+    return;
+  }
+
+  matches = g_ptr_array_new_with_free_func(match_free);
+  for (guint i = 0; i < ctx->texts->len; i++) {
+    g_ptr_array_extend_and_steal(matches,
+                                 g_steal_pointer(&ctx->items[i].matches));
+  }
+
+  g_task_return_pointer(task, matches, (GDestroyNotify) g_ptr_array_unref);
+}
+
+void
+search_async(GPtrArray *texts,
+             const gchar *pattern,
+             const gchar *replacement,
+             SearchFlags flags,
+             GCancellable *cancellable,
+             GAsyncReadyCallback callback,
+             gpointer user_data)
+{
+  struct search_ctx *ctx;
+  GTask *task;
+
+  g_assert(texts);
+  g_assert(pattern);
+
+  ctx = g_malloc0(sizeof(*ctx));
+  ctx->texts = texts;
+  ctx->pattern = g_strdup(pattern);
+  ctx->replacement = g_strdup(replacement != NULL ? replacement : "");
+  ctx->flags = flags;
+
+  task = g_task_new(NULL, cancellable, callback, user_data);
+  g_task_set_source_tag(task, search_async);
+  g_task_set_task_data(task, ctx, search_ctx_free);
+
+  g_task_run_in_thread(task, search_thread);
+  g_object_unref(task);
+}
+
+GPtrArray *
+search_finish(GAsyncResult *res, GError **error)
+{
+  g_return_val_if_fail(g_task_is_valid(res, NULL), NULL);
+
+  return g_task_propagate_pointer(G_TASK(res), error);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+  SEARCH_DEFAULT = 0,
+  /* pattern is a regular expression and the replacement may use \0 to \9 */
+  SEARCH_REGEX = 1 << 0,
+  SEARCH_CASELESS = 1 << 1,
+} SearchFlags;
+
+/*
+ * A text to search. Plain texts are matched anywhere, markdown texts only
+ * outside of style markers and [[links]].
+ */
+typedef struct {
+  gpointer page;
+  gchar *text;
+  gboolean markdown;
+  /* Markdown before this byte is only read, so that blocks opened in it
+   * are known */
+  gsize from;
+} SearchText;
+
+/*
+ * A match in one of the texts, as a byte range and as a character range.
+ * before and after are the rest of the line around it, cut to a few words,
+ * for previews.
+ */
+typedef struct {
+  gpointer page;
+  /* Of the SearchText it is in */
+  gboolean markdown;
+  gsize start_byte;
+  gsize end_byte;
+  gint start;
+  gint end;
+  gchar *text;
+  gchar *replacement;
+  gchar *before;
+  gchar *after;
+} SearchMatch;
+
+/* Takes ownership of text */
+SearchText *search_text_new(gpointer page, gchar *text, gboolean markdown);
+
+void search_text_free(SearchText *text);
+
+/*
+ * Finds pattern in every text, concurrently on a thread pool. Takes
+ * ownership of texts, a GPtrArray of SearchText.
+ */
+void search_async(GPtrArray *texts,
+                  const gchar *pattern,
+                  const gchar *replacement,
+                  SearchFlags flags,
+                  GCancellable *cancellable,
+                  GAsyncReadyCallback callback,
+                  gpointer user_data);
+
+/* The matches as a GPtrArray of SearchMatch, in text order and by offset
+ * within a text */
+GPtrArray *search_finish(GAsyncResult *res, GError **error);
+
+G_END_DECLS
@@ -0,0 +1,265 @@
+#include "session.h"
+#include "editor_page.h"
+#include "linkgraph.h"
+#include "manifest.h"
+#include "perf.h"
+#include <gio/gio.h>
+#include <glib.h>
+#include <gtk/gtk.h>
+
+#include <stdlib.h>
+
+#define DEFAULT_WARM_SESSIONS 2
+
+/* Closed sessions, most recently closed first */
+static GQueue warm = G_QUEUE_INIT;
+
+/* Modification time of the manifest in path in microseconds, 0 if there is
+ * none */
+static gint64
+manifest_mtime(const gchar *path)
+{
+  const gchar *names[] = { MANIFEST_FILE, MANIFEST_LEGACY_FILE };
+  gint64 mtime = 0;
+
+  for (guint i = 0; mtime == 0 && i < G_N_ELEMENTS(names); i++) {
+    gchar *filename = g_build_filename(path, names[i], NULL);
+    GFile *file = g_file_new_for_path(filename);
+    GFileInfo *info;
+
+    info = g_file_query_info(file, G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+                                   G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+                             G_FILE_QUERY_INFO_NONE, NULL, NULL);
+    if (info != NULL) {
+      GDateTime *time = g_file_info_get_modification_date_time(info);
+
+      if (time != NULL) {
+        mtime = g_date_time_to_unix(time) * G_USEC_PER_SEC +
+                g_date_time_get_microsecond(time);
+        g_date_time_unref(time);
+      }
+      g_object_unref(info);
+    }
+
+    g_object_unref(file);
+    g_free(filename);
+  }
+
+  return mtime;
+}
+
+static guint
+max_warm(void)
+{
+  const gchar *max = g_getenv(SESSION_WARM_ENV);
+
+  return max != NULL ? MAX(atoi(max), 0) : DEFAULT_WARM_SESSIONS;
+}
+
+Session *
+session_new(const gchar *path)
+{
+  Session *self = g_malloc0(sizeof(*self));
+
+  self->path = g_strdup(path);
+  self->pages = g_hash_table_new(g_str_hash, g_str_equal);
+  self->pages_list = g_queue_new();
+  self->owned = g_ptr_array_new_with_free_func(g_object_unref);
+  self->provider = gtk_css_provider_new();
+  perf_count(PERF_CSS_PROVIDERS, 1);
+
+  return self;
+}
+
+void
+session_free(Session *self)
+{
+  GHashTableIter iter;
+  gpointer key;
+
+  if (self == NULL) {
+    return;
+  }
+
+  g_message("Closing workspace %s, %u pages",
+            self->path != NULL ? self->path : "(unsaved)", self->owned->len);
+
+  /* Once every page is out the graphs hold nothing of the session */
+  for (guint i = 0; i < self->owned->len; i++) {
+    EditorPage *page = g_ptr_array_index(self->owned, i);
+
+    link_graph_remove_page(editor_page_links(), page);
+    link_graph_remove_page(editor_page_embeds(), page);
+    page->removed = TRUE;
+    page->pages = NULL;
+  }
+  g_ptr_array_unref(self->owned);
+
+  g_hash_table_iter_init(&iter, self->pages);
+  while (g_hash_table_iter_next(&iter, &key, NULL)) {
+    g_free(key);
+  }
+  g_hash_table_unref(self->pages);
+  g_queue_free(self->pages_list);
+
+  g_object_unref(self->provider);
+  perf_count(PERF_CSS_PROVIDERS, -1);
+
+  g_free(self->path);
+  g_free(self);
+}
+
+void
+session_add_page(Session *self, EditorPage *page)
+{
+  g_ptr_array_add(self->owned, page);
+}
+
+void
+session_set_style(Session *self, const gchar *css)
+{
+  gtk_css_provider_load_from_string(self->provider, css);
+}
+
+gboolean
+session_modified(Session *self)
+{
+  for (guint i = 0; i < self->owned->len; i++) {
+    EditorPage *page = g_ptr_array_index(self->owned, i);
+
+    if (!page->removed && gtk_text_buffer_get_modified(page->content)) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+void
+session_saved(Session *self, const gchar *path)
+{
+  if (path != self->path) {
+    g_free(self->path);
+    self->path = g_strdup(path);
+  }
+  self->mtime = manifest_mtime(path);
+}
+
+void
+session_show(Session *self, GtkBox *box)
+{
+  for (GList *iter = self->pages_list->head; iter != NULL;
+       iter = iter->next) {
+    gtk_box_append(box, editor_page_button(iter->data));
+  }
+
+  gtk_style_context_add_provider_for_display(gdk_display_get_default(),
+                                             GTK_STYLE_PROVIDER(self->provider),
+                                             GTK_STYLE_PROVIDER_PRIORITY_USER);
+}
+
+void
+session_hide(Session *self, GtkBox *box)
+{
+  /* The pages keep their buttons for the next show */
+  for (GList *iter = self->pages_list->head; iter != NULL;
+       iter = iter->next) {
+    gtk_box_remove(box, EDITOR_PAGE(iter->data)->page_button);
+  }
+
+  gtk_style_context_remove_provider_for_display(
+    gdk_display_get_default(), GTK_STYLE_PROVIDER(self->provider));
+}
+
+static gint
+same_path(gconstpointer a, gconstpointer b)
+{
+  return g_strcmp0(((const Session *) a)->path, b);
+}
+
+void
+session_stash(Session *self)
+{
+  guint max = max_warm();
+
+  if (self->path == NULL) {
+    if (session_modified(self)) {
+      g_warning("Dropping a workspace that was never saved");
+    }
+    session_free(self);
+    return;
+  }
+
+  session_forget(self->path);
+  g_queue_push_head(&warm, self);
+
+  /* Unsaved changes are not thrown away, their session stays past the
+   * maximum until it is opened again */
+  for (GList *iter = warm.tail; iter != NULL && warm.length > max;) {
+    GList *prev = iter->prev;
+
+    if (!session_modified(iter->data)) {
+      session_free(iter->data);
+      g_queue_delete_link(&warm, iter);
+    }
+    iter = prev;
+  }
+}
+
+Session *
+session_take(const gchar *path)
+{
+  GList *link = g_queue_find_custom(&warm, path, same_path);
+  Session *self;
+
+  if (link == NULL) {
+    return NULL;
+  }
+
+  self = link->data;
+  g_queue_delete_link(&warm, link);
+
+  if (self->mtime != manifest_mtime(path) && !session_modified(self)) {
+    g_message("%s changed on disk, loading it again", path);
+    session_free(self);
+    return NULL;
+  }
+
+  return self;
+}
+
+Session *
+session_peek(const gchar *path)
+{
+  GList *link = g_queue_find_custom(&warm, path, same_path);
+
+  return link != NULL ? link->data : NULL;
+}
+
+void
+session_forget(const gchar *path)
+{
+  GList *link = g_queue_find_custom(&warm, path, same_path);
+
+  if (link != NULL) {
+    session_free(link->data);
+    g_queue_delete_link(&warm, link);
+  }
+}
+
+GList *
+session_filter(Session *self, GList *pages)
+{
+  GList *iter = pages;
+
+  while (iter != NULL) {
+    GList *next = iter->next;
+
+    if (EDITOR_PAGE(iter->data)->pages != self->pages) {
+      pages = g_list_delete_link(pages, iter);
+    }
+    iter = next;
+  }
+
+  return pages;
+}
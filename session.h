@@ -0,0 +1,80 @@
+#pragma once
+
+#include <gtk/gtk.h>
+
+#include "editor_page.h"
+#include "manifest.h"
+
+G_BEGIN_DECLS
+
+/* Number of closed workspaces kept warm, 2 if unset */
+#define SESSION_WARM_ENV "RPGEDITOR_WARM_SESSIONS"
+
+/*
+ * An open workspace: its pages, their sidebar order and the style of their
+ * buttons. One session is shown at a time. A closed session is kept warm
+ * so that switching back to it skips loading, past the maximum the least
+ * recently closed one is freed along with all its pages.
+ */
+typedef struct {
+  /* NULL until saved */
+  gchar *path;
+  /* heading -> EditorPage, the pages member of every page */
+  GHashTable *pages;
+  /* Sidebar order */
+  GQueue *pages_list;
+  /* Every page made in the session, removed ones too. Holds the reference
+   * the page was created with. */
+  GPtrArray *owned;
+  GtkCssProvider *provider;
+  ManifestCompression compression;
+  /* The page shown when the session was closed, and the character offset
+   * at the top of its view */
+  EditorPage *current;
+  gint top;
+  /* Of the manifest when the session was loaded or saved */
+  gint64 mtime;
+} Session;
+
+Session *session_new(const gchar *path);
+
+/* Releases the pages of the session and takes them out of the link graphs */
+void session_free(Session *self);
+
+/* Takes over the reference page was created with */
+void session_add_page(Session *self, EditorPage *page);
+
+/* Loads css into the style of the session */
+void session_set_style(Session *self, const gchar *css);
+
+/* Whether any page has changes that are not saved */
+gboolean session_modified(Session *self);
+
+/* Records that the session is on disk at path as of now */
+void session_saved(Session *self, const gchar *path);
+
+/* Puts the buttons of the pages in box and the style on the display */
+void session_show(Session *self, GtkBox *box);
+
+/* Undoes session_show() */
+void session_hide(Session *self, GtkBox *box);
+
+/* Keeps a closed session warm. Sessions that were never saved can not be
+ * opened again and are freed. */
+void session_stash(Session *self);
+
+/* The warm session of path, or NULL. A session that is out of date with
+ * the workspace on disk is freed unless it has unsaved changes. */
+Session *session_take(const gchar *path);
+
+/* The warm session of path without taking it, or NULL */
+Session *session_peek(const gchar *path);
+
+/* Frees the warm session of path, if any */
+void session_forget(const gchar *path);
+
+/* The pages of the list that belong to the session, frees the rest of the
+ * list */
+GList *session_filter(Session *self, GList *pages);
+
+G_END_DECLS
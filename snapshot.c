@@ -0,0 +1,385 @@
+#include "snapshot.h"
+#include "manifest.h"
+#include "workspace.h"
+#include <gio/gio.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <errno.h>
+#include <string.h>
+
+static gchar *
+object_path(const gchar *base_path, const gchar *hash)
+{
+  gchar prefix[3] = { hash[0], hash[1], '\0' };
+
+  return g_build_filename(base_path, SNAPSHOT_DIR, SNAPSHOT_OBJECTS, prefix,
+                          hash + 2, NULL);
+}
+
+static gboolean
+valid_hash(const gchar *hash)
+{
+  if (hash == NULL || strlen(hash) != 64) {
+    return FALSE;
+  }
+
+  for (const gchar *iter = hash; *iter != '\0'; iter++) {
+    if (!g_ascii_isxdigit(*iter)) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+static gboolean
+make_parent(const gchar *path, GError **error)
+{
+  gchar *dir = g_path_get_dirname(path);
+  gboolean ok = TRUE;
+
+  if (g_mkdir_with_parents(dir, 0755) != 0) {
+    g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                "Could not create %s: %s", dir, g_strerror(errno));
+    ok = FALSE;
+  }
+  g_free(dir);
+
+  return ok;
+}
+
+/*
+ * Copies from into to, through converter if given. to is replaced
+ * atomically, so an interrupted copy never leaves a truncated object.
+ */
+static gboolean
+copy_file(const gchar *from,
+          const gchar *to,
+          GConverter *converter,
+          GError **error)
+{
+  GFile *src;
+  GFile *dest;
+  GFileInputStream *in;
+  GFileOutputStream *out;
+  GOutputStream *stream;
+  gboolean ok;
+
+  src = g_file_new_for_path(from);
+  dest = g_file_new_for_path(to);
+
+  in = g_file_read(src, NULL, error);
+  if (in == NULL) {
+    g_object_unref(src);
+    g_object_unref(dest);
+    return FALSE;
+  }
+
+  out = g_file_replace(dest, NULL, FALSE, G_FILE_CREATE_NONE, NULL, error);
+  if (out == NULL) {
+    g_object_unref(in);
+    g_object_unref(src);
+    g_object_unref(dest);
+    return FALSE;
+  }
+
+  if (converter != NULL) {
+    stream = g_converter_output_stream_new(G_OUTPUT_STREAM(out), converter);
+  } else {
+    stream = g_object_ref(G_OUTPUT_STREAM(out));
+  }
+
+  ok = g_output_stream_splice(stream, G_INPUT_STREAM(in),
+                              G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
+                                G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+                              NULL, error) >= 0;
+
+  if (!ok && !g_output_stream_is_closed(G_OUTPUT_STREAM(out))) {
+    /* Closing through a cancelled cancellable keeps the old file */
+    GCancellable *cancel = g_cancellable_new();
+
+    g_cancellable_cancel(cancel);
+    g_output_stream_close(G_OUTPUT_STREAM(out), cancel, NULL);
+    g_object_unref(cancel);
+  }
+
+  g_object_unref(stream);
+  g_object_unref(out);
+  g_object_unref(in);
+  g_object_unref(src);
+  g_object_unref(dest);
+
+  return ok;
+}
+
+static gboolean
+store_object(const gchar *base_path,
+             const ManifestEntry *entry,
+             GError **error)
+{
+  gchar *object;
+  gchar *page;
+  gboolean ok;
+
+  object = object_path(base_path, entry->hash);
+
+  /* Objects are immutable, an unchanged page is already stored */
+  if (g_file_test(object, G_FILE_TEST_EXISTS)) {
+    g_free(object);
+    return TRUE;
+  }
+
+  page = g_build_filename(base_path, entry->file, NULL);
+
+  ok = make_parent(object, error);
+  if (ok && g_str_has_suffix(entry->file, ".gz")) {
+    ok = copy_file(page, object, NULL, error);
+  } else if (ok) {
+    GConverter *compressor;
+
+    compressor = G_CONVERTER(g_zlib_compressor_new(
+      G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1));
+    ok = copy_file(page, object, compressor, error);
+    g_object_unref(compressor);
+  }
+
+  g_free(page);
+  g_free(object);
+
+  return ok;
+}
+
+/* Snapshot names sort by time, returns the last one or NULL */
+static gchar *
+latest_snapshot(const gchar *dir_path)
+{
+  const gchar *name;
+  gchar *latest = NULL;
+  GDir *dir;
+
+  dir = g_dir_open(dir_path, 0, NULL);
+  if (dir == NULL) {
+    return NULL;
+  }
+
+  while ((name = g_dir_read_name(dir)) != NULL) {
+    if (g_str_has_suffix(name, SNAPSHOT_SUFFIX) &&
+        (latest == NULL || strcmp(name, latest) > 0)) {
+      g_free(latest);
+      latest = g_strdup(name);
+    }
+  }
+
+  g_dir_close(dir);
+
+  return latest;
+}
+
+static gboolean
+same_as_latest(const gchar *dir_path, GString *manifest)
+{
+  gchar *latest;
+  gchar *path;
+  gchar *data = NULL;
+  gsize len = 0;
+  gboolean same;
+
+  latest = latest_snapshot(dir_path);
+  if (latest == NULL) {
+    return FALSE;
+  }
+
+  path = g_build_filename(dir_path, latest, NULL);
+  same = g_file_get_contents(path, &data, &len, NULL) &&
+         len == manifest->len && memcmp(data, manifest->str, len) == 0;
+
+  g_free(data);
+  g_free(path);
+  g_free(latest);
+
+  return same;
+}
+
+gboolean
+snapshot_take(const gchar *base_path, GString *manifest, GError **error)
+{
+  g_autoptr(Manifest) parsed = NULL;
+  GDateTime *now;
+  gchar *dir_path;
+  gchar *stamp;
+  gchar *path;
+  gboolean ok = TRUE;
+
+  dir_path = g_build_filename(base_path, SNAPSHOT_DIR, NULL);
+
+  if (same_as_latest(dir_path, manifest)) {
+    g_free(dir_path);
+    return TRUE;
+  }
+
+  parsed = manifest_parse(g_strndup(manifest->str, manifest->len),
+                          manifest->len, error);
+  if (parsed == NULL) {
+    g_free(dir_path);
+    return FALSE;
+  }
+
+  /* Objects first, a snapshot never refers to a missing object */
+  for (guint i = 0; ok && i < parsed->entries->len; i++) {
+    ManifestEntry *entry = &g_array_index(parsed->entries, ManifestEntry, i);
+
+    if (!valid_hash(entry->hash)) {
+      g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                  "No hash for %s in the manifest", entry->file);
+      ok = FALSE;
+      break;
+    }
+
+    ok = store_object(base_path, entry, error);
+  }
+
+  if (!ok) {
+    g_free(dir_path);
+    return FALSE;
+  }
+
+  now = g_date_time_new_now_utc();
+  stamp = g_date_time_format(now, "%Y%m%dT%H%M%S");
+  path = g_strdup_printf("%s" G_DIR_SEPARATOR_S "%s-%06d" SNAPSHOT_SUFFIX,
+                         dir_path, stamp, g_date_time_get_microsecond(now));
+
+  ok = g_file_set_contents(path, manifest->str, manifest->len, error);
+
+  g_free(path);
+  g_free(stamp);
+  g_date_time_unref(now);
+  g_free(dir_path);
+
+  return ok;
+}
+
+/* Writes the page of entry to a free slot of commit, as file */
+static gboolean
+restore_page(WorkspaceCommit *commit,
+             const gchar *base_path,
+             const ManifestEntry *entry,
+             gchar **file,
+             GError **error)
+{
+  GConverter *decompressor;
+  GFileInputStream *in;
+  GInputStream *stream;
+  GOutputStream *out;
+  GFile *object;
+  gchar *path;
+  gchar *name;
+  gboolean ok;
+
+  path = object_path(base_path, entry->hash);
+  object = g_file_new_for_path(path);
+  in = g_file_read(object, NULL, error);
+  g_object_unref(object);
+  g_free(path);
+  if (in == NULL) {
+    return FALSE;
+  }
+
+  name = g_str_to_ascii(entry->heading != NULL ? entry->heading : "", NULL);
+  out = workspace_commit_open(commit, name, file, error);
+  g_free(name);
+  if (out == NULL) {
+    g_object_unref(in);
+    return FALSE;
+  }
+
+  /* Objects are gzip, the slot compresses again if the workspace is */
+  decompressor = G_CONVERTER(g_zlib_decompressor_new(
+    G_ZLIB_COMPRESSOR_FORMAT_GZIP));
+  stream = g_converter_input_stream_new(G_INPUT_STREAM(in), decompressor);
+
+  ok = g_output_stream_splice(out, stream,
+                              G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
+                                G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+                              NULL, error) >= 0;
+
+  g_object_unref(stream);
+  g_object_unref(decompressor);
+  g_object_unref(out);
+  g_object_unref(in);
+
+  return ok;
+}
+
+gboolean
+snapshot_restore(const gchar *base_path, const gchar *name, GError **error)
+{
+  g_autoptr(Manifest) snapshot = NULL;
+  g_autoptr(WorkspaceCommit) commit = NULL;
+  gchar *path;
+  gchar *data;
+  gsize len;
+  gboolean ok = TRUE;
+
+  path = g_build_filename(base_path, SNAPSHOT_DIR, name, NULL);
+  if (!g_file_get_contents(path, &data, &len, error)) {
+    g_free(path);
+    return FALSE;
+  }
+  g_free(path);
+
+  snapshot = manifest_parse(data, len, error);
+  if (snapshot == NULL) {
+    return FALSE;
+  }
+
+  for (guint i = 0; i < snapshot->entries->len; i++) {
+    ManifestEntry *entry = &g_array_index(snapshot->entries, ManifestEntry, i);
+    gchar *object;
+    gboolean found;
+
+    if (!valid_hash(entry->hash)) {
+      g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                  "No hash for %s in snapshot %s", entry->file, name);
+      return FALSE;
+    }
+
+    object = object_path(base_path, entry->hash);
+    found = g_file_test(object, G_FILE_TEST_EXISTS);
+    g_free(object);
+
+    if (!found) {
+      g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_NOENT,
+                  "Page %s of snapshot %s is missing", entry->file, name);
+      return FALSE;
+    }
+  }
+
+  /* Restored like a save, the live pages stay until the manifest swap */
+  commit = workspace_commit_begin(base_path, snapshot->compression, error);
+  if (commit == NULL) {
+    return FALSE;
+  }
+
+  for (guint i = 0; ok && i < snapshot->entries->len; i++) {
+    ManifestEntry entry = g_array_index(snapshot->entries, ManifestEntry, i);
+    const ManifestEntry *live;
+    gchar *file = NULL;
+
+    /* A page that is the same as in the snapshot keeps its file */
+    live = workspace_commit_find(commit, entry.id, entry.heading);
+    if (live != NULL && g_str_equal(live->hash, entry.hash)) {
+      entry.file = live->file;
+    } else {
+      ok = restore_page(commit, base_path, &entry, &file, error);
+      entry.file = file;
+    }
+
+    if (ok) {
+      workspace_commit_add(commit, &entry);
+    }
+    g_free(file);
+  }
+
+  return ok && workspace_commit_finish(commit, error);
+}
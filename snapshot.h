@@ -0,0 +1,34 @@
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define SNAPSHOT_DIR ".snapshots"
+#define SNAPSHOT_OBJECTS "objects"
+#define SNAPSHOT_SUFFIX ".tab"
+
+/*
+ * Workspace history, kept in base_path/.snapshots:
+ *
+ *   objects/ab/cdef...   gzip page bodies, named by the SHA-256 of the page
+ *   <time>.tab           the workspace manifest at that time
+ *
+ * Page bodies are shared between snapshots, so a snapshot costs its
+ * manifest plus the pages that changed since any earlier snapshot.
+ */
+
+/* Records the workspace just saved with manifest in base_path. Nothing is
+ * written if it is identical to the latest snapshot. */
+gboolean snapshot_take(const gchar *base_path,
+                       GString *manifest,
+                       GError **error);
+
+/* Replaces the pages in base_path with those of the snapshot file name (as
+ * found in SNAPSHOT_DIR). Committed like a save, the current state is left
+ * alone if any page of the snapshot is missing or can not be written. */
+gboolean snapshot_restore(const gchar *base_path,
+                          const gchar *name,
+                          GError **error);
+
+G_END_DECLS
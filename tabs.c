@@ -0,0 +1,227 @@
+#include "tabs.h"
+#include "editor_page.h"
+#include <adwaita.h>
+#include <glib.h>
+#include <gtk/gtk.h>
+
+#include <stdlib.h>
+
+#define DEFAULT_MAX_TABS 8
+
+struct tabs {
+  AdwTabView *view;
+  /* page -> its AdwTabPage */
+  GHashTable *pages;
+  /* Open pages, most recently shown first */
+  GQueue recent;
+  guint max;
+  TabsViewCreated created;
+  TabsSelected selected;
+  gpointer user_data;
+  /* Set while tabs_show() selects, which is not the user's choice */
+  gboolean selecting;
+  /* Set while tabs_clear() closes everything */
+  gboolean clearing;
+};
+
+static void
+tabs_free(gpointer data)
+{
+  struct tabs *tabs = data;
+
+  g_hash_table_unref(tabs->pages);
+  g_queue_clear(&tabs->recent);
+  g_free(tabs);
+}
+
+static EditorPage *
+tab_page(AdwTabPage *tab)
+{
+  return g_object_get_data(G_OBJECT(adw_tab_page_get_child(tab)), "page");
+}
+
+static void
+heading_changed(EditorPage *page,
+                G_GNUC_UNUSED GParamSpec *pspec,
+                gpointer user_data)
+{
+  adw_tab_page_set_title(ADW_TAB_PAGE(user_data), page->heading);
+}
+
+static void
+touch(struct tabs *tabs, EditorPage *page)
+{
+  g_queue_remove(&tabs->recent, page);
+  g_queue_push_head(&tabs->recent, page);
+}
+
+/* The last tab stays, unless its page is gone */
+static gboolean
+close_page(AdwTabView *view, AdwTabPage *tab, gpointer user_data)
+{
+  struct tabs *tabs = user_data;
+
+  if (adw_tab_view_get_n_pages(view) == 1 && !tab_page(tab)->removed &&
+      !tabs->clearing) {
+    adw_tab_view_close_page_finish(view, tab, FALSE);
+    return GDK_EVENT_STOP;
+  }
+
+  return GDK_EVENT_PROPAGATE;
+}
+
+static void
+page_detached(G_GNUC_UNUSED AdwTabView *view,
+              AdwTabPage *tab,
+              G_GNUC_UNUSED gint position,
+              gpointer user_data)
+{
+  struct tabs *tabs = user_data;
+  EditorPage *page = tab_page(tab);
+
+  g_hash_table_remove(tabs->pages, page);
+  g_queue_remove(&tabs->recent, page);
+}
+
+static void
+selected_changed(AdwTabView *view,
+                 G_GNUC_UNUSED GParamSpec *pspec,
+                 gpointer user_data)
+{
+  struct tabs *tabs = user_data;
+  AdwTabPage *tab = adw_tab_view_get_selected_page(view);
+
+  if (tabs->selecting || tab == NULL) {
+    return;
+  }
+
+  touch(tabs, tab_page(tab));
+  tabs->selected(tab_page(tab), tabs->user_data);
+}
+
+GtkWidget *
+tabs_new(TabsViewCreated created, TabsSelected selected, gpointer user_data)
+{
+  GtkWidget *box;
+  GtkWidget *bar;
+  struct tabs *tabs;
+  const gchar *max;
+
+  tabs = g_malloc0(sizeof(*tabs));
+  tabs->pages = g_hash_table_new(NULL, NULL);
+  g_queue_init(&tabs->recent);
+  tabs->created = created;
+  tabs->selected = selected;
+  tabs->user_data = user_data;
+
+  max = g_getenv(TABS_MAX_ENV);
+  tabs->max = max != NULL ? MAX(atoi(max), 1) : DEFAULT_MAX_TABS;
+
+  tabs->view = adw_tab_view_new();
+  gtk_widget_set_vexpand(GTK_WIDGET(tabs->view), TRUE);
+  g_signal_connect(tabs->view, "close-page", G_CALLBACK(close_page), tabs);
+  g_signal_connect(tabs->view, "page-detached", G_CALLBACK(page_detached),
+                   tabs);
+  g_signal_connect(tabs->view, "notify::selected-page",
+                   G_CALLBACK(selected_changed), tabs);
+
+  bar = GTK_WIDGET(adw_tab_bar_new());
+  adw_tab_bar_set_view(ADW_TAB_BAR(bar), tabs->view);
+
+  box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
+  gtk_widget_set_hexpand(box, TRUE);
+  gtk_box_append(GTK_BOX(box), bar);
+  gtk_box_append(GTK_BOX(box), GTK_WIDGET(tabs->view));
+  g_object_set_data_full(G_OBJECT(box), "tabs", tabs, tabs_free);
+
+  return box;
+}
+
+static AdwTabPage *
+open_tab(struct tabs *tabs, EditorPage *page)
+{
+  GtkWidget *textarea;
+  GtkWidget *scroll;
+  AdwTabPage *tab;
+
+  textarea = gtk_text_view_new_with_buffer(page->content);
+  gtk_text_view_set_left_margin(GTK_TEXT_VIEW(textarea), 20);
+  gtk_text_view_set_wrap_mode(GTK_TEXT_VIEW(textarea), GTK_WRAP_WORD);
+  tabs->created(GTK_TEXT_VIEW(textarea), tabs->user_data);
+
+  scroll = gtk_scrolled_window_new();
+  gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(scroll), textarea);
+  gtk_scrolled_window_set_min_content_width(GTK_SCROLLED_WINDOW(scroll), 300);
+  gtk_scrolled_window_set_min_content_height(GTK_SCROLLED_WINDOW(scroll), 400);
+  g_object_set_data_full(G_OBJECT(scroll), "page", g_object_ref(page),
+                         g_object_unref);
+  g_object_set_data(G_OBJECT(scroll), "textarea", textarea);
+
+  tab = adw_tab_view_append(tabs->view, scroll);
+  adw_tab_page_set_title(tab, page->heading);
+  g_signal_connect_object(page, "notify::heading",
+                          G_CALLBACK(heading_changed), tab, 0);
+  g_hash_table_insert(tabs->pages, page, tab);
+
+  return tab;
+}
+
+GtkTextView *
+tabs_show(GtkWidget *widget, EditorPage *page)
+{
+  struct tabs *tabs = g_object_get_data(G_OBJECT(widget), "tabs");
+  AdwTabPage *tab = g_hash_table_lookup(tabs->pages, page);
+
+  /* The first tab in is selected on its own */
+  tabs->selecting = TRUE;
+  if (tab == NULL) {
+    tab = open_tab(tabs, page);
+  }
+  touch(tabs, page);
+  adw_tab_view_set_selected_page(tabs->view, tab);
+  tabs->selecting = FALSE;
+
+  /* After the new tab is in, so there is always one left to select */
+  while (g_queue_get_length(&tabs->recent) > tabs->max) {
+    EditorPage *oldest = g_queue_peek_tail(&tabs->recent);
+
+    adw_tab_view_close_page(tabs->view,
+                            g_hash_table_lookup(tabs->pages, oldest));
+    if (g_queue_peek_tail(&tabs->recent) == oldest) {
+      break;
+    }
+  }
+
+  return GTK_TEXT_VIEW(
+    g_object_get_data(G_OBJECT(adw_tab_page_get_child(tab)), "textarea"));
+}
+
+void
+tabs_close(GtkWidget *widget, EditorPage *page)
+{
+  struct tabs *tabs = g_object_get_data(G_OBJECT(widget), "tabs");
+  AdwTabPage *tab = g_hash_table_lookup(tabs->pages, page);
+
+  if (tab != NULL) {
+    adw_tab_view_close_page(tabs->view, tab);
+  }
+}
+
+void
+tabs_clear(GtkWidget *widget)
+{
+  struct tabs *tabs = g_object_get_data(G_OBJECT(widget), "tabs");
+  gint n_pages;
+
+  tabs->selecting = TRUE;
+  tabs->clearing = TRUE;
+  while ((n_pages = adw_tab_view_get_n_pages(tabs->view)) > 0) {
+    adw_tab_view_close_page(tabs->view,
+                            adw_tab_view_get_nth_page(tabs->view, 0));
+    if (adw_tab_view_get_n_pages(tabs->view) == n_pages) {
+      break;
+    }
+  }
+  tabs->clearing = FALSE;
+  tabs->selecting = FALSE;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <gtk/gtk.h>
+
+#include "editor_page.h"
+
+G_BEGIN_DECLS
+
+/* Number of page views kept open, 8 if unset */
+#define TABS_MAX_ENV "RPGEDITOR_MAX_TABS"
+
+/*
+ * The open pages, each in a tab with a text view of its own, so a page
+ * comes back scrolled and selected as it was left. Past the maximum the
+ * least recently shown tab is closed.
+ */
+typedef void (*TabsViewCreated)(GtkTextView *view, gpointer user_data);
+typedef void (*TabsSelected)(EditorPage *page, gpointer user_data);
+
+/* created is called for every new view, selected when the user picks a
+ * tab */
+GtkWidget *tabs_new(TabsViewCreated created,
+                    TabsSelected selected,
+                    gpointer user_data);
+
+/* Selects the tab of page, opening one if needed, and returns its view */
+GtkTextView *tabs_show(GtkWidget *tabs, EditorPage *page);
+
+void tabs_close(GtkWidget *tabs, EditorPage *page);
+
+/* Closes every tab, the last one too, without selecting another page */
+void tabs_clear(GtkWidget *tabs);
+
+G_END_DECLS
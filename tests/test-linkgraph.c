@@ -0,0 +1,122 @@
+#include "linkgraph.h"
+#include <glib.h>
+
+#define TOWN GUINT_TO_POINTER(1)
+#define MILL GUINT_TO_POINTER(2)
+#define WELL GUINT_TO_POINTER(3)
+
+static guint
+list_length(GList *list)
+{
+  guint n = g_list_length(list);
+
+  g_list_free(list);
+
+  return n;
+}
+
+static gboolean
+list_has(GList *list, gpointer page)
+{
+  gboolean found = g_list_find(list, page) != NULL;
+
+  g_list_free(list);
+
+  return found;
+}
+
+static void
+test_counts(void)
+{
+  g_autoptr(LinkGraph) graph = link_graph_new();
+
+  link_graph_add_page(graph, TOWN, FALSE);
+  link_graph_add_page(graph, MILL, FALSE);
+  g_assert_cmpuint(list_length(link_graph_orphans(graph)), ==, 2);
+
+  /* A page may link to another one several times */
+  link_graph_add_link(graph, TOWN, MILL);
+  link_graph_add_link(graph, TOWN, MILL);
+  g_assert_cmpuint(link_graph_n_links(graph), ==, 2);
+  g_assert_cmpuint(list_length(link_graph_targets(graph, TOWN)), ==, 1);
+  g_assert_false(list_has(link_graph_orphans(graph), MILL));
+
+  link_graph_remove_link(graph, TOWN, MILL);
+  g_assert_cmpuint(link_graph_n_links(graph), ==, 1);
+  g_assert_false(list_has(link_graph_orphans(graph), MILL));
+
+  link_graph_remove_link(graph, TOWN, MILL);
+  g_assert_cmpuint(link_graph_n_links(graph), ==, 0);
+  g_assert_true(list_has(link_graph_orphans(graph), MILL));
+
+  /* Nothing left to remove */
+  link_graph_remove_link(graph, TOWN, MILL);
+  g_assert_cmpuint(link_graph_n_links(graph), ==, 0);
+}
+
+/* Self links do not keep a page from being an orphan */
+static void
+test_self_link(void)
+{
+  g_autoptr(LinkGraph) graph = link_graph_new();
+
+  link_graph_add_page(graph, TOWN, FALSE);
+  link_graph_add_link(graph, TOWN, TOWN);
+  g_assert_cmpuint(link_graph_n_links(graph), ==, 1);
+  g_assert_true(list_has(link_graph_orphans(graph), TOWN));
+}
+
+static void
+test_stubs(void)
+{
+  g_autoptr(LinkGraph) graph = link_graph_new();
+
+  link_graph_add_page(graph, TOWN, FALSE);
+  link_graph_add_page(graph, WELL, TRUE);
+  link_graph_add_link(graph, TOWN, WELL);
+  g_assert_true(link_graph_is_stub(graph, WELL));
+  g_assert_cmpuint(list_length(link_graph_stubs(graph)), ==, 1);
+
+  link_graph_set_stub(graph, WELL, FALSE);
+  g_assert_false(link_graph_is_stub(graph, WELL));
+  g_assert_cmpuint(list_length(link_graph_stubs(graph)), ==, 0);
+}
+
+static void
+test_remove_page(void)
+{
+  g_autoptr(LinkGraph) graph = link_graph_new();
+
+  link_graph_add_page(graph, TOWN, FALSE);
+  link_graph_add_page(graph, MILL, FALSE);
+  link_graph_add_page(graph, WELL, FALSE);
+  link_graph_add_link(graph, TOWN, MILL);
+  link_graph_add_link(graph, MILL, WELL);
+  link_graph_add_link(graph, MILL, WELL);
+  g_assert_cmpuint(link_graph_n_links(graph), ==, 3);
+
+  /* Its own links go, links to it dangle */
+  link_graph_remove_page(graph, MILL);
+  g_assert_cmpuint(link_graph_n_links(graph), ==, 1);
+  g_assert_true(list_has(link_graph_dangling(graph), MILL));
+  g_assert_true(list_has(link_graph_orphans(graph), WELL));
+  g_assert_false(list_has(link_graph_orphans(graph), MILL));
+
+  link_graph_remove_link(graph, TOWN, MILL);
+  g_assert_cmpuint(link_graph_n_links(graph), ==, 0);
+  g_assert_cmpuint(list_length(link_graph_dangling(graph)), ==, 0);
+  g_assert_cmpuint(list_length(link_graph_sources(graph, WELL)), ==, 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  g_test_init(&argc, &argv, NULL);
+
+  g_test_add_func("/linkgraph/counts", test_counts);
+  g_test_add_func("/linkgraph/self-link", test_self_link);
+  g_test_add_func("/linkgraph/stubs", test_stubs);
+  g_test_add_func("/linkgraph/remove-page", test_remove_page);
+
+  return g_test_run();
+}
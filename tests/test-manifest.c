@@ -0,0 +1,149 @@
+#include "manifest.h"
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <string.h>
+
+static gchar *
+write_file(const gchar *dir, const gchar *name, const gchar *contents)
+{
+  gchar *path = g_build_filename(dir, name, NULL);
+
+  g_assert_true(g_file_set_contents(path, contents, -1, NULL));
+
+  return path;
+}
+
+static void
+test_parse(void)
+{
+  const gchar *data = "rpgeditor-manifest\t2\n"
+                      "compression\tgzip\n"
+                      "2\t1\tb.md.gz\t#ff0000\t10\tabc\tSecond\n"
+                      "1\t0\ta.md.gz\t\t5\tdef\tFirst\n";
+  GError *error = NULL;
+  Manifest *manifest;
+  ManifestEntry *entry;
+
+  manifest = manifest_parse(g_strdup(data), strlen(data), &error);
+  g_assert_no_error(error);
+  g_assert_cmpuint(manifest->version, ==, MANIFEST_VERSION);
+  g_assert_cmpint(manifest->compression, ==, MANIFEST_COMPRESSION_GZIP);
+  g_assert_cmpuint(manifest->entries->len, ==, 2);
+
+  /* In page order */
+  entry = &g_array_index(manifest->entries, ManifestEntry, 0);
+  g_assert_cmpuint(entry->id, ==, 1);
+  g_assert_cmpstr(entry->file, ==, "a.md.gz");
+  g_assert_cmpstr(entry->heading, ==, "First");
+  entry = &g_array_index(manifest->entries, ManifestEntry, 1);
+  g_assert_cmpstr(entry->color, ==, "#ff0000");
+  g_assert_cmpuint(entry->length, ==, 10);
+
+  manifest_free(manifest);
+}
+
+static void
+test_future_version(void)
+{
+  const gchar *data = "rpgeditor-manifest\t99\n";
+  GError *error = NULL;
+
+  g_assert_null(manifest_parse(g_strdup(data), strlen(data), &error));
+  g_assert_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL);
+  g_clear_error(&error);
+}
+
+/* Page files outside of the workspace folder */
+static void
+test_bad_file(void)
+{
+  const gchar *files[] = { "../x.md", "sub/x.md", "/tmp/x.md", "a\\x.md",
+                           "notes.txt", ".." };
+
+  for (guint i = 0; i < G_N_ELEMENTS(files); i++) {
+    gchar *data = g_strdup_printf("rpgeditor-manifest\t2\n"
+                                  "1\t0\t%s\t\t0\t\tPage\n",
+                                  files[i]);
+    GError *error = NULL;
+
+    g_assert_null(manifest_parse(data, strlen(data), &error));
+    g_assert_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL);
+    g_clear_error(&error);
+  }
+}
+
+static void
+test_upgrade(void)
+{
+  gchar *dir = g_dir_make_tmp("rpgeditor-XXXXXX", NULL);
+  gchar *legacy = write_file(dir, MANIFEST_LEGACY_FILE,
+                             "Town.md\t#00ff00\nMill.md\t\nnotes.txt\n");
+  gchar *town = write_file(dir, "Town.md", "#Town\nThe [[Mill]].\n");
+  gchar *mill = write_file(dir, "Mill.md", "#Old Mill\n");
+  gchar *path = g_build_filename(dir, MANIFEST_FILE, NULL);
+  GError *error = NULL;
+  Manifest *manifest;
+  ManifestEntry *entry;
+
+  manifest = manifest_load(dir, &error);
+  g_assert_no_error(error);
+  g_assert_cmpuint(manifest->entries->len, ==, 2);
+
+  entry = &g_array_index(manifest->entries, ManifestEntry, 0);
+  g_assert_cmpuint(entry->id, ==, 1);
+  g_assert_cmpstr(entry->file, ==, "Town.md");
+  g_assert_cmpstr(entry->color, ==, "#00ff00");
+  g_assert_cmpstr(entry->heading, ==, "Town");
+  g_assert_cmpuint(entry->length, ==, strlen("#Town\nThe [[Mill]].\n"));
+  entry = &g_array_index(manifest->entries, ManifestEntry, 1);
+  g_assert_cmpstr(entry->heading, ==, "Old Mill");
+  manifest_free(manifest);
+
+  /* Written once, meta.tab is gone */
+  g_assert_true(g_file_test(path, G_FILE_TEST_EXISTS));
+  g_assert_false(g_file_test(legacy, G_FILE_TEST_EXISTS));
+
+  manifest = manifest_load(dir, &error);
+  g_assert_no_error(error);
+  g_assert_cmpuint(manifest->entries->len, ==, 2);
+  manifest_free(manifest);
+
+  g_unlink(path);
+  g_unlink(town);
+  g_unlink(mill);
+  g_rmdir(dir);
+  g_free(path);
+  g_free(mill);
+  g_free(town);
+  g_free(legacy);
+  g_free(dir);
+}
+
+static void
+test_missing(void)
+{
+  gchar *dir = g_dir_make_tmp("rpgeditor-XXXXXX", NULL);
+  GError *error = NULL;
+
+  g_assert_null(manifest_load(dir, &error));
+  g_assert_error(error, G_FILE_ERROR, G_FILE_ERROR_NOENT);
+  g_clear_error(&error);
+
+  g_rmdir(dir);
+  g_free(dir);
+}
+
+int
+main(int argc, char *argv[])
+{
+  g_test_init(&argc, &argv, NULL);
+
+  g_test_add_func("/manifest/parse", test_parse);
+  g_test_add_func("/manifest/future-version", test_future_version);
+  g_test_add_func("/manifest/bad-file", test_bad_file);
+  g_test_add_func("/manifest/upgrade", test_upgrade);
+  g_test_add_func("/manifest/missing", test_missing);
+
+  return g_test_run();
+}
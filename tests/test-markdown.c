@@ -0,0 +1,255 @@
+#include "markdown.h"
+#include <glib.h>
+
+#include <string.h>
+
+/*
+ * What the editor does with a page: the markers come out of the text and
+ * their style goes over what they enclosed, see apply_markup(). Then the
+ * markers are written back where the styles start and end, see
+ * append_toggles(). A style is a bit per byte here, a tag in the editor.
+ */
+static gchar *
+round_trip(const gchar *md)
+{
+  GArray *tokens = md_tokenize(md, strlen(md), MD_PARSE_NO_LINKS);
+  GString *text = g_string_new("");
+  GArray *styles = g_array_new(FALSE, TRUE, sizeof(guint));
+  GString *out = g_string_new("");
+  guint open = 0;
+  guint prev = 0;
+
+  for (guint i = 0; i < tokens->len; i++) {
+    MdToken *token = &g_array_index(tokens, MdToken, i);
+
+    switch (token->type) {
+    case MD_TOKEN_TEXT:
+      g_string_append_len(text, md + token->offset, token->len);
+      for (gsize j = 0; j < token->len; j++) {
+        g_array_append_val(styles, open);
+      }
+      break;
+    case MD_TOKEN_OPEN:
+      open |= 1u << token->style;
+      break;
+    case MD_TOKEN_CLOSE:
+      open &= ~(1u << token->style);
+      break;
+    case MD_TOKEN_LINK:
+    case MD_TOKEN_EMBED:
+      g_assert_not_reached();
+    }
+  }
+  g_assert_cmpuint(open, ==, 0);
+
+  for (gsize i = 0; i <= text->len; i++) {
+    guint cur = i < text->len ? g_array_index(styles, guint, i) : 0;
+
+    for (gint s = MD_N_STYLES - 1; s >= 0; s--) {
+      if (prev & ~cur & (1u << s)) {
+        g_string_append(out, md_rule(s)->close);
+      }
+    }
+    for (guint s = 0; s < MD_N_STYLES; s++) {
+      if ((cur & ~prev & (1u << s)) &&
+          !(s == MD_CODE_BLOCK && g_str_has_prefix(text->str + i, "```"))) {
+        g_string_append(out, md_rule(s)->open);
+      }
+    }
+    if (i < text->len) {
+      g_string_append_c(out, text->str[i]);
+    }
+    prev = cur;
+  }
+
+  g_array_unref(styles);
+  g_string_free(text, TRUE);
+  g_array_unref(tokens);
+
+  return g_string_free(out, FALSE);
+}
+
+static void
+test_round_trip(void)
+{
+  const gchar *pages[] = {
+    "plain text\n",
+    "**bold**, *italic* and `code`\n",
+    "# Title\n## Part\n### Small\nbody\n",
+    "***both***\n",
+    "*a *b* c*\n",
+    "snake_case *word*s foo*bar*\n",
+    "```\ncode with **stars** and `ticks`\n```\nafter\n",
+    "unclosed **bold and `tick\n",
+    "no newline at the end *there*",
+  };
+
+  for (guint i = 0; i < G_N_ELEMENTS(pages); i++) {
+    gchar *out = round_trip(pages[i]);
+
+    g_assert_cmpstr(out, ==, pages[i]);
+    g_free(out);
+  }
+}
+
+/* Spans with nothing in them keep their markers as text */
+static void
+test_empty_spans(void)
+{
+  const gchar *pages[] = {
+    "a **** b\n", "x `` y\n", "```\n```\nafter\n", "# \nnot a header\n",
+    "**** and **bold**\n",
+  };
+
+  for (guint i = 0; i < G_N_ELEMENTS(pages); i++) {
+    gchar *out = round_trip(pages[i]);
+
+    g_assert_cmpstr(out, ==, pages[i]);
+    g_free(out);
+  }
+}
+
+static void
+test_fence_info(void)
+{
+  const gchar *md = "```lua\nprint(1*2*3)\n```\n";
+  GArray *tokens = md_tokenize(md, strlen(md), MD_PARSE_DEFAULT);
+  MdToken *open = &g_array_index(tokens, MdToken, 0);
+  gchar *out;
+
+  /* The fence line stays in the block as text */
+  g_assert_cmpuint(tokens->len, ==, 3);
+  g_assert_cmpint(open->type, ==, MD_TOKEN_OPEN);
+  g_assert_cmpint(open->style, ==, MD_CODE_BLOCK);
+  g_assert_cmpuint(open->len, ==, 0);
+  g_assert_cmpint(g_array_index(tokens, MdToken, 1).type, ==, MD_TOKEN_TEXT);
+  g_array_unref(tokens);
+
+  out = round_trip(md);
+  g_assert_cmpstr(out, ==, md);
+  g_free(out);
+
+  /* A block whose first line is a fence keeps its own fence as well */
+  out = round_trip("```\n```lua\n```\n");
+  g_assert_cmpstr(out, ==, "```\n```lua\n```\n");
+  g_free(out);
+}
+
+static void
+test_flanking(void)
+{
+  const gchar *texts[] = { "2 * 3 * 4", "a ** b ** c", "* not a list *" };
+
+  for (guint i = 0; i < G_N_ELEMENTS(texts); i++) {
+    GArray *tokens = md_tokenize(texts[i], strlen(texts[i]),
+                                 MD_PARSE_DEFAULT);
+
+    g_assert_cmpuint(tokens->len, ==, 1);
+    g_assert_cmpint(g_array_index(tokens, MdToken, 0).type, ==,
+                    MD_TOKEN_TEXT);
+    g_array_unref(tokens);
+  }
+}
+
+static void
+test_links(void)
+{
+  const gchar *md = "[[A]][[A]] ![[B]] [[not closed";
+  GArray *tokens = md_tokenize(md, strlen(md), MD_PARSE_DEFAULT);
+  MdTokenType types[] = { MD_TOKEN_LINK, MD_TOKEN_LINK, MD_TOKEN_TEXT,
+                          MD_TOKEN_EMBED, MD_TOKEN_TEXT };
+  gchar *target;
+
+  g_assert_cmpuint(tokens->len, ==, G_N_ELEMENTS(types));
+  for (guint i = 0; i < G_N_ELEMENTS(types); i++) {
+    g_assert_cmpint(g_array_index(tokens, MdToken, i).type, ==, types[i]);
+  }
+
+  target = md_link_target(md, &g_array_index(tokens, MdToken, 3));
+  g_assert_cmpstr(target, ==, "B");
+  g_free(target);
+  g_array_unref(tokens);
+
+  g_assert_true(md_valid_link_name("Old Mill", 8));
+  g_assert_false(md_valid_link_name("a]b", 3));
+  g_assert_false(md_valid_link_name("a\nb", 3));
+  g_assert_false(md_valid_link_name("", 0));
+}
+
+/* Links in code are code */
+static void
+test_code_links(void)
+{
+  const gchar *md = "```\n[[A]]\n```\n`[[B]]`\n";
+  GArray *tokens = md_tokenize(md, strlen(md), MD_PARSE_DEFAULT);
+
+  for (guint i = 0; i < tokens->len; i++) {
+    g_assert_cmpint(g_array_index(tokens, MdToken, i).type, !=,
+                    MD_TOKEN_LINK);
+  }
+  g_array_unref(tokens);
+}
+
+/* Pieces cut at a block break tokenize as they do in the whole text */
+static void
+test_block_break(void)
+{
+  const gchar *md = "*a\nb*\n\n```\nx\n\ny\n```\n\nc\n";
+  gsize len = strlen(md);
+
+  /* Not inside the paragraph or the code block */
+  g_assert_cmpuint(md_block_break(md, len, 3), ==, 7);
+  g_assert_cmpuint(md_block_break(md, len, 10), ==, 7);
+  g_assert_cmpuint(md_block_break(md, len, 17), ==, 7);
+  g_assert_cmpuint(md_block_break(md, len, 21), ==, 21);
+  g_assert_cmpuint(md_block_break("no break", 8, 2), ==, 8);
+
+  for (gsize limit = 0; limit < len; limit++) {
+    gsize cut = md_block_break(md, len, limit);
+    GArray *whole = md_tokenize(md, len, MD_PARSE_DEFAULT);
+    GArray *head = md_tokenize(md, cut, MD_PARSE_DEFAULT);
+    GArray *tail = md_tokenize(md + cut, len - cut, MD_PARSE_DEFAULT);
+    guint i = 0;
+
+    /* Text tokens may be split differently, markup may not */
+    for (guint j = 0; j < whole->len; j++) {
+      MdToken *token = &g_array_index(whole, MdToken, j);
+      MdToken *piece;
+
+      if (token->type == MD_TOKEN_TEXT) {
+        continue;
+      }
+      do {
+        g_assert_cmpuint(i, <, head->len + tail->len);
+        piece = i < head->len ? &g_array_index(head, MdToken, i)
+                              : &g_array_index(tail, MdToken, i - head->len);
+        i++;
+      } while (piece->type == MD_TOKEN_TEXT);
+
+      g_assert_cmpint(piece->type, ==, token->type);
+      g_assert_cmpint(piece->style, ==, token->style);
+      g_assert_cmpuint(piece->offset + (i > head->len ? cut : 0), ==,
+                       token->offset);
+    }
+
+    g_array_unref(tail);
+    g_array_unref(head);
+    g_array_unref(whole);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  g_test_init(&argc, &argv, NULL);
+
+  g_test_add_func("/markdown/round-trip", test_round_trip);
+  g_test_add_func("/markdown/empty-spans", test_empty_spans);
+  g_test_add_func("/markdown/fence-info", test_fence_info);
+  g_test_add_func("/markdown/flanking", test_flanking);
+  g_test_add_func("/markdown/links", test_links);
+  g_test_add_func("/markdown/code-links", test_code_links);
+  g_test_add_func("/markdown/block-break", test_block_break);
+
+  return g_test_run();
+}
@@ -0,0 +1,112 @@
+#include "search.h"
+#include <gio/gio.h>
+#include <glib.h>
+
+static void
+search_done(G_GNUC_UNUSED GObject *source_object,
+            GAsyncResult *res,
+            gpointer user_data)
+{
+  GPtrArray **matches = user_data;
+  GError *error = NULL;
+
+  *matches = search_finish(res, &error);
+  g_assert_no_error(error);
+}
+
+/* Runs the search to the end, takes ownership of texts */
+static GPtrArray *
+search(const gchar *pattern,
+       const gchar *replacement,
+       SearchFlags flags,
+       GPtrArray *texts)
+{
+  GPtrArray *matches = NULL;
+
+  search_async(texts, pattern, replacement, flags, NULL, search_done,
+               &matches);
+  while (matches == NULL) {
+    g_main_context_iteration(NULL, TRUE);
+  }
+
+  return matches;
+}
+
+static GPtrArray *
+texts_new(void)
+{
+  return g_ptr_array_new_with_free_func((GDestroyNotify) search_text_free);
+}
+
+static void
+test_plain(void)
+{
+  GPtrArray *texts = texts_new();
+  GPtrArray *matches;
+  SearchMatch *match;
+
+  g_ptr_array_add(texts, search_text_new(NULL, g_strdup("The mill, the Mill"),
+                                         FALSE));
+  matches = search("mill", "barn", SEARCH_CASELESS, texts);
+
+  g_assert_cmpuint(matches->len, ==, 2);
+  match = g_ptr_array_index(matches, 1);
+  g_assert_cmpstr(match->text, ==, "Mill");
+  g_assert_cmpstr(match->replacement, ==, "barn");
+  g_assert_cmpint(match->start, ==, 14);
+  g_ptr_array_unref(matches);
+}
+
+/* Markers and links are not text in markdown */
+static void
+test_markdown(void)
+{
+  GPtrArray *texts = texts_new();
+  GPtrArray *matches;
+
+  g_ptr_array_add(texts,
+                  search_text_new(NULL, g_strdup("[[Mill]] **Mill** Mill\n"),
+                                  TRUE));
+  matches = search("Mill", "", SEARCH_DEFAULT, texts);
+  g_assert_cmpuint(matches->len, ==, 2);
+  g_ptr_array_unref(matches);
+
+  texts = texts_new();
+  g_ptr_array_add(texts, search_text_new(NULL, g_strdup("a **b** c\n"), TRUE));
+  matches = search("\\*", "", SEARCH_REGEX, texts);
+  g_assert_cmpuint(matches->len, ==, 0);
+  g_ptr_array_unref(matches);
+}
+
+/* Only from is searched, but a block opened before it still counts */
+static void
+test_markdown_from(void)
+{
+  const gchar *md = "Mill\n```\ncode\n```\n[[Mill]] Mill\n";
+  GPtrArray *texts = texts_new();
+  SearchText *text = search_text_new(NULL, g_strdup(md), TRUE);
+  GPtrArray *matches;
+  SearchMatch *match;
+
+  /* From within the code block */
+  text->from = 9;
+  g_ptr_array_add(texts, text);
+  matches = search("Mill", "", SEARCH_DEFAULT, texts);
+
+  g_assert_cmpuint(matches->len, ==, 1);
+  match = g_ptr_array_index(matches, 0);
+  g_assert_cmpuint(match->start_byte, ==, 27);
+  g_ptr_array_unref(matches);
+}
+
+int
+main(int argc, char *argv[])
+{
+  g_test_init(&argc, &argv, NULL);
+
+  g_test_add_func("/search/plain", test_plain);
+  g_test_add_func("/search/markdown", test_markdown);
+  g_test_add_func("/search/markdown-from", test_markdown_from);
+
+  return g_test_run();
+}
@@ -0,0 +1,178 @@
+#include "manifest.h"
+#include "page.h"
+#include "workspace.h"
+#include <glib.h>
+#include <glib/gstdio.h>
+
+static Page *
+make_page(const gchar *heading, const gchar *body)
+{
+  Page *page = page_new(heading);
+
+  g_string_assign(page->body, body);
+
+  return page;
+}
+
+static void
+remove_tree(const gchar *dir)
+{
+  GDir *handle = g_dir_open(dir, 0, NULL);
+  const gchar *name;
+
+  while ((name = g_dir_read_name(handle)) != NULL) {
+    gchar *path = g_build_filename(dir, name, NULL);
+
+    g_unlink(path);
+    g_free(path);
+  }
+  g_dir_close(handle);
+  g_rmdir(dir);
+}
+
+static void
+assert_pages(GPtrArray *expected, GPtrArray *loaded)
+{
+  g_assert_cmpuint(loaded->len, ==, expected->len);
+
+  for (guint i = 0; i < loaded->len; i++) {
+    Page *want = g_ptr_array_index(expected, i);
+    Page *got = g_ptr_array_index(loaded, i);
+
+    g_assert_cmpuint(got->id, ==, want->id);
+    g_assert_cmpstr(got->heading, ==, want->heading);
+    g_assert_cmpstr(got->body->str, ==, want->body->str);
+  }
+}
+
+static void
+save_and_load(ManifestCompression compression)
+{
+  gchar *dir = g_dir_make_tmp("rpgeditor-XXXXXX", NULL);
+  GPtrArray *pages = g_ptr_array_new_with_free_func((GDestroyNotify) page_free);
+  ManifestCompression loaded_compression;
+  GError *error = NULL;
+  GPtrArray *loaded;
+
+  g_ptr_array_add(pages, make_page("Town", "The [[Mill]] and **the well**.\n"));
+  g_ptr_array_add(pages, make_page("Mill", "```\nkeep *this*\n```\n"));
+  g_ptr_array_add(pages, make_page("Empty", ""));
+
+  g_assert_true(workspace_save(dir, pages, compression, &error));
+  g_assert_no_error(error);
+
+  loaded = workspace_load(dir, &loaded_compression, &error);
+  g_assert_no_error(error);
+  g_assert_cmpint(loaded_compression, ==, compression);
+  assert_pages(pages, loaded);
+  g_ptr_array_unref(loaded);
+
+  /* The second save goes to the other slots, then the first ones again */
+  for (guint i = 0; i < 2; i++) {
+    g_string_append(((Page *) g_ptr_array_index(pages, 0))->body, "More.\n");
+    g_assert_true(workspace_save(dir, pages, compression, &error));
+    g_assert_no_error(error);
+
+    loaded = workspace_load(dir, NULL, &error);
+    g_assert_no_error(error);
+    assert_pages(pages, loaded);
+    g_ptr_array_unref(loaded);
+  }
+
+  g_ptr_array_unref(pages);
+  remove_tree(dir);
+  g_free(dir);
+}
+
+static void
+test_save_load(void)
+{
+  save_and_load(MANIFEST_COMPRESSION_NONE);
+}
+
+static void
+test_save_load_gzip(void)
+{
+  save_and_load(MANIFEST_COMPRESSION_GZIP);
+}
+
+/* Headings that make the same file name each get a slot of their own */
+static void
+test_colliding_names(void)
+{
+  gchar *dir = g_dir_make_tmp("rpgeditor-XXXXXX", NULL);
+  GPtrArray *pages = g_ptr_array_new_with_free_func((GDestroyNotify) page_free);
+  GError *error = NULL;
+  GPtrArray *loaded;
+  Manifest *manifest;
+  GHashTable *files;
+
+  g_ptr_array_add(pages, make_page("A/B", "slash\n"));
+  g_ptr_array_add(pages, make_page("A:B", "colon\n"));
+  g_ptr_array_add(pages, make_page("A_B", "underscore\n"));
+  g_ptr_array_add(pages, make_page("Same", "first\n"));
+  g_ptr_array_add(pages, make_page("Same", "second\n"));
+
+  for (guint i = 0; i < 2; i++) {
+    g_assert_true(workspace_save(dir, pages, MANIFEST_COMPRESSION_NONE,
+                                 &error));
+    g_assert_no_error(error);
+
+    loaded = workspace_load(dir, NULL, &error);
+    g_assert_no_error(error);
+    assert_pages(pages, loaded);
+    g_ptr_array_unref(loaded);
+  }
+
+  manifest = manifest_load(dir, &error);
+  g_assert_no_error(error);
+  files = g_hash_table_new(g_str_hash, g_str_equal);
+  for (guint i = 0; i < manifest->entries->len; i++) {
+    ManifestEntry *entry = &g_array_index(manifest->entries, ManifestEntry, i);
+
+    g_assert_false(g_hash_table_contains(files, entry->file));
+    g_hash_table_add(files, (gpointer) entry->file);
+  }
+  g_hash_table_unref(files);
+  manifest_free(manifest);
+
+  g_ptr_array_unref(pages);
+  remove_tree(dir);
+  g_free(dir);
+}
+
+static void
+test_view(void)
+{
+  gchar *dir = g_dir_make_tmp("rpgeditor-XXXXXX", NULL);
+  WorkspaceView view = { 7, 1234 };
+  WorkspaceView loaded = { 1, 1 };
+  GError *error = NULL;
+
+  /* Nothing recorded yet */
+  g_assert_true(workspace_view_load(dir, &loaded, &error));
+  g_assert_no_error(error);
+  g_assert_cmpuint(loaded.page_id, ==, 0);
+
+  g_assert_true(workspace_view_save(dir, &view, &error));
+  g_assert_true(workspace_view_load(dir, &loaded, &error));
+  g_assert_no_error(error);
+  g_assert_cmpuint(loaded.page_id, ==, 7);
+  g_assert_cmpint(loaded.top, ==, 1234);
+
+  remove_tree(dir);
+  g_free(dir);
+}
+
+int
+main(int argc, char *argv[])
+{
+  g_test_init(&argc, &argv, NULL);
+
+  g_test_add_func("/workspace/save-load", test_save_load);
+  g_test_add_func("/workspace/save-load-gzip", test_save_load_gzip);
+  g_test_add_func("/workspace/colliding-names", test_colliding_names);
+  g_test_add_func("/workspace/view", test_view);
+
+  return g_test_run();
+}
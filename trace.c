@@ -0,0 +1,218 @@
+#include "trace.h"
+#include <glib.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_MAGIC "rpgeditor-trace\t1\n"
+
+static void
+clear_event(gpointer data)
+{
+  TraceEvent *event = data;
+
+  g_free(event->text);
+}
+
+Trace *
+trace_new(void)
+{
+  Trace *trace = g_malloc0(sizeof(*trace));
+
+  trace->events = g_array_new(FALSE, TRUE, sizeof(TraceEvent));
+  g_array_set_clear_func(trace->events, clear_event);
+
+  return trace;
+}
+
+void
+trace_free(Trace *trace)
+{
+  if (trace == NULL) {
+    return;
+  }
+
+  g_array_unref(trace->events);
+  g_free(trace->page);
+  g_free(trace);
+}
+
+static TraceEvent *
+append(Trace *trace, TraceEventType type)
+{
+  TraceEvent event = { type, 0, 0, 0, NULL };
+  gint64 now = g_get_monotonic_time();
+
+  if (trace->last_time != 0) {
+    event.delay = now - trace->last_time;
+  }
+  trace->last_time = now;
+
+  g_array_append_val(trace->events, event);
+
+  return &g_array_index(trace->events, TraceEvent, trace->events->len - 1);
+}
+
+/* A page event first if the edit is to another page than the last one */
+static void
+switch_page(Trace *trace, const gchar *page)
+{
+  if (g_strcmp0(trace->page, page) == 0) {
+    return;
+  }
+
+  g_free(trace->page);
+  trace->page = g_strdup(page);
+  append(trace, TRACE_PAGE)->text = g_strdup(page);
+}
+
+void
+trace_insert(Trace *trace,
+             const gchar *page,
+             gint offset,
+             const gchar *text,
+             gint len)
+{
+  TraceEvent *event;
+
+  switch_page(trace, page);
+
+  event = append(trace, TRACE_INSERT);
+  event->start = offset;
+  event->text = len < 0 ? g_strdup(text) : g_strndup(text, len);
+}
+
+void
+trace_delete(Trace *trace, const gchar *page, gint start, gint end)
+{
+  TraceEvent *event;
+
+  switch_page(trace, page);
+
+  event = append(trace, TRACE_DELETE);
+  event->start = start;
+  event->end = end;
+}
+
+gboolean
+trace_write(Trace *trace, const gchar *path, GError **error)
+{
+  GString *out = g_string_new(TRACE_MAGIC);
+  gboolean ok;
+
+  for (guint i = 0; i < trace->events->len; i++) {
+    TraceEvent *event = &g_array_index(trace->events, TraceEvent, i);
+    gchar *escaped = NULL;
+
+    g_string_append_printf(out, "%" G_GINT64_FORMAT "\t", event->delay);
+
+    switch (event->type) {
+    case TRACE_PAGE:
+      escaped = g_strescape(event->text, NULL);
+      g_string_append_printf(out, "p\t%s\n", escaped);
+      break;
+    case TRACE_INSERT:
+      escaped = g_strescape(event->text, NULL);
+      g_string_append_printf(out, "i\t%d\t%s\n", event->start, escaped);
+      break;
+    case TRACE_DELETE:
+      g_string_append_printf(out, "d\t%d\t%d\n", event->start, event->end);
+      break;
+    }
+
+    g_free(escaped);
+  }
+
+  ok = g_file_set_contents(path, out->str, out->len, error);
+  g_string_free(out, TRUE);
+
+  return ok;
+}
+
+static gboolean
+parse_event(gchar *line, TraceEvent *event)
+{
+  gchar **fields = g_strsplit(line, "\t", 4);
+  guint n = g_strv_length(fields);
+  gboolean ok = n >= 3 && strlen(fields[1]) == 1;
+
+  if (ok) {
+    event->delay = g_ascii_strtoll(fields[0], NULL, 10);
+
+    switch (fields[1][0]) {
+    case 'p':
+      event->type = TRACE_PAGE;
+      event->text = g_strcompress(fields[2]);
+      break;
+    case 'i':
+      ok = n == 4;
+      event->type = TRACE_INSERT;
+      event->start = atoi(fields[2]);
+      event->text = ok ? g_strcompress(fields[3]) : NULL;
+      break;
+    case 'd':
+      ok = n == 4;
+      event->type = TRACE_DELETE;
+      event->start = atoi(fields[2]);
+      event->end = ok ? atoi(fields[3]) : 0;
+      break;
+    default:
+      ok = FALSE;
+    }
+  }
+
+  g_strfreev(fields);
+
+  return ok;
+}
+
+Trace *
+trace_read(const gchar *path, GError **error)
+{
+  Trace *trace;
+  gchar *data;
+  gchar *line;
+  gchar *next;
+  gsize len;
+  guint n = 1;
+
+  if (!g_file_get_contents(path, &data, &len, error)) {
+    return NULL;
+  }
+
+  if (!g_str_has_prefix(data, TRACE_MAGIC)) {
+    g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                "%s is not a trace", path);
+    g_free(data);
+    return NULL;
+  }
+
+  trace = trace_new();
+
+  for (line = data + strlen(TRACE_MAGIC); *line != '\0'; line = next) {
+    TraceEvent event = { 0 };
+
+    next = strchr(line, '\n');
+    if (next != NULL) {
+      *next++ = '\0';
+    } else {
+      next = line + strlen(line);
+    }
+    n++;
+
+    if (!parse_event(line, &event)) {
+      g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                  "Bad event on line %u of %s", n, path);
+      clear_event(&event);
+      trace_free(trace);
+      g_free(data);
+      return NULL;
+    }
+
+    g_array_append_val(trace->events, event);
+  }
+
+  g_free(data);
+
+  return trace;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Editing sessions are recorded when this names the file to write them to */
+#define TRACE_ENV "RPGEDITOR_TRACE"
+
+typedef enum {
+  /* Following edits are to the page called text */
+  TRACE_PAGE = 0,
+  TRACE_INSERT,
+  TRACE_DELETE,
+} TraceEventType;
+
+/*
+ * One edit of a page. Offsets are in characters, like GtkTextIter offsets.
+ * In a file every event is a line of tab separated fields:
+ *
+ *   delay<TAB>p<TAB>heading
+ *   delay<TAB>i<TAB>offset<TAB>text
+ *   delay<TAB>d<TAB>start<TAB>end
+ *
+ * delay is the time since the previous event in microseconds. Text is
+ * escaped with g_strescape().
+ */
+typedef struct {
+  TraceEventType type;
+  gint64 delay;
+  gint start;
+  gint end;
+  gchar *text;
+} TraceEvent;
+
+typedef struct {
+  GArray *events;
+  gint64 last_time;
+  gchar *page;
+} Trace;
+
+Trace *trace_new(void);
+
+void trace_free(Trace *trace);
+
+void trace_insert(Trace *trace,
+                  const gchar *page,
+                  gint offset,
+                  const gchar *text,
+                  gint len);
+
+void trace_delete(Trace *trace, const gchar *page, gint start, gint end);
+
+gboolean trace_write(Trace *trace, const gchar *path, GError **error);
+
+Trace *trace_read(const gchar *path, GError **error);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(Trace, trace_free)
+
+G_END_DECLS
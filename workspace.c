@@ -0,0 +1,529 @@
+/* For syncfs() */
+#define _GNU_SOURCE
+
+#include "workspace.h"
+#include "manifest.h"
+#include "page.h"
+#include <gio/gio.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* Inserted before the extension of the second slot of a page */
+#define SLOT_B ".b"
+
+struct _WorkspaceCommit {
+  gchar *base_path;
+  ManifestCompression compression;
+  /* The live manifest, NULL in a new workspace */
+  Manifest *current;
+  /* Files named by the current and new manifests */
+  GHashTable *current_files;
+  GHashTable *new_files;
+  GString *manifest;
+  gboolean written;
+};
+
+static gboolean
+is_empty(const gchar *base_path, GError **error)
+{
+  GDir *dir;
+  gboolean empty;
+
+  dir = g_dir_open(base_path, 0, error);
+  if (dir == NULL) {
+    return FALSE;
+  }
+
+  empty = g_dir_read_name(dir) == NULL;
+  g_dir_close(dir);
+
+  if (!empty) {
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_EMPTY,
+                "%s is not empty and has no manifest", base_path);
+  }
+
+  return empty;
+}
+
+WorkspaceCommit *
+workspace_commit_begin(const gchar *base_path,
+                       ManifestCompression compression,
+                       GError **error)
+{
+  WorkspaceCommit *commit;
+  GError *lerr = NULL;
+  Manifest *current;
+
+  current = manifest_load(base_path, &lerr);
+  if (current == NULL) {
+    if (!g_error_matches(lerr, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+      g_propagate_error(error, lerr);
+      return NULL;
+    }
+    g_clear_error(&lerr);
+
+    if (!is_empty(base_path, error)) {
+      return NULL;
+    }
+  }
+
+  commit = g_malloc0(sizeof(*commit));
+  commit->base_path = g_strdup(base_path);
+  commit->compression = compression;
+  commit->current = current;
+  commit->current_files = g_hash_table_new(g_str_hash, g_str_equal);
+  commit->new_files = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                            NULL);
+  commit->manifest = manifest_begin(compression);
+
+  for (guint i = 0; current != NULL && i < current->entries->len; i++) {
+    ManifestEntry *entry = &g_array_index(current->entries, ManifestEntry, i);
+
+    g_hash_table_add(commit->current_files, (gpointer) entry->file);
+  }
+
+  return commit;
+}
+
+const ManifestEntry *
+workspace_commit_find(WorkspaceCommit *commit, guint id, const gchar *heading)
+{
+  if (commit->current == NULL ||
+      commit->current->compression != commit->compression) {
+    return NULL;
+  }
+
+  for (guint i = 0; i < commit->current->entries->len; i++) {
+    ManifestEntry *entry = &g_array_index(commit->current->entries,
+                                          ManifestEntry, i);
+    gchar *path;
+    gboolean exists;
+
+    /* The heading is the first line of the file */
+    if (entry->id != id || g_strcmp0(entry->heading, heading) != 0 ||
+        entry->hash == NULL || entry->hash[0] == '\0') {
+      continue;
+    }
+
+    path = g_build_filename(commit->base_path, entry->file, NULL);
+    exists = g_file_test(path, G_FILE_TEST_IS_REGULAR);
+    g_free(path);
+
+    return exists ? entry : NULL;
+  }
+
+  return NULL;
+}
+
+/* A slot for a page called name that no manifest is using. Different
+ * headings can give the same name once made ASCII, later ones get a
+ * counter. */
+static gchar *
+free_slot(WorkspaceCommit *commit, const gchar *name)
+{
+  const gchar *suffix;
+  const gchar *slots[] = { "", SLOT_B };
+  gchar *base;
+
+  suffix = commit->compression == MANIFEST_COMPRESSION_GZIP ? ".md.gz"
+                                                            : ".md";
+
+  base = g_strdup(name);
+  g_strdelimit(base, "/\\:", '_');
+
+  for (guint n = 0;; n++) {
+    gchar *stem = n == 0 ? g_strdup(base) : g_strdup_printf("%s-%u", base, n);
+
+    for (guint i = 0; i < G_N_ELEMENTS(slots); i++) {
+      gchar *file = g_strconcat(stem, slots[i], suffix, NULL);
+
+      if (!g_hash_table_contains(commit->current_files, file) &&
+          !g_hash_table_contains(commit->new_files, file)) {
+        g_free(stem);
+        g_free(base);
+        return file;
+      }
+      g_free(file);
+    }
+
+    g_free(stem);
+  }
+}
+
+GOutputStream *
+workspace_commit_open(WorkspaceCommit *commit,
+                      const gchar *name,
+                      gchar **file,
+                      GError **error)
+{
+  GFileOutputStream *out;
+  GOutputStream *stream;
+  gchar *slot;
+  gchar *path;
+  GFile *gfile;
+
+  slot = free_slot(commit, name);
+
+  /* Taken even if writing fails, so no other page picks it */
+  g_hash_table_add(commit->new_files, g_strdup(slot));
+  commit->written = TRUE;
+
+  path = g_build_filename(commit->base_path, slot, NULL);
+  gfile = g_file_new_for_path(path);
+
+  /* A free slot is not live, whatever is left in it from an earlier save
+   * goes. Created in place, it is synced with the others. */
+  g_unlink(path);
+  out = g_file_create(gfile, G_FILE_CREATE_NONE, NULL, error);
+
+  g_object_unref(gfile);
+  g_free(path);
+
+  if (out == NULL) {
+    g_free(slot);
+    return NULL;
+  }
+
+  if (commit->compression == MANIFEST_COMPRESSION_GZIP) {
+    GConverter *compressor;
+
+    compressor = G_CONVERTER(g_zlib_compressor_new(
+      G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1));
+    stream = g_converter_output_stream_new(G_OUTPUT_STREAM(out), compressor);
+    g_object_unref(compressor);
+    g_object_unref(out);
+  } else {
+    stream = G_OUTPUT_STREAM(out);
+  }
+
+  *file = slot;
+
+  return stream;
+}
+
+void
+workspace_commit_add(WorkspaceCommit *commit, const ManifestEntry *entry)
+{
+  g_hash_table_add(commit->new_files, g_strdup(entry->file));
+  manifest_append(commit->manifest, entry);
+}
+
+/* One sync for all the pages instead of one per file */
+static gboolean
+sync_pages(const gchar *base_path, GError **error)
+{
+#ifdef __linux__
+  gint fd;
+  gint saved_errno;
+
+  fd = g_open(base_path, O_RDONLY | O_DIRECTORY, 0);
+  if (fd < 0 || syncfs(fd) != 0) {
+    saved_errno = errno;
+    if (fd >= 0) {
+      close(fd);
+    }
+    g_set_error(error, G_IO_ERROR, g_io_error_from_errno(saved_errno),
+                "Could not sync %s: %s", base_path, g_strerror(saved_errno));
+    return FALSE;
+  }
+  close(fd);
+#else
+  (void) base_path;
+  (void) error;
+  sync();
+#endif
+
+  return TRUE;
+}
+
+gboolean
+workspace_commit_finish(WorkspaceCommit *commit, GError **error)
+{
+  if (commit->written && !sync_pages(commit->base_path, error)) {
+    return FALSE;
+  }
+
+  if (!manifest_commit(commit->base_path, commit->manifest, error)) {
+    return FALSE;
+  }
+
+  /* Committed, the files of the old workspace are no longer needed */
+  for (guint i = 0;
+       commit->current != NULL && i < commit->current->entries->len; i++) {
+    ManifestEntry *entry = &g_array_index(commit->current->entries,
+                                          ManifestEntry, i);
+    gchar *path;
+
+    if (g_hash_table_contains(commit->new_files, entry->file)) {
+      continue;
+    }
+
+    path = g_build_filename(commit->base_path, entry->file, NULL);
+    g_unlink(path);
+    g_free(path);
+  }
+
+  return TRUE;
+}
+
+GString *
+workspace_commit_manifest(WorkspaceCommit *commit)
+{
+  return commit->manifest;
+}
+
+void
+workspace_commit_free(WorkspaceCommit *commit)
+{
+  if (commit == NULL) {
+    return;
+  }
+
+  g_clear_pointer(&commit->current, manifest_free);
+  g_hash_table_unref(commit->current_files);
+  g_hash_table_unref(commit->new_files);
+  g_string_free(commit->manifest, TRUE);
+  g_free(commit->base_path);
+  g_free(commit);
+}
+
+/* Streams a gzip page file through the decompressor into one buffer */
+static gboolean
+read_compressed(const gchar *filename,
+                gchar **content,
+                gsize *size,
+                GError **error)
+{
+  GFile *file;
+  GFileInputStream *in;
+  GConverter *decompressor;
+  GInputStream *stream;
+  GOutputStream *mem;
+  gboolean ok;
+
+  file = g_file_new_for_path(filename);
+  in = g_file_read(file, NULL, error);
+  g_object_unref(file);
+  if (in == NULL) {
+    return FALSE;
+  }
+
+  decompressor = G_CONVERTER(g_zlib_decompressor_new(
+    G_ZLIB_COMPRESSOR_FORMAT_GZIP));
+  stream = g_converter_input_stream_new(G_INPUT_STREAM(in), decompressor);
+  mem = g_memory_output_stream_new_resizable();
+
+  /* NUL terminated like g_file_get_contents() */
+  ok = g_output_stream_splice(mem, stream,
+                              G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE, NULL,
+                              error) >= 0 &&
+       g_output_stream_write_all(mem, "", 1, NULL, NULL, error) &&
+       g_output_stream_close(mem, NULL, error);
+
+  if (ok) {
+    GMemoryOutputStream *out = G_MEMORY_OUTPUT_STREAM(mem);
+
+    *size = g_memory_output_stream_get_data_size(out) - 1;
+    *content = g_memory_output_stream_steal_data(out);
+  }
+
+  g_object_unref(mem);
+  g_object_unref(stream);
+  g_object_unref(decompressor);
+  g_object_unref(in);
+
+  return ok;
+}
+
+gboolean
+workspace_read_file(const gchar *filename,
+                    gchar **contents,
+                    gsize *length,
+                    GError **error)
+{
+  if (g_str_has_suffix(filename, ".gz")) {
+    return read_compressed(filename, contents, length, error);
+  }
+
+  return g_file_get_contents(filename, contents, length, error);
+}
+
+GPtrArray *
+workspace_load(const gchar *base_path,
+               ManifestCompression *compression,
+               GError **error)
+{
+  g_autoptr(Manifest) manifest = NULL;
+  GPtrArray *pages;
+
+  manifest = manifest_load(base_path, error);
+  if (manifest == NULL) {
+    return NULL;
+  }
+
+  pages = g_ptr_array_new_with_free_func((GDestroyNotify) page_free);
+
+  for (guint i = 0; i < manifest->entries->len; i++) {
+    ManifestEntry *entry = &g_array_index(manifest->entries, ManifestEntry, i);
+    gchar *filename;
+    gchar *data = NULL;
+    gsize len = 0;
+    Page *page = NULL;
+
+    filename = g_build_filename(base_path, entry->file, NULL);
+    if (workspace_read_file(filename, &data, &len, error)) {
+      page = page_parse(data, len, error);
+    }
+    g_free(data);
+    g_free(filename);
+
+    if (page == NULL) {
+      g_prefix_error(error, "%s: ", entry->file);
+      g_ptr_array_unref(pages);
+      return NULL;
+    }
+
+    page->id = entry->id;
+    page->color = entry->color != NULL && entry->color[0] != '\0'
+                    ? g_strdup(entry->color)
+                    : NULL;
+    g_ptr_array_add(pages, page);
+  }
+
+  if (compression != NULL) {
+    *compression = manifest->compression;
+  }
+
+  return pages;
+}
+
+gboolean
+workspace_save(const gchar *base_path,
+               GPtrArray *pages,
+               ManifestCompression compression,
+               GError **error)
+{
+  g_autoptr(WorkspaceCommit) commit = NULL;
+  guint last_id = 0;
+  gboolean ok = TRUE;
+
+  commit = workspace_commit_begin(base_path, compression, error);
+  if (commit == NULL) {
+    return FALSE;
+  }
+
+  for (guint i = 0; i < pages->len; i++) {
+    last_id = MAX(last_id, ((Page *) g_ptr_array_index(pages, i))->id);
+  }
+
+  for (guint i = 0; ok && i < pages->len; i++) {
+    Page *page = g_ptr_array_index(pages, i);
+    ManifestEntry entry = { 0 };
+    GOutputStream *stream;
+    GString *md;
+    gchar *name;
+    gchar *file = NULL;
+    gchar *hash;
+
+    if (page->id == 0) {
+      page->id = ++last_id;
+    }
+
+    md = page_to_md(page);
+    hash = g_compute_checksum_for_data(G_CHECKSUM_SHA256,
+                                       (const guchar *) md->str, md->len);
+    name = g_str_to_ascii(page->heading, NULL);
+
+    stream = workspace_commit_open(commit, name, &file, error);
+    ok = stream != NULL &&
+         g_output_stream_write_all(stream, md->str, md->len, NULL, NULL,
+                                   error) &&
+         g_output_stream_close(stream, NULL, error);
+
+    if (ok) {
+      entry.id = page->id;
+      entry.order = i;
+      entry.file = file;
+      entry.color = page->color;
+      entry.length = md->len;
+      entry.hash = hash;
+      entry.heading = page->heading;
+      workspace_commit_add(commit, &entry);
+    }
+
+    g_clear_object(&stream);
+    g_free(file);
+    g_free(name);
+    g_free(hash);
+    g_string_free(md, TRUE);
+  }
+
+  return ok && workspace_commit_finish(commit, error);
+}
+
+gboolean
+workspace_view_load(const gchar *base_path,
+                    WorkspaceView *view,
+                    GError **error)
+{
+  GError *lerr = NULL;
+  gchar *path;
+  gchar *data = NULL;
+  gchar **lines;
+
+  *view = (WorkspaceView) { 0 };
+
+  path = g_build_filename(base_path, WORKSPACE_VIEW_FILE, NULL);
+  if (!g_file_get_contents(path, &data, NULL, &lerr)) {
+    g_free(path);
+    if (g_error_matches(lerr, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+      g_clear_error(&lerr);
+      return TRUE;
+    }
+    g_propagate_error(error, lerr);
+    return FALSE;
+  }
+  g_free(path);
+
+  /* Unknown lines are skipped, for views that record more later */
+  lines = g_strsplit(data, "\n", -1);
+  for (guint i = 0; lines[i] != NULL; i++) {
+    gchar **fields = g_strsplit(lines[i], "\t", 2);
+
+    if (fields[0] != NULL && fields[1] != NULL) {
+      if (g_str_equal(fields[0], "page")) {
+        view->page_id = strtoul(fields[1], NULL, 10);
+      } else if (g_str_equal(fields[0], "top")) {
+        view->top = MAX(atoi(fields[1]), 0);
+      }
+    }
+    g_strfreev(fields);
+  }
+  g_strfreev(lines);
+  g_free(data);
+
+  return TRUE;
+}
+
+gboolean
+workspace_view_save(const gchar *base_path,
+                    const WorkspaceView *view,
+                    GError **error)
+{
+  gchar *path;
+  gchar *data;
+  gboolean ok;
+
+  path = g_build_filename(base_path, WORKSPACE_VIEW_FILE, NULL);
+  data = g_strdup_printf("page\t%u\ntop\t%d\n", view->page_id, view->top);
+  ok = g_file_set_contents(path, data, -1, error);
+  g_free(data);
+  g_free(path);
+
+  return ok;
+}
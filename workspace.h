@@ -0,0 +1,94 @@
+#pragma once
+
+#include "manifest.h"
+#include "page.h"
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Saves a workspace so that the folder always holds either the old or the
+ * new workspace, never a mix.
+ *
+ * Every page has two slot files, "<name>.md" and "<name>.b.md" (or .md.gz),
+ * and the manifest names the live one. Pages whose names collide get
+ * "<name>-<n>" slots instead. A save writes each changed page to a slot the
+ * current manifest does not use, syncs all of them in one go and then
+ * atomically replaces the manifest, which is the commit point. Files only
+ * the old manifest used are removed afterwards.
+ */
+typedef struct _WorkspaceCommit WorkspaceCommit;
+
+/* Fails if base_path has no manifest and is not empty */
+WorkspaceCommit *workspace_commit_begin(const gchar *base_path,
+                                        ManifestCompression compression,
+                                        GError **error);
+
+/* The entry of page id in the current manifest if its file can be kept for
+ * a page that did not change since. Valid until the commit is freed. */
+const ManifestEntry *workspace_commit_find(WorkspaceCommit *commit,
+                                           guint id,
+                                           const gchar *heading);
+
+/* Creates the free slot file of a page called name, compressed if the
+ * workspace is. file is set to the name for its manifest entry. */
+GOutputStream *workspace_commit_open(WorkspaceCommit *commit,
+                                     const gchar *name,
+                                     gchar **file,
+                                     GError **error);
+
+void workspace_commit_add(WorkspaceCommit *commit,
+                          const ManifestEntry *entry);
+
+/* Syncs the written pages and swaps in the new manifest */
+gboolean workspace_commit_finish(WorkspaceCommit *commit, GError **error);
+
+/* The manifest as written by workspace_commit_finish() */
+GString *workspace_commit_manifest(WorkspaceCommit *commit);
+
+void workspace_commit_free(WorkspaceCommit *commit);
+
+/* Reads a page file whole, decompressing it if the name ends in ".gz". The
+ * contents are NUL terminated like with g_file_get_contents(). */
+gboolean workspace_read_file(const gchar *filename,
+                             gchar **contents,
+                             gsize *length,
+                             GError **error);
+
+/* The pages of the workspace in base_path in manifest order, as a GPtrArray
+ * of Page. compression may be NULL. */
+GPtrArray *workspace_load(const gchar *base_path,
+                          ManifestCompression *compression,
+                          GError **error);
+
+/* Writes pages as a new save of base_path, pages without an id get one */
+gboolean workspace_save(const gchar *base_path,
+                        GPtrArray *pages,
+                        ManifestCompression compression,
+                        GError **error);
+
+/* Kept next to the manifest, outside of saves and snapshots */
+#define WORKSPACE_VIEW_FILE "view.tab"
+
+/*
+ * Where the workspace was left: the page shown and the character offset at
+ * the top of its view. page_id is 0 if nothing was recorded.
+ */
+typedef struct {
+  guint page_id;
+  gint top;
+} WorkspaceView;
+
+/* Fills view in from base_path, all zero if there is no view file */
+gboolean workspace_view_load(const gchar *base_path,
+                             WorkspaceView *view,
+                             GError **error);
+
+gboolean workspace_view_save(const gchar *base_path,
+                             const WorkspaceView *view,
+                             GError **error);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(WorkspaceCommit, workspace_commit_free)
+
+G_END_DECLS